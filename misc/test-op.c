@@ -51,6 +51,7 @@
 #include "op-val-support.h"
 #include "op-val.h"
 
+#include "instr-len.h"
 
 #include "parse.h"
 #include "big-int.h"
@@ -2817,6 +2818,185 @@ void test_sim()
 }
 
 
+/***/
+
+/* instruction lengths -- spec_len() on the disassembler test cases, then
+   instr_bounds()/instr_len() on a few whole instructions
+
+   '!' marks the test cases that are reserved addressing modes (6F, 4F, ...)
+   which the disassembler shows anyway.
+ */
+void test_len()
+{
+	printf("Lengths\n");
+	printf("-------\n");
+	for (unsigned i=0; i < ARRAY_SIZE(dis_vax); i++) {
+		struct test_dis_case	test = dis_vax[i];
+		int			len  = spec_len(test.b, test.width);
+
+		for (int j=0; j < (int) sizeof(test.b); j++) {
+			if (j < test.cnt)
+				printf("%02X ", test.b[j]);
+			else
+				printf("   ");
+		}
+		printf("%2d %3d%s\n", test.width, len, (len == test.cnt) ? "" : " !");
+	}
+	printf("\n");
+
+	static const uint8_t	code[] = {
+		0xD0, 0x50, 0x51,					/* MOVL    r0, r1			*/
+		0x12, 0xFE,						/* BNEQ    .				*/
+		0x9A, 0x8F, 0x41, 0x50,					/* MOVZBL  I^#0x41, r0			*/
+		0xC1, 0x44, 0xAF, 0x10, 0x8F, 0x00, 0x01, 0x00, 0x00, 0x52,
+									/* ADDL3   B^x[r4], I^#0x100, r2	*/
+		0x7D, 0x8F, 1, 2, 3, 4, 5, 6, 7, 8, 0x50,		/* MOVQ    I^#..., r0			*/
+		0xFD, 0x50, 0x8F, 1, 2, 3, 4, 5, 6, 7, 8, 0x50,		/* MOVG    I^#..., r0			*/
+		0xE8, 0x44, 0x60, 0x02,					/* BLBS    (r0)[r4], .+2		*/
+		0x31, 0x00, 0x10,					/* BRW     .+0x1003			*/
+		0xFD, 0x60,						/* reserved instruction			*/
+	};
+	unsigned	ofs[ARRAY_SIZE(code)+1];
+	unsigned	cnt = instr_bounds(code, sizeof(code), ARRAY_SIZE(code), ofs);
+
+	for (unsigned i=0; i < cnt; i++) {
+		for (unsigned j=ofs[i]; j < ofs[i+1]; j++)
+			printf("%02X ", code[j]);
+		printf("\n");
+	}
+	printf("stopped at %u of %u: %d\n", ofs[cnt], (unsigned) sizeof(code), instr_len(code + ofs[cnt], sizeof(code) - ofs[cnt]));
+
+	/* reserved addressing mode, instructions that don't fit */
+	static const struct {
+		uint8_t		b[4];
+		unsigned	avail;
+	} odd[] = {
+		{{0xD0, 0x6F, 0x50}, 3},	/* MOVL    (pc), r0		*/
+		{{0xD0, 0x44, 0x8F}, 3},	/* MOVL    I^#[r4]		*/
+		{{0xD0, 0x50},       2},	/* MOVL    r0			*/
+		{{0xD0, 0x44},       2},	/* MOVL    [r4]			*/
+		{{0x12},             1},	/* BNEQ				*/
+		{{0xFD},             1},
+		{{0xFC, 0x00},       2},	/* XFC				*/
+	};
+
+	for (unsigned i=0; i < ARRAY_SIZE(odd); i++) {
+		for (unsigned j=0; j < 4; j++) {
+			if (j < odd[i].avail)
+				printf("%02X ", odd[i].b[j]);
+			else
+				printf("   ");
+		}
+		printf("%2d\n", instr_len(odd[i].b, odd[i].avail));
+	}
+	printf("\n");
+}
+
+
+/* instr_len() against a slow reference that decodes each operand with
+   op_sim() and op_val(), on random bytes.  instr_len() must also say 0 for
+   every shorter avail.
+
+   The random numbers come from a fixed xorshift seed, so the counts are the
+   same on every run.
+ */
+#define LEN_BUF		128	/* longer than any instruction */
+
+static uint32_t	len_seed = 2463534242u;
+
+uint32_t len_rnd()
+{
+	len_seed ^= len_seed << 13;
+	len_seed ^= len_seed >> 17;
+	len_seed ^= len_seed << 5;
+	return len_seed;
+}
+
+
+/* op_val() says no because of the registers, not the addressing mode --
+   check_reg()/check_idx().  That is unpredictable rather than reserved,
+   instr_len() leaves it to the callers.
+ */
+bool len_regs(const uint8_t *b)
+{
+	if ((b[0] & 0xF0) == 0x50)
+		return true;
+	if (((b[0] & 0xF0) != 0x40) || (b[0] == 0x4F) || (b[1] == 0x7F) || (b[1] == 0x8F))
+		return false;
+	return ((b[1] & 0xF0) == 0x70) || ((b[1] & 0xF0) == 0x80) || ((b[1] & 0xF0) == 0x90);
+}
+
+
+/* b[] has MAX_OPLEN bytes of slack after avail for op_sim() */
+int len_ref(uint8_t *b, unsigned avail)
+{
+	unsigned	two = b[0] == 0xFD;
+	unsigned	op  = two ? 0x100 | b[1] : b[0];
+
+	if (((b[0] >= 0xFC) && !two) || !mne[op][0])
+		return -1;
+
+	unsigned	len = 1 + two;
+
+	for (unsigned i=0; i < op_cnt[op]; i++) {
+		if (ops[op][i*3] == 'b') {
+			len += op_width[op][i];
+			continue;
+		}
+
+		struct fields	fields;
+		struct sim_ret	r;
+
+		memset(&fields, 0xFF, sizeof(fields));
+		r = op_sim(b + len, &fields, op_width[op][i], op_ifp[op][i]);
+		if (r.cnt <= 0)
+			return -1;
+		if (!op_val(b + len, op_width[op][i]) && !len_regs(b + len))
+			return -1;
+		len += r.cnt;
+	}
+	return (len > avail) ? 0 : (int) len;
+}
+
+
+void test_len_random(unsigned cnt)
+{
+	static uint8_t	b[LEN_BUF + MAX_OPLEN];
+	unsigned	instrs = 0, reserved = 0, bad = 0;
+
+	printf("Lengths, random\n");
+	printf("---------------\n");
+	for (unsigned i=0; i < cnt; i++) {
+		for (unsigned j=0; j < LEN_BUF; j++)
+			b[j] = len_rnd();
+		if (i & 1)
+			b[0] = 0xFD;		/* half of them two-byte opcodes */
+
+		int	ref = len_ref(b, LEN_BUF);
+		int	len = instr_len(b, LEN_BUF);
+		bool	ok  = len == ref;
+
+		for (unsigned j=0; ok && ((int) j < ref); j++)
+			ok = instr_len(b, j) == 0;
+
+		if (ref > 0)
+			instrs++;
+		else
+			reserved++;
+		if (ok)
+			continue;
+		if (bad++ < 10) {
+			printf("instr_len() %d, op_sim() %d:", len, ref);
+			for (int j=0; j < ((ref > 0) ? ref : 8); j++)
+				printf(" %02X", b[j]);
+			printf("\n");
+		}
+	}
+	printf("%u buffers, %u instructions, %u reserved, %u wrong\n", cnt, instrs, reserved, bad);
+	printf("\n");
+}
+
+
 /***/
 
 /* Crappy benchmarking of operand handling.
@@ -3353,8 +3533,9 @@ void help()
 	fprintf(stderr, "./test-op <mode>\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, " mode:\n");
-	fprintf(stderr, "   --built-in        built-in test of asm/dis/sim\n");
+	fprintf(stderr, "   --built-in        built-in test of asm/dis/sim/lengths\n");
 	fprintf(stderr, "   --built-in-parse  built-in test of parse_bigint/parse_fp\n");
+	fprintf(stderr, "   --built-in-len    instr_len() against op_sim() on random bytes\n");
 	fprintf(stderr, "   --time            time op_asm+op_dis+op_sim+op_val\n");
 	fprintf(stderr, "   --time-asm        time op_asm\n");
 	fprintf(stderr, "   --time-dis        time op_dis\n");
@@ -3385,8 +3566,11 @@ int main(int argc, char *argv[argc])
 		test_asm();
 		test_dis();
 		test_sim();
+		test_len();
 	} else if (strcmp(argv[1], "--built-in-parse") == 0) {
 		test_parse();
+	} else if (strcmp(argv[1], "--built-in-len") == 0) {
+		test_len_random(1000000);
 
 	} else if (strcmp(argv[1], "--time") == 0) {
 		time_op();
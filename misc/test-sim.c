@@ -0,0 +1,723 @@
+/* Copyright 2018  Peter Lund <firefly@vax64.dk>
+
+   Licensed under GPL v2.
+
+   ---
+
+   Test bench for the simulator's internal data structures.
+
+   The simulator is a single translation unit of static functions, so it is
+   included whole, with its main() renamed out of the way.  Every test prints
+   what it sees, misc/test-sim.expected has the right answers.
+ */
+
+#define main	sim_main
+#include "sim.c"
+#undef main
+
+
+/***/
+
+static void jnl_show(struct cpu *cpu, const char *what)
+{
+	printf("  %-24s", what);
+	for (int i=0; i < 8; i++)
+		printf(" r%d=%X", i, cpu->r[i]);
+	printf("\n");
+}
+
+
+/* instruction k bumps r(k & 7) at µop idx */
+static void jnl_instr(struct cpu *cpu, int k, int idx)
+{
+	jnl_log(cpu, k & 7, idx);
+	cpu->r[k & 7] += 0x10;
+}
+
+
+static void jnl_setup(struct cpu *cpu)
+{
+	jnl_commit(cpu);
+	for (int i=0; i < 8; i++)
+		cpu->r[i] = i;
+}
+
+
+/* a trace of cnt one-µop instructions that side exits in its last one --
+   keep the last entry, roll it back */
+static void jnl_trace(struct cpu *cpu, int cnt)
+{
+	char	buf[40];
+
+	jnl_setup(cpu);
+	for (int k=0; k < cnt; k++)
+		jnl_instr(cpu, k, k);
+	jnl_keep(cpu, cnt - 1);
+	jnl_rollback(cpu);
+	sprintf(buf, "%d instrs, keep 1", cnt);
+	jnl_show(cpu, buf);
+}
+
+
+static void test_jnl(void)
+{
+	static struct cpu	cpu;
+
+	printf("journal\n");
+	assert((JNL_CNT & (JNL_CNT-1)) == 0);
+
+	/* plain rollback */
+	jnl_setup(&cpu);
+	jnl_instr(&cpu, 1, 0);
+	jnl_instr(&cpu, 1, 1);
+	jnl_instr(&cpu, 2, 2);
+	jnl_rollback(&cpu);
+	jnl_show(&cpu, "rollback");
+
+	/* commit */
+	jnl_setup(&cpu);
+	jnl_instr(&cpu, 1, 0);
+	jnl_commit(&cpu);
+	jnl_instr(&cpu, 2, 0);
+	jnl_rollback(&cpu);
+	jnl_show(&cpu, "commit, rollback");
+
+	/* side exits with and without the ring having wrapped */
+	jnl_trace(&cpu, 3);
+	jnl_trace(&cpu, JNL_CNT);
+	jnl_trace(&cpu, JNL_CNT + 1);
+	jnl_trace(&cpu, JNL_CNT + 5);
+
+	/* the kept range wraps: 10 entries, the last 3 are kept (slots 7, 0, 1),
+	   r7 once, r0 and r1 twice (once committed, once kept) */
+	jnl_setup(&cpu);
+	for (int k=0; k < 10; k++)
+		jnl_instr(&cpu, k, k);
+	jnl_keep(&cpu, 7);
+	jnl_show(&cpu, "wrap, keep 3");
+	jnl_rollback(&cpu);
+	jnl_show(&cpu, "wrap, rollback");
+
+	/* keep, then more entries from the exe/post phase, then rollback */
+	jnl_setup(&cpu);
+	for (int k=0; k < 10; k++)
+		jnl_instr(&cpu, k, k);
+	jnl_keep(&cpu, 9);
+	jnl_instr(&cpu, 3, 10);
+	jnl_instr(&cpu, 4, 11);
+	jnl_rollback(&cpu);
+	jnl_show(&cpu, "keep 1, log 2, rollback");
+
+	/* keep nothing, keep everything */
+	jnl_setup(&cpu);
+	for (int k=0; k < 4; k++)
+		jnl_instr(&cpu, k, k);
+	jnl_keep(&cpu, 4);
+	jnl_rollback(&cpu);
+	jnl_show(&cpu, "keep 0, rollback");
+
+	jnl_setup(&cpu);
+	for (int k=0; k < 4; k++)
+		jnl_instr(&cpu, k, k + 1);
+	jnl_keep(&cpu, 0);
+	jnl_rollback(&cpu);
+	jnl_show(&cpu, "keep all, rollback");
+	printf("\n");
+}
+
+
+/***/
+
+#define PTE(v, prot, m, pfn)	(((uint32_t) (v) << 31) | ((uint32_t) (prot) << 27) | \
+				 ((m) ? PTE_M : 0) | (pfn))
+#define PROT_KW		2
+#define PROT_UW		4
+#define PROT_ERKW	6
+#define PROT_UR		15
+
+#define S0(n)		(0x80000000 + (n) * MEM_PAGE_SZE)
+#define P0(n)		((n) * MEM_PAGE_SZE)
+
+
+static void tlb_mode(struct cpu *cpu, int mode)
+{
+	cpu->r[R_PSL] = (cpu->r[R_PSL] & ~(3u << 24)) | ((uint32_t) mode << 24);
+}
+
+
+/* an access through the data TLB: was the page there, what did it give */
+static void tlb_try(struct cpu *cpu, const char *what, uint32_t va, int write)
+{
+	struct tlb_entry	*e;
+	int			 err = 0;
+	bool			 hit = tlb_lookup(&cpu->dtlb, va) != NULL;
+
+	printf("  %-26s %-4s %s  ", what, hit ? "hit" : "miss", write ? "W" : "R");
+	if (tlb_xlat(cpu, &cpu->dtlb, va, write, &e, &err))
+		printf("pfn %03X rights %02X\n", e->pfn, e->rights);
+	else
+		printf("fault %03X\n", err);
+}
+
+
+/* which of the test pages are in the data TLB */
+static void tlb_show(struct cpu *cpu, const char *what)
+{
+	static const struct {
+		const char	*name;
+		uint32_t	 va;
+	} page[] = {
+		{"S0:0", S0(0)}, {"S0:1", S0(1)}, {"S0:2", S0(2)}, {"S0:64", S0(64)},
+		{"S0:128", S0(128)}, {"P0:0", P0(0)}, {"P0:1", P0(1)},
+	};
+
+	printf("  %-26s", what);
+	for (unsigned i=0; i < ARRAY_SIZE(page); i++)
+		printf(" %s%s", page[i].name, tlb_lookup(&cpu->dtlb, page[i].va) ? "+" : "-");
+	printf("\n");
+}
+
+
+static void test_tlb(void)
+{
+	static struct cpu	cpu;
+	uint32_t		pte;
+
+	printf("tlb\n");
+	cpu_init(&cpu);
+	mem_init(&cpu, 64*1024);
+
+	/* system page table at 0x4000, the P0 page table in S0 page 4 */
+	phys_st32(cpu.mem, 0x4000 +   0*4, PTE(1, PROT_KW,   0, 10));
+	phys_st32(cpu.mem, 0x4000 +   1*4, PTE(1, PROT_UR,   1, 11));
+	phys_st32(cpu.mem, 0x4000 +   2*4, PTE(1, PROT_ERKW, 1, 12));
+	phys_st32(cpu.mem, 0x4000 +   3*4, PTE(0, PROT_KW,   0, 0));
+	phys_st32(cpu.mem, 0x4000 +   4*4, PTE(1, PROT_KW,   1, 16));
+	phys_st32(cpu.mem, 0x4000 +  64*4, PTE(1, PROT_KW,   1, 10));
+	phys_st32(cpu.mem, 0x4000 + 128*4, PTE(1, PROT_KW,   1, 10));
+	phys_st32(cpu.mem, 16 * MEM_PAGE_SZE + 0*4, PTE(1, PROT_UW, 1, 13));
+	phys_st32(cpu.mem, 16 * MEM_PAGE_SZE + 1*4, PTE(1, PROT_UW, 0, 14));
+
+	mtpr(&cpu, PR_SBR,  0x4000);
+	mtpr(&cpu, PR_SLR,  130);
+	mtpr(&cpu, PR_P0BR, S0(4));
+	mtpr(&cpu, PR_P0LR, 2);
+	mtpr(&cpu, PR_MAPEN, 1);
+
+	/* fill, hit, and the M bit: no write rights until it is set */
+	tlb_mode(&cpu, MODE_KERNEL);
+	tlb_try(&cpu, "kernel, KW", S0(0), 0);
+	tlb_try(&cpu, "kernel, KW", S0(0), 0);
+	tlb_try(&cpu, "kernel, KW, M clear", S0(0), 1);
+	phys_ld32(cpu.mem, 0x4000, &pte);
+	printf("  %-26s %08X\n", "pte after the write", pte);
+	tlb_try(&cpu, "kernel, KW", S0(0), 1);
+
+	/* rights per mode */
+	tlb_mode(&cpu, MODE_USER);
+	tlb_try(&cpu, "user, KW", S0(0), 0);
+	tlb_try(&cpu, "user, UR", S0(1), 0);
+	tlb_try(&cpu, "user, UR", S0(1), 1);
+	tlb_mode(&cpu, MODE_SUPER);
+	tlb_try(&cpu, "super, UR", S0(1), 0);
+	tlb_try(&cpu, "super, ERKW", S0(2), 0);
+	tlb_mode(&cpu, MODE_EXEC);
+	tlb_try(&cpu, "exec, ERKW", S0(2), 0);
+	tlb_try(&cpu, "exec, ERKW", S0(2), 1);
+	tlb_mode(&cpu, MODE_KERNEL);
+	tlb_try(&cpu, "kernel, ERKW", S0(2), 1);
+
+	/* faults don't fill */
+	tlb_try(&cpu, "kernel, not valid", S0(3), 0);
+	tlb_try(&cpu, "kernel, not valid", S0(3), 0);
+	tlb_try(&cpu, "kernel, past SLR", S0(130), 0);
+	tlb_try(&cpu, "kernel, past P0LR", P0(2), 0);
+	tlb_try(&cpu, "kernel, reserved region", 0xC0000000, 0);
+
+	/* P0, page table in S0 */
+	tlb_try(&cpu, "kernel, P0 UW", P0(0), 0);
+	tlb_try(&cpu, "kernel, P0 UW, M clear", P0(1), 1);
+	phys_ld32(cpu.mem, 16 * MEM_PAGE_SZE + 1*4, &pte);
+	printf("  %-26s %08X\n", "pte after the write", pte);
+
+	/* flushes */
+	tlb_show(&cpu, "before the flushes");
+	mtpr(&cpu, PR_TBIS, S0(1) + 0x123);
+	tlb_show(&cpu, "TBIS S0:1");
+	mtpr(&cpu, PR_P0BR, S0(4));
+	tlb_show(&cpu, "P0BR");
+	mtpr(&cpu, PR_TBIA, 0);
+	tlb_show(&cpu, "TBIA");
+
+	/* three pages in the same set of a 2-way TLB */
+	tlb_try(&cpu, "kernel, S0:0", S0(0), 0);
+	tlb_try(&cpu, "kernel, S0:64", S0(64), 0);
+	tlb_try(&cpu, "kernel, S0:128", S0(128), 0);
+	tlb_show(&cpu, "same set");
+	tlb_try(&cpu, "kernel, S0:0", S0(0), 0);
+	tlb_show(&cpu, "same set");
+
+	/* no mapping: all rights, pa = va */
+	mtpr(&cpu, PR_MAPEN, 0);
+	tlb_show(&cpu, "MAPEN off");
+	tlb_mode(&cpu, MODE_USER);
+	tlb_try(&cpu, "user, unmapped", 0x1234, 1);
+	printf("\n");
+}
+
+
+/***/
+
+/* the flags the architecture says the µop sets, worked out right away from
+   the operands and the old flags -- independently of lf_record()/flags_get()
+ */
+static int lf_eager(int op, int width, uint32_t a, uint32_t b, int old)
+{
+	int		bits = 8 << width;
+	uint32_t	mask = (uint32_t) (((uint64_t) 1 << bits) - 1);
+	int64_t		min  = -((int64_t) 1 << (bits - 1));
+	int64_t		max  =  ((int64_t) 1 << (bits - 1)) - 1;
+	int64_t		sa   = (int64_t) ((uint64_t) (a & mask) << (64 - bits)) >> (64 - bits);
+	int64_t		sb   = (int64_t) ((uint64_t) (b & mask) << (64 - bits)) >> (64 - bits);
+	int		cin  = C(old);
+	int64_t		r;
+	uint32_t	res;
+	int		v = 0, c = C(old);
+
+	switch (op) {
+	case U_MOV:	res = a;		break;
+	case U_AND:	res = a &  b;		break;
+	case U_BIC:	res = a & ~b;		break;
+	case U_BIS:	res = a |  b;		break;
+	case U_XOR:	res = a ^  b;		break;
+	case U_ROTL:	res = (uint32_t) ((((uint64_t) a << 32 | a) << (b & 31)) >> 32);	break;
+
+	case U_MOVX:
+		return NZVC(N(old), Z(old) && !(a & mask), 0, C(old));
+
+	case U_SIGNBW:
+	case U_SIGNBL:
+	case U_SIGNWL:
+	case U_ZEROBW:
+	case U_ZEROBL:
+	case U_ZEROWL:
+		/* width is the result's, the source is the smaller one */
+		{
+		int	from = (op == U_SIGNWL) || (op == U_ZEROWL) ? 16 : 8;
+		int	sign = (op == U_SIGNBW) || (op == U_SIGNBL) || (op == U_SIGNWL);
+
+		res = a & (((uint32_t) 1 << from) - 1);
+		if (sign && (res >> (from - 1)))
+			res |= ~(((uint32_t) 1 << from) - 1);
+		c = 0;
+		}
+		break;
+
+	case U_TRUNCWB:
+	case U_TRUNCLB:
+	case U_TRUNCLW:
+		{
+		int	from = (op == U_TRUNCWB) ? 16 : 32;
+		int64_t	sx   = (int64_t) ((uint64_t) a << (64 - from)) >> (64 - from);
+
+		res = a;
+		v   = (sx < min) || (sx > max);
+		c   = 0;
+		}
+		break;
+
+	case U_ASHL:
+		{
+		int	cnt = (int8_t) b;
+
+		if (cnt >= 32) {
+			res = 0;
+			v   = a != 0;
+		} else if (cnt >= 0) {
+			r   = (int64_t) (int32_t) a * ((int64_t) 1 << cnt);
+			res = r;
+			v   = r != (int32_t) res;
+		} else {
+			res = (uint32_t) ((int64_t) (int32_t) a >> ((-cnt < 63) ? -cnt : 63));
+		}
+		c = 0;
+		}
+		break;
+
+	case U_MUL:
+		r   = sa * sb;
+		res = r;
+		v   = (r < min) || (r > max);
+		c   = 0;
+		break;
+
+	case U_DIV:
+		if ((sb == 0) || ((sa == min) && (sb == -1))) {
+			res = a;
+			v   = 1;
+		} else {
+			res = sa / sb;
+		}
+		c = 0;
+		break;
+
+	case U_ADD:
+	case U_ADC:
+		cin = (op == U_ADC) ? cin : 0;
+		r   = sa + sb + cin;
+		res = r;
+		v   = (r < min) || (r > max);
+		c   = (uint64_t) (a & mask) + (b & mask) + cin > mask;
+		break;
+
+	case U_SUB:
+	case U_SBB:
+		cin = (op == U_SBB) ? cin : 0;
+		r   = sa - sb - cin;
+		res = r;
+		v   = (r < min) || (r > max);
+		c   = (a & mask) < (uint64_t) (b & mask) + cin;
+		break;
+
+	case U_CMP:
+		return NZVC(sa < sb, (a & mask) == (b & mask), 0, (a & mask) < (b & mask));
+
+	default:
+		assert(0);
+		return 0;
+	}
+
+	res &= mask;
+	return NZVC(res >> (bits - 1), res == 0, v, c);
+}
+
+
+static void test_lflags(void)
+{
+	static const uint32_t	val[] = {
+		0, 1, 2, 0x7F, 0x80, 0xFF, 0x100, 0x7FFF, 0x8000, 0xFFFF, 0x10000,
+		0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, 0xFFFFFFFE, 0x12345678, 0xEDCBA987,
+		0x1F, 0x20, 0x21, 0xE0, 0xC1,		/* shift counts */
+	};
+	static const struct {
+		int	op;
+		int	width;		/* -1: all three */
+	} alu_op[] = {
+		{U_MOV, -1}, {U_AND, -1}, {U_BIC, -1}, {U_BIS, -1}, {U_XOR, -1},
+		{U_ROTL, UW_32}, {U_MOVX, -1},
+		{U_SIGNBW, UW_16}, {U_SIGNBL, UW_32}, {U_SIGNWL, UW_32},
+		{U_ZEROBW, UW_16}, {U_ZEROBL, UW_32}, {U_ZEROWL, UW_32},
+		{U_TRUNCWB, UW_8}, {U_TRUNCLB, UW_8}, {U_TRUNCLW, UW_16},
+		{U_ASHL, UW_32}, {U_MUL, -1}, {U_DIV, -1},
+		{U_ADD, -1}, {U_ADC, -1}, {U_SUB, -1}, {U_SBB, -1}, {U_CMP, -1},
+	};
+	static struct cpu	cpu;
+
+	printf("lazy flags\n");
+	for (unsigned i=0; i < ARRAY_SIZE(alu_op); i++)
+		for (int width = UW_8; width <= UW_32; width++) {
+			if ((alu_op[i].width >= 0) && (alu_op[i].width != width))
+				continue;
+
+			struct uop	u = {.op = alu_op[i].op, .width = width, .flags = U_ARCH,
+					     .dst = 2, .s1 = 0, .s2 = 1};
+			unsigned	cnt = 0, bad = 0;
+
+			/* old flags in psl[], or still pending from a CMP/ADD --
+			   the µops that leave C alone have to copy the carry
+			   record of the pending one
+			 */
+			for (int psl=0; psl < 16; psl++)
+			for (int pending=0; pending < 2; pending++)
+			for (unsigned ia=0; ia < ARRAY_SIZE(val); ia++)
+			for (unsigned ib=0; ib < ARRAY_SIZE(val); ib++) {
+				int	old = psl;
+
+				cpu.lf[U_ARCH].op = LF_NONE;
+				cpu.psl[U_ARCH]   = old;
+				if (pending) {
+					/* 0 - 1 borrows, 0 - 0 doesn't */
+					cpu.r[0] = 0;
+					cpu.r[1] = C(psl);
+					alu(&cpu, (struct uop) {.op = U_CMP, .width = UW_32, .flags = U_ARCH, .s1 = 0, .s2 = 1});
+					old = NZVC(C(psl), !C(psl), 0, C(psl));
+				}
+
+				cpu.r[0] = val[ia];
+				cpu.r[1] = val[ib];
+				alu(&cpu, u);
+
+				int	want = lf_eager(u.op, width, val[ia], val[ib], old);
+				int	got  = flags_get(&cpu, U_ARCH, NZVC(1,1,1,1)) & 15;
+				int	ok   = got == want;
+
+				/* asking for fewer flags gives the same ones */
+				for (int need=0; need < 16; need++)
+					if ((flags_get(&cpu, U_ARCH, need) & need) != (want & need))
+						ok = 0;
+				flags_sync(&cpu, U_ARCH);
+				if (cpu.psl[U_ARCH] != (uint32_t) want)
+					ok = 0;
+
+				cnt++;
+				if (ok)
+					continue;
+				if (bad++ < 5)
+					printf("  %s.%d %08X %08X old %X: lazy %X, synced %X, eager %X\n",
+						uop[u.op].name, 1 << width, val[ia], val[ib], old,
+						got, cpu.psl[U_ARCH], want);
+			}
+			printf("  %-8s %d  %5u cases, %u wrong\n", uop[u.op].name, 1 << width, cnt, bad);
+		}
+	printf("\n");
+}
+
+
+/***/
+
+struct tm_dev {
+	const char	*name;
+	uint64_t	 again;			/* re-post with this delay */
+	int		 cnt;			/* ... this many times */
+};
+
+
+static void tm_fire(struct cpu *cpu, struct timer *t)
+{
+	struct tm_dev	*d = t->dev;
+
+	printf("  %10llu  %s%s\n", (unsigned long long) cpu->clock, d->name,
+		(cpu->clock == t->when) ? "" : ", wrong time");
+	if (d->cnt-- > 0)
+		timer_add(cpu, t, d->again);
+}
+
+
+/* run instructions up to clock 'until' the way cpu_run() does: the wheel only
+   gets a look in when cpu->due is reached
+ */
+static void tm_run(struct cpu *cpu, uint64_t until)
+{
+	while (cpu->due <= until) {
+		if (cpu->clock < cpu->due)
+			cpu->clock = cpu->due;
+		timers_run(cpu);
+	}
+	cpu->clock = until;
+}
+
+
+static void test_timers(void)
+{
+	static const char	*name[] = {
+		"1",		"63",		"64",		"65",
+		"4095",		"4096",		"4097",		"2^18-1",
+		"2^18",		"2^18+1",	"2^24-1",	"2^24",
+		"2^30",		"same1",	"same2",	"same3",
+		"every",
+	};
+	static const uint64_t	delay[ARRAY_SIZE(name)] = {
+		1,		63,		64,		65,
+		4095,		4096,		4097,		(1 << 18) - 1,
+		1 << 18,	(1 << 18) + 1,	(1 << 24) - 1,	1 << 24,
+		1 << 30,	300000,		300000,		300000,
+		150000,
+	};
+	static struct tm_dev	dev[ARRAY_SIZE(name)];
+	static struct timer	tm[ARRAY_SIZE(name)];
+	static struct cpu	cpu;
+
+	printf("timers\n");
+	timers_init(&cpu);
+
+	/* every level, the far list, several due on the same tick, a timer
+	   that re-posts itself from its callback
+	 */
+	dev[16].again = 100000;
+	dev[16].cnt   = 3;
+	cpu.clock = 1000;
+	for (unsigned i=0; i < ARRAY_SIZE(name); i++) {
+		dev[i].name = name[i];
+		tm[i].fire  = tm_fire;
+		tm[i].dev   = &dev[i];
+		timer_add(&cpu, &tm[i], delay[i]);
+	}
+	tm_run(&cpu, (1ull << 30) + 2000);
+	printf("  fired %ld, cascaded %ld\n", cpu.timers->fired, cpu.timers->cascaded);
+
+	/* the wheel moves into the next 2^24 window while a timer for that
+	   window is still on the far list: the wheel is run at a point where
+	   nothing is due, then a later timer goes on level 0
+	 */
+	uint64_t	edge = (cpu.clock | ((1 << 24) - 1)) + 1;
+	static const char	*fname[] = {"far", "near"};
+	static struct tm_dev	fdev[ARRAY_SIZE(fname)];
+	static struct timer	ftm[ARRAY_SIZE(fname)];
+
+	for (unsigned i=0; i < ARRAY_SIZE(fname); i++) {
+		fdev[i].name = fname[i];
+		ftm[i].fire  = tm_fire;
+		ftm[i].dev   = &fdev[i];
+	}
+	printf("  %10llu  edge\n", (unsigned long long) edge);
+	timer_add(&cpu, &ftm[0], edge + 50 - cpu.clock);
+	tm_run(&cpu, edge + 10);
+	timers_run(&cpu);
+	timer_add(&cpu, &ftm[1], 100);
+	tm_run(&cpu, edge + 1000);
+	printf("\n");
+}
+
+
+/***/
+
+/* cpu_run() without the reports and events: the translated ROM code when
+   rx is set and it has something for the PC, the fast engine (and the
+   µcode engine behind it) otherwise -- until cnt instructions, HALT or an
+   exception
+ */
+static int rom_run(struct cpu *cpu, bool rx, uint64_t cnt)
+{
+	cpu->due = cnt;
+	while (!cpu->stopped && (cpu->clock < cnt)) {
+		uint32_t		 pc = cpu->r[15];
+		const struct rx_func	*f  = rx ? rx_lookup(cpu, pc) : NULL;
+		const uint8_t		*b;
+		int			 avail, len, exc;
+
+		b = ifetch(cpu, pc, &avail);
+		if (!f || ((exc = rx_run(cpu, f, &pc, &b, &avail)) == FX_UCODE)) {
+			exc = fx_instruction(cpu, pc, b, avail, &len);
+			if (exc == FX_UCODE)
+				exc = ucode_instruction(cpu, pc, b, avail, &len);
+			if (!exc)
+				cpu->clock++;
+		}
+		if (exc) {
+			exc_regs(cpu, exc);
+			cpu->r[15] = pc;
+			return exc;
+		}
+		jnl_commit(cpu);
+	}
+	return 0;
+}
+
+
+/* power-up state, pointers into RAM in the registers */
+static void rom_reset(struct cpu *cpu, uint32_t pc)
+{
+	flags_sync(cpu, U_ARCH);
+	flags_sync(cpu, U_MICRO);
+	memset(cpu->r, 0, sizeof(cpu->r));
+	memset(cpu->psl, 0, sizeof(cpu->psl));
+	memset(cpu->mem->ram, 0, cpu->mem->ram_pagecnt * MEM_PAGE_SZE);
+	for (int i=0; i < 14; i++)
+		cpu->r[i] = 0x2000 + i * 0x400;
+	cpu->r[14]     = 0xF000;
+	cpu->r[15]     = pc;
+	cpu->r[R_PSL]  = (1u << 26) | (0x1F << 16);
+	cpu->clock     = 0;
+	cpu->stopped   = 0;
+	cpu->rx_instrs = 0;
+}
+
+
+/* is there translated code for pc? */
+static const char *rom_xl(struct cpu *cpu, uint32_t pc)
+{
+	return rx_lookup(cpu, pc) ? "translated" : "interpreted";
+}
+
+
+static void test_rom(void)
+{
+	static struct cpu	cpu, ref;
+	uint32_t		cpu_ram = 0;
+
+	printf("rom\n");
+	cpu_init(&cpu);
+	mem_init(&cpu, 64*1024);
+	rom_load(&cpu, ROM_BASE, "vax-bin/ka655x.bin");
+	cpu_init(&ref);
+	mem_init(&ref, 64*1024);
+	rom_load(&ref, ROM_BASE, "vax-bin/ka655x.bin");
+
+	/* the guard -- a function on page 1, one on page 0 */
+	uint32_t	p0 = rx_funcs[0].start;
+	uint32_t	p1 = 0;
+	uint8_t		*page1 = mem_page(cpu.mem, (RX_BASE >> MEM_PAGE_BITS) + 1);
+
+	for (unsigned i=0; !p1 && (i < ARRAY_SIZE(rx_funcs)); i++)
+		if (rx_funcs[i].start - RX_BASE >= MEM_PAGE_SZE)
+			p1 = rx_funcs[i].start;
+
+	rx_init(&cpu);
+	printf("  as built:    %3d changed, %04X_%04X %s, %04X_%04X %s\n", rx_changed,
+		SPLIT(p0), rom_xl(&cpu, p0), SPLIT(p1), rom_xl(&cpu, p1));
+	page1[p1 & (MEM_PAGE_SZE-1)] ^= 1;
+	rx_init(&cpu);
+	printf("  byte flipped:%3d changed, %04X_%04X %s, %04X_%04X %s\n", rx_changed,
+		SPLIT(p0), rom_xl(&cpu, p0), SPLIT(p1), rom_xl(&cpu, p1));
+	page1[p1 & (MEM_PAGE_SZE-1)] ^= 1;
+	mem_set_flags(cpu.mem, (RX_BASE >> MEM_PAGE_BITS) + 1, MF_WRITE, 0);
+	rx_init(&cpu);
+	printf("  writable:    %3d changed, %04X_%04X %s, %04X_%04X %s\n", rx_changed,
+		SPLIT(p0), rom_xl(&cpu, p0), SPLIT(p1), rom_xl(&cpu, p1));
+	mem_set_flags(cpu.mem, (RX_BASE >> MEM_PAGE_BITS) + 1, 0, MF_WRITE);
+	rx_init(&cpu);
+	cpu.preg[PR_MAPEN] = 1;
+	printf("  MAPEN on:    %3d changed, %04X_%04X %s, %04X_%04X %s\n", rx_changed,
+		SPLIT(p0), rom_xl(&cpu, p0), SPLIT(p1), rom_xl(&cpu, p1));
+	cpu.preg[PR_MAPEN] = 0;
+
+	/* from every function, the translation against the fast engine on
+	   its own: the same registers, flags, exception, instruction count,
+	   and RAM
+	 */
+	uint64_t	instrs = 0, translated = 0;
+	unsigned	differ = 0;
+
+	for (unsigned i=0; i < ARRAY_SIZE(rx_funcs); i++) {
+		uint32_t	pc = rx_funcs[i].start;
+		int		exc, ref_exc;
+
+		rom_reset(&cpu, pc);
+		rom_reset(&ref, pc);
+		exc     = rom_run(&cpu, true,  500);
+		ref_exc = rom_run(&ref, false, 500);
+		instrs     += cpu.clock;
+		translated += cpu.rx_instrs;
+
+		flags_sync(&cpu, U_ARCH);
+		flags_sync(&ref, U_ARCH);
+		if ((exc != ref_exc) || (cpu.clock != ref.clock) || (cpu.stopped != ref.stopped) ||
+		    memcmp(cpu.r, ref.r, sizeof(cpu.r)) || (cpu.psl[U_ARCH] != ref.psl[U_ARCH]) ||
+		    memcmp(cpu.mem->ram, ref.mem->ram, ref.mem->ram_pagecnt * MEM_PAGE_SZE)) {
+			printf("  from %04X_%04X: PC %04X_%04X/%04X_%04X after %llu/%llu instructions\n",
+				SPLIT(pc), SPLIT(cpu.r[15]), SPLIT(ref.r[15]),
+				(unsigned long long) cpu.clock, (unsigned long long) ref.clock);
+			differ++;
+		}
+		for (unsigned j=0; j < ref.mem->ram_pagecnt * MEM_PAGE_SZE; j++)
+			cpu_ram += cpu.mem->ram[j] != 0;
+	}
+	printf("  %zu functions: %llu instructions, %llu translated, %u RAM bytes written, %u differ\n",
+		ARRAY_SIZE(rx_funcs), (unsigned long long) instrs, (unsigned long long) translated,
+		cpu_ram, differ);
+	printf("\n");
+}
+
+
+/***/
+
+int main()
+{
+	test_jnl();
+	test_tlb();
+	test_lflags();
+	test_timers();
+	test_rom();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/perl
+
+# Copyright 2018  Peter Lund <firefly@vax64.dk>
+#
+# Licensed under GPL v2.
+#
+# ---
+#
+# Annotate the microcode with how often each µop ran.
+#
+#   ./revax-sim --stats stats.txt <binary>
+#   misc/ucode-heat.pl stats.txt < src/ucode.vu
+#
+# Prints ucode.vu with the run count in front of each µop line -- the
+# 'ucode' records of the report, which carry the ucode.vu line number of
+# each ucode[] entry.  The other records are ignored.  Lines without µops
+# and µops that never ran get an empty count column, so the source still
+# lines up.
+#
+# The report has to come from a revax-sim built from the same ucode.vu.
+
+use strict;
+use warnings;
+
+die "usage: ucode-heat.pl <stats report> < ucode.vu\n" unless scalar @ARGV == 1;
+
+my %heat;	# ucode.vu line -> count
+
+open(my $f, '<', $ARGV[0]) or die "can't open $ARGV[0]: $!\n";
+while (<$f>) {
+	next unless /^ucode\s+(\d+)\s+(\d+)\s+(\d+)\s*$/;
+	$heat{$2} += $3;
+}
+close($f);
+
+while (<STDIN>) {
+	if (exists $heat{$.}) {
+		printf "%12d  %s", $heat{$.}, $_;
+	} else {
+		printf "%12s  %s", '', $_;
+	}
+}
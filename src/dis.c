@@ -91,6 +91,8 @@ STATIC struct dis_ret op_dis_sane(uint8_t b[MAX_OPLEN], uint32_t pc, int width,
 #include "op-val-support.h"
 #include "op-val.h"
 
+#include "instr-len.h"
+
 
 /***/
 
@@ -460,31 +462,25 @@ void dis(struct outfiles *f, unsigned idx, int len)
 
 
 /*   . = unclassified
-     @ = code label
-     X = code
-    (d = data   some day, maybe)
+     @ = code label (first byte of an instruction that is a branch target)
+     X = code (first byte of an instruction)
+     x = code (the rest of the instruction)
+     d = data in the instruction stream (CASE tables, procedure entry masks)
 
 
      Transitions:
       . => @
       . => X
+      . => x
+      . => d
       X => @
 
      This means the map can be used as a quick check to see if a label is known
      already + as a check to see if an EBB is known already (so we can avoid
      scanning through an instruction more than once).
 
-     Problem with this:  jumping into the middle of instructions.
-     Can be fixed by encoding instruction starts, too.  Maybe both x and X?
-     Or X and '-'?  That would allow detection of overlapping instructions, which
-     would probably be a feature.
-
-     Should I use bit flags instead?
-     What if bits always get set and never reset?
-
-     Should distinguish between call targets and other targets (so we can
-     handle the register mask procedure header correctly).
-
+     Jumping into the middle of an instruction (or into a CASE table) lands on
+     an 'x' or a 'd' -- those are counted as overlaps and not traced.
  */
 char	map[ARRAY_SIZE(blob)];
 
@@ -493,10 +489,14 @@ char	map[ARRAY_SIZE(blob)];
      BB_END	BRB, BRW, JMP, RET, RSB, REI, HALT  -- BPT?  XFC?
      CTRL
      CASE
+     JUMP	JMP, JSB -- the last operand is the target address
+     CALL	CALLG, CALLS -- the last operand is a procedure (entry mask)
  */
 #define	CTRL	1
 #define	BB_END	2
 #define CASE	4
+#define JUMP	8
+#define CALL	16
 uint8_t	class[512];
 
 
@@ -547,16 +547,16 @@ void prepare_classification()
 	class[0xCF] = CTRL|CASE;	/* CASEL	*/
 	class[0xAF] = CTRL|CASE;	/* CASEW	*/
 
-	class[0x17] = CTRL|BB_END;	/* JMP		*/
+	class[0x17] = CTRL|BB_END|JUMP;	/* JMP		*/
 
-	class[0x16] = CTRL;		/* JSB		*/
+	class[0x16] = CTRL|JUMP;	/* JSB		*/
 	class[0x05] = CTRL|BB_END;	/* RSB		*/
 
 	class[0xF4] = CTRL;		/* SOBGEQ	*/
 	class[0xF5] = CTRL;		/* SOBGTR	*/
 
-	class[0xFA] = CTRL;		/* CALLG	*/
-	class[0xFB] = CTRL;		/* CALLS	*/
+	class[0xFA] = CTRL|CALL;	/* CALLG	*/
+	class[0xFB] = CTRL|CALL;	/* CALLS	*/
 	class[0x04] = CTRL|BB_END;	/* RET		*/
 
 //	class[0x03] = CTRL;		/* BPT		*/
@@ -567,148 +567,280 @@ void prepare_classification()
 }
 
 
-/* step through an operand -- tell us how long it was in bytes
+/* flood fill -- find the code that is reachable from the entry points
+
+   A work list of VAX addresses: a label is marked in the map when it is
+   added, so it never goes on the list twice and there is no need to search
+   a label list.  Each label is traced through its extended basic block until
+   an unconditional control transfer (BRB, BRW, JMP, RSB, RET, REI, HALT), an
+   instruction that can't be decoded, or an instruction that has been traced
+   already.  Branch targets, CASE tables, and JMP/JSB/CALLG/CALLS targets that
+   are absolute or PC-relative add new labels.
 
-   FIXME should probably have a flag to say when to add labels (for JMP, CALL)
+   Indirect control transfers (JMP (R0), CALLS #0, @4(R1), RSB/RET through a
+   modified stack, ...) can't be followed.  They are counted so the .ctrl file
+   can fill in the missing entry points.
 
-    -1   reserved operand
+   rx_dump() translates the code it finds to C for revax-sim.
  */
-static int op_len(unsigned idx, int width) __attribute__((unused));
-static int op_len(unsigned idx, int width)
+static uint32_t	*work;
+static unsigned	 work_cnt, work_max;
+
+static struct {
+	unsigned	instrs, labels, procs, cases;
+	unsigned	indirect;	/* JMP/JSB/CALLx we can't follow */
+	unsigned	unknown_case;	/* CASE with a limit that isn't a constant */
+	unsigned	outside;	/* targets outside the blob */
+	unsigned	overlap;	/* targets in the middle of something */
+	unsigned	bad;		/* reserved instructions/operands */
+} map_stats;
+
+
+static uint32_t le16(unsigned idx)
 {
-	switch (blob[idx] & 0xF0) {
-	case 0x00:
-	case 0x10:
-	case 0x20:
-	case 0x30:
-		return 1;
-	case 0x40:
-		{
-		switch (blob[idx+1] & 0xF0) {
-		case 0x00:	// 6-bit imm -- not allowed
-		case 0x10:	// 6-bit imm -- not allowed
-		case 0x20:	// 6-bit imm -- not allowed
-		case 0x30:	// 6-bit imm -- not allowed
-		case 0x40:	// indexed + indexed -- not allowed
-		case 0x50:	// indexed + register -- not allowed
-			return -1;
-		case 0x60:
-			return 2; // (Rn)[Rx]
-		case 0x70:
-			return 2; // -(Rn)[Rx]
-		case 0x80:
-			if ((blob[idx+1] & 0x0F) == 0x0F)
-				return -1; // indexed + imm -- not allowed
-			else
-				return 2;  // (Rn)+[Rx]
-		case 0x90:
-			if ((blob[idx+1] & 0x0F) == 0x0F)
-				return 2+4; // @#addr[Rx]
-			else
-				return 2;   // @(Rn)+[Rx]
-		case 0xA0:	// B^(Rn)[Rx]
-		case 0xB0:	// @B^(Rn)[Rx]
-			return 2+1;
-		case 0xC0:	// W^(Rn)[Rx]
-		case 0xD0:	// @W^(Rn)[Rx]
-			return 2+2;
-		case 0xE0:	// L^(Rn)[Rx]
-		case 0xF0:	// @L^(Rn)[Rx]
-			return 2+4;
-		default:
-			assert(0);
-		}
+	return blob[idx] | (blob[idx+1] << 8);
+}
+
+
+static uint32_t le32(unsigned idx)
+{
+	return le16(idx) | (le16(idx+2) << 16);
+}
+
+
+/* a new code label -- added to the work list unless it is known already */
+static void map_label(uint32_t addr)
+{
+	if ((addr < blob_start) || (addr - blob_start >= blob_size)) {
+		map_stats.outside++;
+		return;
+	}
+
+	unsigned	idx = addr - blob_start;
+
+	switch (map[idx]) {
+	case '@':
+		return;
+	case 'X':
+		/* traced already, as part of another EBB */
+		map[idx] = '@';
+		map_stats.labels++;
+		return;
+	case '.':
+		break;
+	default:
+		map_stats.overlap++;
+		return;
+	}
+
+	map[idx] = '@';
+	map_stats.labels++;
+
+	if (work_cnt == work_max) {
+		work_max = work_max ? 2 * work_max : 1024;
+		work = realloc(work, work_max * sizeof(work[0]));
+		if (!work) {
+			fprintf(stderr, "map_label(), out of memory.\n");
+			exit(1);
 		}
-	case 0x50:
-		return 1; // Rn
-	case 0x60:
-		return 1; // (Rn)
-	case 0x70:
-		return 1; // @(Rn)
-	case 0x80:
-		if ((blob[idx] & 0x0F) == 0xF)
-			return 1+width;	// imm
-		else
-			return 1;		// (Rn)+
-	case 0x90:
-		if ((blob[idx] & 0x0F) == 0xF)
-			return 1+4;		// abs
-		else
-			return 1;		// @(Rn)+
-	case 0xA0:
-	case 0xB0:
-		return 1+1;
-	case 0xC0:
-	case 0xD0:
-		return 1+2;
-	case 0xE0:
-	case 0xF0:
-		return 1+4;
+	}
+	work[work_cnt++] = idx;
+}
+
+
+/* CALLG/CALLS target -- an entry mask followed by the code */
+static void map_proc(uint32_t addr)
+{
+	if ((addr < blob_start) || (addr - blob_start + 2 >= blob_size)) {
+		map_stats.outside++;
+		return;
+	}
+
+	unsigned	idx = addr - blob_start;
+
+	if (map[idx] == 'd')
+		return;		/* seen already */
+	if ((map[idx] != '.') || (map[idx+1] != '.')) {
+		map_stats.overlap++;
+		return;
+	}
+	map[idx]   = 'd';
+	map[idx+1] = 'd';
+	map_stats.procs++;
+	map_label(addr + 2);
+}
+
+
+/* the target of a JMP/JSB/CALLx operand at idx, if it is known statically */
+static bool op_target(unsigned idx, uint32_t *target)
+{
+	uint32_t	pc = blob_start + idx;
+
+	switch (blob[idx]) {
+	case 0x9F:	/* @#addr */
+		*target = le32(idx+1);
+		return true;
+	case 0xAF:	/* B^addr */
+		*target = pc + 2 + (int32_t)(int8_t) blob[idx+1];
+		return true;
+	case 0xCF:	/* W^addr */
+		*target = pc + 3 + (int32_t)(int16_t) le16(idx+1);
+		return true;
+	case 0xEF:	/* L^addr */
+		*target = pc + 5 + le32(idx+1);
+		return true;
 	default:
-		assert(0);
+		return false;
 	}
 }
 
 
-void map_blob()
+/* trace an extended basic block, starting at a label */
+static void map_trace(unsigned idx)
 {
-	/* reset map, label list, stats, label count */
+	for (bool first = true;; first = false) {
+		if (idx >= blob_size)
+			return;
+		if (!first && (map[idx] != '.')) {
+			/* joins code we know about (or will trace) */
+			if ((map[idx] != '@') && (map[idx] != 'X'))
+				map_stats.overlap++;
+			return;
+		}
 
-	/* put "primers" into the label list -- just use @0 for now */
+		/* the whole instruction first -- it tells us if it is bad, and
+		   only control transfers need their operands looked at
+		 */
+		int	len = instr_len(blob + idx, blob_size - idx);
 
-	/* for each label:
-	       run through the basic block, i.e. add labels for all the control
-	       instructions we encounter, continue until we reach an unconditional
-	       control transfer instruction (BRB, BRW, JMP, RET, REI, HALT --
-	       not sure what to do about BPT and XFC).
+		if (len <= 0) {
+			map_stats.bad++;
+			return;
+		}
 
-               all the instruction bytes encountered should be marked as 'code'.
+		int	op = (blob[idx] == 0xFD) ? blob[idx+1] + 0x100 : blob[idx];
 
-	 */
+		/* operands */
+		uint32_t	targets[2];
+		int		target_cnt = 0;
+		bool		proc = false;
+		int		limit = -1;	/* CASE */
 
-	/* keep going through the labels until no new labels are added
+		for (unsigned i=0, pos = (op > 0xFF) ? 2 : 1; class[op] && (i < op_cnt[op]); i++) {
+			int	width = op_width[op][i];
 
-	   nope, slow.  We should have a list of labels (of course) and a work
-	   list.  Keep going until the work list is empty.  New labels go into
-	   both the label list and the work list.
-	 */
+			if (ops[op][i*3] == 'b') {
+				uint32_t	disp = (width == 1) ? (int32_t)(int8_t)  blob[idx+pos]
+								: (int32_t)(int16_t) le16(idx+pos);
+
+				pos += width;
+				targets[target_cnt++] = blob_start + idx + pos + disp;
+				continue;
+			}
+
+			/* the limit of a CASE is (in practice) a constant */
+			if ((class[op] & CASE) && (i == 2)) {
+				uint8_t	b = blob[idx+pos];
+
+				if ((b & 0xC0) == 0x00)
+					limit = b & 0x3F;
+				else if (b == 0x8F)
+					limit = (width == 1) ? blob[idx+pos+1] : le16(idx+pos+1);
+			}
 
+			/* JMP/JSB/CALLx target */
+			if ((class[op] & (JUMP | CALL)) && (i == op_cnt[op]-1)) {
+				if (op_target(idx + pos, &targets[target_cnt])) {
+					target_cnt++;
+					proc = class[op] & CALL;
+				} else {
+					map_stats.indirect++;
+				}
+			}
+
+			pos += spec_len(blob + idx + pos, width);
+		}
 
-	/* what information might we want per label?  target + list of "come froms"
-	   + possibly a name.
+		/* mark the instruction */
+		if (map[idx] != '@')
+			map[idx] = 'X';
+		for (int i=1; (i < len) && (idx+i < blob_size); i++)
+			map[idx+i] = 'x';
+		map_stats.instrs++;
 
-	   what information might we want per work list item?  just the target
-	   address.
+		for (int i=0; i < target_cnt; i++)
+			if (proc)
+				map_proc(targets[i]);
+			else
+				map_label(targets[i]);
 
-	   use 'X' in the map while working, go through the labels afterwards
-	   and convert the label targets to '@'.
+		idx += len;
 
+		/* CASE -- the displacement table follows the instruction, the
+		   code after it is the fall-through for out-of-range values.
 
-	   data structures?   simple array w/ doubling (amortized O(1)) for
-	   work list?   simple array w/ doubling for labels as well?  With a
-	   "thread" providing a tree?
+		   The table can't extend past code it branches to, which keeps
+		   us out of trouble if the limit is bigger than the table (there
+		   is at least one CASEW #^X8001, #^X8011 in the KA655 ROM).
+		 */
+		if (class[op] & CASE) {
+			if (limit < 0) {
+				map_stats.unknown_case++;
+				return;
+			}
+			map_stats.cases++;
 
-	   I can get by with a simple list of VAX addresses in both cases.
-	   If I don't search in the labels list, I don't have to keep it sorted
-	   or maintain a hash table or a tree.  I can avoid searching in the
-	   labels if I mark all labels immediately in the map as I take their
-	   addresses off the work list.
+			unsigned	table = idx;
+			unsigned	end   = blob_size;
 
-           The instruction tracer should check every label against the map as
-           they are generated (as that is very cheap to do).  This code should
-           be in the function that adds new labels to the work list.
+			for (int i=0; (i <= limit) && (idx+1 < end); i++) {
+				unsigned	target = table + (int32_t)(int16_t) le16(idx);
 
-           How do I avoid tracing through the same code several times if there
-           are more than one label in an EBB?  Could have an early out by checking
-           with the map to see if it's classified as code/label already.
+				map[idx]   = 'd';
+				map[idx+1] = 'd';
+				if ((target > idx) && (target < end))
+					end = target;
+				map_label(blob_start + target);
+				idx += 2;
+			}
+		}
 
-	 */
+		if (class[op] & BB_END)
+			return;
+	}
 }
 
 
-void map_dump()
+void map_blob(unsigned entry_cnt, const uint32_t entry[entry_cnt])
 {
-	char	*fname = "runtime/ka655x.bin.map";
+	/* reset map, work list, stats */
+	memset(map, '.', sizeof(map));
+	work_cnt = 0;
+	memset(&map_stats, 0, sizeof(map_stats));
+
+	/* "primers" -- @0 + whatever the command line said */
+	map_label(blob_start);
+	for (unsigned i=0; i < entry_cnt; i++)
+		map_label(entry[i]);
+
+	while (work_cnt)
+		map_trace(work[--work_cnt]);
+
+	unsigned	code = 0;
+
+	for (unsigned i=0; i < blob_size; i++)
+		code += (map[i] == '@') || (map[i] == 'X') || (map[i] == 'x');
+
+	printf("flood fill: %u instructions (%u of %u bytes), %u labels, %u procedures, %u CASE tables\n",
+		map_stats.instrs, code, blob_size, map_stats.labels, map_stats.procs, map_stats.cases);
+	printf("            %u indirect, %u unknown CASE limits, %u outside, %u overlaps, %u bad\n",
+		map_stats.indirect, map_stats.unknown_case, map_stats.outside, map_stats.overlap, map_stats.bad);
+}
+
+
+void map_dump(const char *outname)
+{
+	char	*fname = mem_sprintf("%s.map", outname);
 	FILE	*f;
 
 	if ((f = fopen(fname, "w")) == NULL) {
@@ -716,9 +848,10 @@ void map_dump()
 		fprintf(stdout, "can't create map file.\n");
 		exit(1);
 	}
+	free(fname);
 
 	for (unsigned i = 0; i < blob_size; i+=64) {
-		fprintf(f, "%04X_%04X  ", SPLIT(i));
+		fprintf(f, "%04X_%04X  ", SPLIT(blob_start + i));
 
 		for (unsigned j = 0; (j < 64) && (i+j < blob_size); j++) {
 			if ((j == 16) || (j == 32) || (j == 48))
@@ -736,6 +869,392 @@ void map_dump()
 /***/
 
 
+/* ahead-of-time translation to C -- revax-dis -c <file>
+
+   The code the flood fill found becomes C functions over revax-sim's struct
+   cpu, one for each run of instructions that follow each other.  Every
+   instruction has a label and a case in its function's switch, so the
+   simulator can come in anywhere (an RSB comes back to the middle of a run),
+   and branches to the same run are gotos.
+
+   The operands are taken apart here with the op_sim() the fast engine
+   (revax-sim --engine fast) uses, and each specifier becomes the C for its
+   case in fx_operand().  What the instruction then does is fx_execute().
+   Instructions the fast engine doesn't know are handed back to the simulator
+   by RX_INSTR, operands it would refuse by RX_UCODE.
+
+   rx_sum[] has a checksum of each page of the binary.  The simulator only
+   uses the functions for pages that still match.  The RX_* macros are in
+   sim.c.
+ */
+#define RX_PAGE		512
+
+/* what a function uses -- its locals are only declared if they are */
+#define USE_O		1
+#define USE_EXC		2
+#define USE_VA		4
+#define USE_X		8
+#define USE_TMP		16
+
+/* the function being written -- the body comes first, then the locals */
+static char	*rx_body;
+static size_t	 rx_len, rx_max;
+
+/* static targets of the instruction being written */
+static uint32_t	 rx_target[2];
+static int	 rx_target_cnt;
+
+static struct {
+	unsigned	funcs, instrs, ucode;
+} rx_stats;
+
+
+static void rx_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void rx_printf(const char *fmt, ...)
+{
+	va_list	ap;
+	int	n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if (rx_len + n + 1 > rx_max) {
+		rx_max  = 2 * (rx_len + n + 1);
+		rx_body = realloc(rx_body, rx_max);
+		if (!rx_body) {
+			fprintf(stderr, "rx_printf(), out of memory.\n");
+			exit(1);
+		}
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(rx_body + rx_len, n + 1, fmt, ap);
+	va_end(ap);
+	rx_len += n;
+}
+
+
+/* FNV-1a -- revax-sim has the same one */
+static uint32_t rx_page_sum(const uint8_t *p, unsigned cnt)
+{
+	uint32_t	h = 2166136261u;
+
+	for (unsigned i=0; i < cnt; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+
+/* cpu->r[n] + disp, as C */
+static const char *rx_rn_disp(int n, int32_t disp)
+{
+	static char	buf[40];
+
+	if (disp < 0)
+		sprintf(buf, "cpu->r[%d] - 0x%X", n, -(uint32_t) disp);
+	else
+		sprintf(buf, "cpu->r[%d] + 0x%X", n, (uint32_t) disp);
+	return buf;
+}
+
+
+/* C for operand i of op, its specifier (or displacement) is at blob[*idx] --
+   false if the simulator has to interpret the instruction
+ */
+static bool rx_operand(unsigned *idx, int op, int i, unsigned *use)
+{
+	char	acc   = ops[op][i*3];
+	char	type  = ops[op][i*3+1];
+	int	width = op_width[op][i];
+
+	if (acc == 'b') {
+		int32_t	disp = (width == 1) ? (int32_t)(int8_t)  blob[*idx]
+					    : (int32_t)(int16_t) le16(*idx);
+
+		*idx += width;
+		rx_target[rx_target_cnt++] = blob_start + *idx + disp;
+		rx_printf("\tRX_TARGET(%d, 0x%08X);\n", i, blob_start + *idx + disp);
+		return true;
+	}
+
+	/* integers only, no bit fields */
+	if (!strchr("rmwa", acc) || !strchr("bwlq", type))
+		return false;
+
+	uint8_t		b[MAX_OPLEN];
+	struct fields	f;
+	struct sim_ret	r;
+
+	memset(b, 0x0, MAX_OPLEN);
+	memcpy(b, blob + *idx, (*idx + MAX_OPLEN <= blob_size) ? MAX_OPLEN : blob_size - *idx);
+	memset(&f, 0xFF, sizeof(f));
+	r = op_sim(b, &f, width, op_ifp[op][i]);
+	if ((r.cnt <= 0) || (*idx + r.cnt > blob_size) || !op_val(b, width))
+		return false;
+	*idx += r.cnt;
+
+	uint32_t	npc = blob_start + *idx;	/* PC-relative modes */
+	uint32_t	va  = 0;
+	bool		known = false;			/* va is */
+
+	switch (r.cl) {
+	case CLASS_IMM:
+		if (acc != 'r')
+			return false;
+		rx_printf("\tRX_IMM(%d, 0x%08X, 0x%08X);\n", i, f.imm.val[0], f.imm.val[1]);
+		return true;
+
+	case CLASS_REG:
+		/* the PC is UNPREDICTABLE here, the interpreters decide */
+		if ((acc == 'a') || (f.Rn == 15) || ((width == 8) && (f.Rn >= 14)))
+			return false;
+		rx_printf("\tRX_REG(%d, %d, %d);\n", i, f.Rn, width);
+		return true;
+	}
+
+	if ((f.Rn == 15) || (f.Rx == 15))
+		return false;
+	if (f.Rx >= 0) {
+		rx_printf("\tx  = cpu->r[%d] * %d;\n", f.Rx, width);
+		*use |= USE_X;
+	}
+	*use |= USE_VA;
+
+	switch (r.cl) {
+	case LBL_ADDR__RN_:			/* (Rn) */
+	case LBL_ADDR__RN_______XINDEX_RX__:
+		rx_printf("\tva = cpu->r[%d];\n", f.Rn);
+		break;
+
+	case LBL_ADDR____RN_:			/* -(Rn) */
+	case LBL_ADDR____RN_____XINDEX_RX__:
+		rx_printf("\tjnl_log(cpu, %d, 0);\n", f.Rn);
+		rx_printf("\tva = cpu->r[%d] -= %d;\n", f.Rn, width);
+		break;
+
+	case LBL_ADDR__RNXX_:			/* (Rn)+ */
+	case LBL_ADDR__RNXX_____XINDEX_RX__:
+		rx_printf("\tjnl_log(cpu, %d, 0);\n", f.Rn);
+		rx_printf("\tva = cpu->r[%d];\n", f.Rn);
+		rx_printf("\tcpu->r[%d] += %d;\n", f.Rn, width);
+		break;
+
+	case LBL_ADDR___RNXX__:			/* @(Rn)+ */
+	case LBL_ADDR___RNXX____XINDEX_RX__:
+		rx_printf("\tRX_LOAD(cpu->r[%d]);\n", f.Rn);
+		rx_printf("\tjnl_log(cpu, %d, 0);\n", f.Rn);
+		rx_printf("\tcpu->r[%d] += 4;\n", f.Rn);
+		*use |= USE_TMP;
+		break;
+
+	case LBL_ADDR__ADDR_:			/* @#addr */
+	case LBL_ADDR__ADDR_____XINDEX_RX__:
+		va    = f.addr;
+		known = true;
+		break;
+
+	case LBL_ADDR__RNXDISP_:		/* disp(Rn) */
+	case LBL_ADDR__RNXDISP__XINDEX_RX__:
+		rx_printf("\tva = %s;\n", rx_rn_disp(f.Rn, f.disp));
+		break;
+
+	case LBL_ADDR___RNXDISP__:		/* @disp(Rn) */
+	case LBL_ADDR___RNXDISP_XINDEX_RX__:
+		rx_printf("\tRX_LOAD(%s);\n", rx_rn_disp(f.Rn, f.disp));
+		*use |= USE_TMP;
+		break;
+
+	case LBL_ADDR__PCXDISP_:		/* disp(PC) */
+	case LBL_ADDR__PCXDISPXINDEX_RX__:
+		va    = npc + f.disp;
+		known = true;
+		break;
+
+	case LBL_ADDR___PCXDISP__:		/* @disp(PC) */
+	case LBL_ADDR___PCXDISP_XINDEX_RX__:
+		rx_printf("\tRX_LOAD(0x%08X);\n", npc + f.disp);
+		*use |= USE_TMP;
+		break;
+
+	default:
+		return false;
+	}
+
+	if (known)
+		rx_printf("\tva = 0x%08X;\n", va);
+	rx_printf("\tRX_MEM(%d, '%c', %d, %s);\n", i, acc, width, (f.Rx >= 0) ? "va + x" : "va");
+
+	/* JMP/JSB to a known address */
+	if (known && (f.Rx < 0) && (class[op] & JUMP))
+		rx_target[rx_target_cnt++] = va;
+	return true;
+}
+
+
+/* is there an instruction at addr in [start, end)? */
+static bool rx_in(uint32_t addr, unsigned start, unsigned end)
+{
+	unsigned	idx = addr - blob_start;
+
+	return (addr >= blob_start) && (idx >= start) && (idx < end) &&
+	       ((map[idx] == '@') || (map[idx] == 'X'));
+}
+
+
+/* C for the instruction at blob[idx], in the function for [start, end) --
+   how long it is
+ */
+static int rx_instr(unsigned idx, unsigned start, unsigned end, unsigned *use)
+{
+	uint32_t	pc   = blob_start + idx;
+	int		len  = instr_len(blob + idx, blob_size - idx);
+	int		op   = (blob[idx] == 0xFD) ? blob[idx+1] + 0x100 : blob[idx];
+	unsigned	pos  = (op > 0xFF) ? idx + 2 : idx + 1;
+	unsigned	iuse = 0;
+	size_t		mark;
+	bool		ok   = op <= 0xFF;	/* the fast engine has no two-byte opcodes */
+
+	rx_printf("\n\t/* %04X_%04X  %s */\n", SPLIT(pc), mne[op]);
+	rx_printf("L%08X:\n", pc);
+	rx_stats.instrs++;
+
+	mark          = rx_len;
+	rx_target_cnt = 0;
+	if (ok)
+		rx_printf("\tRX_INSTR(0x%08X, 0x%02X);\n", pc, op);
+	for (unsigned i=0; ok && (i < op_cnt[op]); i++)
+		ok = rx_operand(&pos, op, i, &iuse);
+	if (!ok || (pos != idx + len)) {
+		rx_len = mark;
+		rx_body[rx_len] = '\0';
+		rx_printf("\tRX_UCODE(0x%08X);\n", pc);
+		rx_stats.ucode++;
+		return len;
+	}
+
+	*use |= iuse | USE_O | USE_EXC;
+	rx_printf("\tRX_EXEC(0x%02X, 0x%08X);\n", op, pc + len);
+	rx_printf("\tRX_DONE();\n");
+	for (int i=0; i < rx_target_cnt; i++)
+		if (rx_in(rx_target[i], start, end))
+			rx_printf("\tif (cpu->r[15] == 0x%08X)\n\t\tgoto L%08X;\n", rx_target[i], rx_target[i]);
+	if (idx + len < end)
+		rx_printf("\tRX_NEXT(0x%08X);\n", pc + len);
+	else
+		rx_printf("\treturn 0;\n");
+	return len;
+}
+
+
+/* the function for the instructions in [start, end) */
+static void rx_func(FILE *f, unsigned start, unsigned end)
+{
+	unsigned	use = 0;
+	int		len;
+
+	rx_len = 0;
+	for (unsigned idx = start; idx < end; idx += len)
+		len = rx_instr(idx, start, end, &use);
+
+	fprintf(f, "\n\n/* %04X_%04X..%04X_%04X */\n", SPLIT(blob_start + start), SPLIT(blob_start + end - 1));
+	fprintf(f, "static int rx_%08X(struct cpu *cpu, uint32_t *pc)\n", blob_start + start);
+	fprintf(f, "{\n");
+	if (use & USE_O)
+		fprintf(f, "\tstruct fx_opnd\to[6] = {{0}};\n");
+	if (use & USE_VA)
+		fprintf(f, "\tuint32_t\tva;\n");
+	if (use & USE_X)
+		fprintf(f, "\tuint32_t\tx;\n");
+	if (use & USE_TMP)
+		fprintf(f, "\tuint32_t\ttmp;\n");
+	if (use & USE_EXC)
+		fprintf(f, "\tint\t\texc;\n");
+	if (!use)
+		fprintf(f, "\t(void) cpu;\t\t/* nothing the fast engine does */\n");
+	fprintf(f, "\n");
+
+	fprintf(f, "\tswitch (*pc) {\n");
+	for (unsigned idx = start; idx < end; idx += instr_len(blob + idx, blob_size - idx))
+		fprintf(f, "\tcase 0x%08X:\tgoto L%08X;\n", blob_start + idx, blob_start + idx);
+	fprintf(f, "\tdefault:\t\treturn FX_UCODE;\t/* in the middle of one */\n");
+	fprintf(f, "\t}\n");
+	fputs(rx_body, f);
+	fprintf(f, "}\n");
+	rx_stats.funcs++;
+}
+
+
+/* write the translation to cname */
+void rx_dump(const char *cname, const char *fname)
+{
+	FILE	*f;
+
+	if ((f = fopen(cname, "w")) == NULL) {
+		perror("fopen()");
+		fprintf(stdout, "can't create '%s'.\n", cname);
+		exit(1);
+	}
+
+	unsigned	pages = (blob_size + RX_PAGE - 1) / RX_PAGE;
+
+	fprintf(f, "/* %s translated to C by revax-dis -c -- generated, don't edit */\n", fname);
+	fprintf(f, "\n");
+	fprintf(f, "#define RX_BASE\t\t0x%08X\n", blob_start);
+	fprintf(f, "#define RX_SIZE\t\t0x%08X\n", blob_size);
+	fprintf(f, "#define RX_PAGES\t%u\n", pages);
+	fprintf(f, "\n");
+	fprintf(f, "static const uint32_t\trx_sum[RX_PAGES] = {");
+	for (unsigned i=0; i < pages; i++) {
+		unsigned	cnt = (blob_size - i * RX_PAGE < RX_PAGE) ? blob_size - i * RX_PAGE : RX_PAGE;
+
+		fprintf(f, "%s0x%08X,", (i % 6) ? " " : "\n\t", rx_page_sum(blob + i * RX_PAGE, cnt));
+	}
+	fprintf(f, "\n};\n");
+
+	/* runs of instructions that follow each other */
+	uint32_t	*run = NULL;
+	unsigned	 run_cnt = 0;
+
+	for (unsigned idx = 0; idx < blob_size; ) {
+		if ((map[idx] != '@') && (map[idx] != 'X')) {
+			idx++;
+			continue;
+		}
+
+		unsigned	start = idx;
+
+		while ((idx < blob_size) && ((map[idx] == '@') || (map[idx] == 'X')))
+			idx += instr_len(blob + idx, blob_size - idx);
+		rx_func(f, start, idx);
+
+		run = realloc(run, (run_cnt + 1) * 2 * sizeof(run[0]));
+		if (!run) {
+			fprintf(stderr, "rx_dump(), out of memory.\n");
+			exit(1);
+		}
+		run[2*run_cnt]   = blob_start + start;
+		run[2*run_cnt+1] = blob_start + idx;
+		run_cnt++;
+	}
+
+	/* by address, for a binary search */
+	fprintf(f, "\n\nstatic const struct rx_func\trx_funcs[] = {\n");
+	for (unsigned i=0; i < run_cnt; i++)
+		fprintf(f, "\t{0x%08X, 0x%08X, rx_%08X},\n", run[2*i], run[2*i+1], run[2*i]);
+	fprintf(f, "};\n");
+
+	free(run);
+	fclose(f);
+
+	printf("translation: %u instructions in %u functions, %u left to the interpreters\n",
+		rx_stats.instrs, rx_stats.funcs, rx_stats.ucode);
+}
+
+
+/***/
+
+
 void read_ctrl_file(const char *fname)
 {
 	char	*ctrlname = mem_sprintf("%s.ctrl", fname);
@@ -1079,13 +1598,19 @@ void load_blob(const char *fname)
 static void help()
 {
 		fprintf(stderr,
-"revax-dis [-m vax|sane] [-o <outname>] <binary>\n"
+"revax-dis [-m vax|sane] [-o <outname>] [-e <addr>]... <binary>\n"
+"revax-dis -c <file> [-e <addr>]... <binary>\n"
 "\n"
 "  inputs a VAX binary (raw or a.out) + possibly a <binary>.ctrl file with\n"
 "  hints for the disassembler.\n"
 "\n"
 "  outputs <outname>.(asm|lst|info) and an HTML file in the <outname>.html\n"
-"  directory.\n");
+"  directory.\n"
+"\n"
+"  <outname>.map has the code reachable from the start of the binary and from\n"
+"  the entry points given with -e (hex addresses).\n"
+"\n"
+"  -c translates that code to C for revax-sim instead (see rx_dump()).\n");
 }
 
 
@@ -1115,11 +1640,33 @@ int main(int argc, char *argv[])
 	}
 
 	const char	*outname = NULL;
+	const char	*cname   = NULL;
+	uint32_t	 entry[64];
+	unsigned	 entry_cnt = 0;
 
 	bool	m_arg = false;
 	bool	o_arg = false;
 	int	i;
 	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-e") == 0) {
+			char	*end;
+
+			if ((i+1 < argc) && (entry_cnt < ARRAY_SIZE(entry))) {
+				i++;
+				entry[entry_cnt++] = strtoul(argv[i], &end, 16);
+				if ((*argv[i] != '\0') && (*end == '\0'))
+					continue;
+			}
+			help_exit();
+		}
+
+		if (strcmp(argv[i], "-c") == 0) {
+			if (cname || (i+1 == argc))
+				help_exit();
+			cname = argv[++i];
+			continue;
+		}
+
 		if (strcmp(argv[i], "-m") == 0) {
 			if (m_arg)
 				help_exit();
@@ -1162,6 +1709,15 @@ int main(int argc, char *argv[])
 
 	/***/
 
+	if (cname) {
+		load_blob(fname);
+		blob_start = 0x20040000;
+		prepare_classification();
+		map_blob(entry_cnt, entry);
+		rx_dump(cname, fname);
+		exit(0);
+	}
+
 	struct outfiles *outf = open_out_files(fname, outname);
 
 	detect_type(fname);
@@ -1177,6 +1733,10 @@ printf("blob_size: %d\n", blob_size);
 
          "Writing to:" before the disassembly is just as good.
  */
+	prepare_classification();
+	map_blob(entry_cnt, entry);
+	map_dump(outname);
+
 	dis(outf, 0, blob_size);
 //	dis(outf, 0, 0x22);
 //	dis(outf, 0x24, 0x100);
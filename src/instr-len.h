@@ -0,0 +1,121 @@
+/* Copyright 2018  Peter Lund <firefly@vax64.dk>
+
+   Licensed under GPL v2.
+
+   ---
+
+   instruction lengths -- shared by dis and sim
+
+   The operand specifier lengths come from src/op-len.h, which is generated
+   from the [sim] section of src/operands.spec, the operand counts/widths
+   from src/vax-instr.h.  An operand costs two table lookups: the first byte
+   says whether it is an index prefix, the second lookup is on the byte after
+   it for index prefixes and on the same byte again otherwise.  There are no
+   branches on the addressing mode.
+
+   The callers decide what to do with XFC, reserved instructions, and
+   reserved addressing modes -- the lengths only say that they are there.
+ */
+
+#ifndef INSTR_LEN__H
+#define INSTR_LEN__H
+
+#include <stdint.h>
+
+#include "vax-instr.h"
+
+#include "op-len.h"
+
+
+/* length of the operand specifier at b[] for an operand of width bytes
+
+   -1   reserved addressing mode
+
+   Reads b[1] only if b[0] is an index prefix.
+ */
+static inline int spec_len(const uint8_t *b, int width)
+{
+	unsigned	e0 = op_len_tab[0][b[0]];
+	unsigned	x  = (e0 & OPL_IDX) >> 6;
+	unsigned	e1 = op_len_tab[x][b[x]];
+
+	if ((e0 | e1) & OPL_BAD)
+		return -1;
+	return x + (e1 & OPL_BYTES) + ((e1 & OPL_IMM) >> 5) * width;
+}
+
+
+/* length of the instruction at b[], never reads past b[avail-1]
+
+   >0   length in bytes
+    0   it doesn't fit in avail bytes
+   -1   reserved instruction (including XFC) or reserved addressing mode
+ */
+static inline int instr_len(const uint8_t *b, unsigned avail)
+{
+	if (avail == 0)
+		return 0;
+
+	unsigned	two = b[0] == 0xFD;
+
+	if (two && (avail < 2))
+		return 0;
+
+	unsigned	op  = two ? 0x100 | b[1] : b[0];
+
+	if (((b[0] >= 0xFC) && !two) || !mne[op][0])
+		return -1;
+
+	unsigned	len = 1 + two;
+
+	for (unsigned i=0; i < op_cnt[op]; i++) {
+		if (len >= avail)
+			return 0;
+
+		/* branch displacements are width bytes, no specifier */
+		unsigned	br    = ops[op][i*3] == 'b';
+		int		width = op_width[op][i];
+
+		unsigned	e0 = op_len_tab[0][b[len]];
+		unsigned	x  = br ? 0 : (e0 & OPL_IDX) >> 6;
+
+		if (len + x >= avail)
+			return 0;
+
+		unsigned	e1 = op_len_tab[x][b[len + x]];
+		unsigned	n  = x + (e1 & OPL_BYTES) + ((e1 & OPL_IMM) >> 5) * width;
+
+		if (!br && ((e0 | e1) & OPL_BAD))
+			return -1;
+		len += br ? (unsigned) width : n;
+	}
+
+	return (len > avail) ? 0 : (int) len;
+}
+
+
+/* linear sweep -- the offsets of the consecutive instructions from b[0]
+   onwards, at most max of them
+
+   ofs[0..cnt-1] are the starts, ofs[cnt] is where the sweep stopped: the end
+   of the last instruction, which is the start of an instruction that is
+   reserved or doesn't fit in avail bytes if cnt < max.
+ */
+static inline unsigned instr_bounds(const uint8_t *b, unsigned avail, unsigned max, unsigned ofs[max+1])
+{
+	unsigned	idx = 0;
+	unsigned	cnt = 0;
+
+	while (cnt < max) {
+		int	len = instr_len(b + idx, avail - idx);
+
+		if (len <= 0)
+			break;
+		ofs[cnt++] = idx;
+		idx += len;
+	}
+	ofs[cnt] = idx;
+	return cnt;
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "macros.h"
 #include "strret.h"
@@ -38,6 +39,51 @@
 /***/
 
 
+/* The formatters below run for every operand of every disassembled
+   instruction, so they put the digits in place themselves instead of going
+   through sprintf().  The output is the same.
+ */
+
+/* append s at buf[idx] -- truncates, always terminates, returns the new idx
+   (never more than size-1)
+ */
+static unsigned str_append(char *buf, unsigned idx, unsigned size, const char *s)
+{
+	unsigned	len = strlen(s);
+
+	if (idx >= size)
+		return idx;
+	if (len > size-1-idx)
+		len = size-1-idx;
+
+	memcpy(buf+idx, s, len);
+	buf[idx+len] = '\0';
+	return idx + len;
+}
+
+
+/* cnt upper case hex digits, returns the position after them */
+static char *put_hex(char *p, uint32_t x, int cnt)
+{
+	static const char	digits[] = "0123456789ABCDEF";
+
+	for (int i=cnt-1; i >= 0; i--) {
+		p[i] = digits[x & 0xF];
+		x >>= 4;
+	}
+	return p + cnt;
+}
+
+
+/* "XXXX_XXXX" -- the %04X_%04X format used for 32-bit values */
+static char *put_hex32(char *p, uint32_t x)
+{
+	p = put_hex(p, x >> 16, 4);
+	*p++ = '_';
+	return put_hex(p, x, 4);
+}
+
+
 /* immediate -- 1/2/4/8/16 bytes, may be b/w/l/q/o int or f/d/g/h fp */
 static struct str_ret str_imm(struct big_int imm, uint32_t pc, int width, enum ifp ifp)
 {
@@ -46,19 +92,36 @@ static struct str_ret str_imm(struct big_int imm, uint32_t pc, int width, enum i
 	(void) pc;
 
 	switch (ifp) {
-	case IFP_INT: if (width == 1) sprintf(buf.str, "0x%02X", imm.val[0] & 0xFF);
-		 else if (width == 2) sprintf(buf.str, "0x%04X", imm.val[0] & 0xFFFF);
-		 else if (width == 4) sprintf(buf.str, "0x%04X_%04X", SPLIT(imm.val[0]));
-		 else if (width == 8) {
-				      sprintf(buf.str, "0x%04X_%04X_%04X_%04X",
-				      		SPLIT(imm.val[1]), SPLIT(imm.val[0]));
-		 }
-		 else if (width ==16) {
-				      sprintf(buf.str, "0x%04X_%04X_%04X_%04X__%04X_%04X_%04X_%04X",
-				      		SPLIT(imm.val[3]), SPLIT(imm.val[2]), SPLIT(imm.val[1]), SPLIT(imm.val[0]));
-		 }
-		 else UNREACHABLE();
-		 break;
+	case IFP_INT: {
+		/* 0xXX, 0xXXXX, 0xXXXX_XXXX, ..., 0xXXXX_XXXX_XXXX_XXXX__XXXX_XXXX_XXXX_XXXX */
+		char	*p = buf.str;
+
+		*p++ = '0';
+		*p++ = 'x';
+		if (width == 1)
+			p = put_hex(p, imm.val[0], 2);
+		else if (width == 2)
+			p = put_hex(p, imm.val[0], 4);
+		else if (width == 4)
+			p = put_hex32(p, imm.val[0]);
+		else if (width == 8) {
+			p = put_hex32(p, imm.val[1]);
+			*p++ = '_';
+			p = put_hex32(p, imm.val[0]);
+		} else if (width == 16) {
+			p = put_hex32(p, imm.val[3]);
+			*p++ = '_';
+			p = put_hex32(p, imm.val[2]);
+			*p++ = '_';
+			*p++ = '_';
+			p = put_hex32(p, imm.val[1]);
+			*p++ = '_';
+			p = put_hex32(p, imm.val[0]);
+		} else
+			UNREACHABLE();
+		*p = '\0';
+		break;
+	}
 	case IFP_F: assert(width== 4); return fp_to_str("%g", imm, 'f');
 	case IFP_D: assert(width== 8); return fp_to_str("%g", imm, 'd');
 	case IFP_G: assert(width== 8); return fp_to_str("%g", imm, 'g');
@@ -99,7 +162,20 @@ static struct str_ret str_disp(int32_t disp, uint32_t pc, int width, enum ifp if
 
 	(void) pc, (void) width, (void) ifp;
 
-	sprintf(buf.str, "%d", disp);
+	/* "%d" -- digits from the right, then the sign */
+	char		 tmp[12];
+	char		*p = tmp + sizeof(tmp);
+	uint32_t	 x = (disp < 0) ? -(uint32_t) disp : (uint32_t) disp;
+
+	*--p = '\0';
+	do {
+		*--p = '0' + x % 10;
+		x /= 10;
+	} while (x);
+	if (disp < 0)
+		*--p = '-';
+
+	memcpy(buf.str, p, tmp + sizeof(tmp) - p);
 	return buf;
 }
 
@@ -111,7 +187,9 @@ static struct str_ret str_pcrel(int32_t disp, uint32_t pc, int width, enum ifp i
 
 	(void) width, (void) ifp;
 
-	sprintf(buf.str, "0x%04X_%04X", SPLIT(disp + (uint32_t) pc));
+	buf.str[0] = '0';
+	buf.str[1] = 'x';
+	*put_hex32(buf.str+2, disp + (uint32_t) pc) = '\0';
 	return buf;
 }
 
@@ -123,7 +201,9 @@ static struct str_ret str_addr(int32_t addr, uint32_t pc, int width, enum ifp if
 
 	(void) pc, (void) width, (void) ifp;
 
-	sprintf(buf.str, "0x%04X_%04X", SPLIT(addr));
+	buf.str[0] = '0';
+	buf.str[1] = 'x';
+	*put_hex32(buf.str+2, addr) = '\0';
 	return buf;
 }
 
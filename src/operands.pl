@@ -12,8 +12,9 @@
 #   src/operands.pl --dis < src/operands.spec > src/op-dis.h
 #   src/operands.pl --sim < src/operands.spec > src/op-sim.h
 #   src/operands.pl --val < src/operands.spec > src/op-val.h
+#   src/operands.pl --len < src/operands.spec > src/op-len.h
 #
-#   (the last line is for operand validation)
+#   (the last two lines are for operand validation and operand lengths)
 #
 # There's also (to check the parser):
 #
@@ -802,19 +803,23 @@ done:
 			#  <fname:convfunc>	--> convfunc(fields.fname)
 			#  <width>		--> '1'/'2'/'4'/'8'
 			#  everything else	--> direct output
+			#
+			# everything goes through str_append() which keeps idx
+			# inside ret.str[]
 
 			my $s = $action;
 			while ($s ne '') {
 				if    ($s =~ s/^<width>//) {
-					print  $indent, "if (idx < sizeof(ret.str))\n";
-					print  $indent, "\tidx += snprintf(ret.str+idx, sizeof(ret.str)-idx,\"%d\", width);\n";
+					# same as "%d"
+					print  $indent, "idx = str_append(ret.str, idx, sizeof(ret.str), str_disp(width, pc, width, ifp).str);\n";
 				} elsif ($s =~ s/^<([a-zA-Z0-9_]+):([a-zA-Z0-9_]+)>//) {
 					#          ---------   ---------
-					print  $indent, "if (idx < sizeof(ret.str))\n";
-					print  $indent, "\tidx += snprintf(ret.str+idx, sizeof(ret.str)-idx, \"%s\", str_$2(fields.$1, pc, width, ifp).str);\n";
-				} else {
-					printf "%sret.str[idx++] = '%s';\n", $indent, substr($s, 0, 1);
-					$s =~ s/^.//;
+					print  $indent, "idx = str_append(ret.str, idx, sizeof(ret.str), str_$2(fields.$1, pc, width, ifp).str);\n";
+				} elsif ($s =~ s/^([^<]+)// || $s =~ s/^(.)//) {
+					my $lit = $1;
+
+					$lit =~ s/([\\"])/\\$1/g;
+					printf "%sidx = str_append(ret.str, idx, sizeof(ret.str), \"%s\");\n", $indent, $lit;
 				}
 			}
 		}
@@ -1176,6 +1181,145 @@ sub handle_val() {
 }
 
 
+########
+#
+# len
+
+# the [sim] cases as ([[mask, val]+], bytes, imm) -- bytes = specifier +
+# displacement/address, imm = 1 if the operand width has to be added
+sub len_cases() {
+	my @cases = ();
+
+	foreach my $case (@{$file{'sim'}}) {
+		my @bytes = map { [pattern($_->{'pattern'})] } @{$case->{'bytes'}};
+		my $cnt   = scalar @bytes;
+		my $imm   = 0;
+
+		if (defined $case->{'data'}) {
+			my $width = $case->{'width'};
+
+			if    ($width eq '8')	{ $cnt += 1; }
+			elsif ($width eq '16')	{ $cnt += 2; }
+			elsif ($width eq '32')	{ $cnt += 4; }
+			else			{ $imm  = 1; }
+		}
+		push @cases, [\@bytes, $cnt, $imm];
+	}
+	@cases;
+}
+
+
+# length of the operand specifier b0 b1 -- the first matching case in file
+# order, like op_sim()
+#
+#   (bytes, imm, number of pattern bytes) or () for reserved addressing modes
+sub spec_len($$@) {
+	my ($b0, $b1, @cases) = @_;
+	my @b = ($b0, $b1);
+
+	CASE: foreach my $case (@cases) {
+		my ($bytes, $cnt, $imm) = @{$case};
+
+		for (my $i=0; $i < scalar @{$bytes}; $i++) {
+			my ($mask, $val) = @{$bytes->[$i]};
+
+			next CASE if (($b[$i] & $mask) != $val);
+		}
+		return ($cnt, $imm, scalar @{$bytes});
+	}
+	return ();
+}
+
+
+sub handle_len() {
+	# row 0: the first byte of the specifier
+	# row 1: the byte after an index prefix -- the same for all index prefixes
+	my @row0  = ();
+	my @row1  = ();
+	my @idx   = ();
+	my @cases = len_cases();
+
+	for (my $b0=0; $b0 < 256; $b0++) {
+		# an index prefix is a first byte that matches two-byte cases
+		my @l   = map { [spec_len($b0, $_, @cases)] } (0 .. 255);
+		$idx[$b0] = grep { defined $_->[0] && ($_->[2] == 2) } @l;
+
+		if (!$idx[$b0]) {
+			my ($cnt, $imm) = @{$l[0]};
+
+			$row0[$b0] = defined $cnt ? $cnt | ($imm << 5) : 0x80;
+			next;
+		}
+
+		$row0[$b0] = 0x40 | 1;
+		for (my $b1=0; $b1 < 256; $b1++) {
+			my ($cnt, $imm) = @{$l[$b1]};
+			my $e = defined $cnt ? ($cnt - 1) | ($imm << 5) : 0x80;
+
+			if (defined $row1[$b1] && ($row1[$b1] != $e)) {
+				printf STDERR "--len: %02X %02X doesn't look like the other index prefixes.\n", $b0, $b1;
+				exit 1;
+			}
+			$row1[$b1] = $e;
+		}
+	}
+	for (my $b1=0; $b1 < 256; $b1++) {
+		$row1[$b1] //= 0x80;
+	}
+
+	# [val] patterns without a check function are never allowed
+	foreach my $case (@{$file{'val'}}) {
+		next if defined $case->{'checkfun'};
+
+		my @bytes = map { [pattern($_->{'pattern'})] } @{$case->{'bytes'}};
+		my ($mask0, $val0) = @{$bytes[0]};
+
+		if (scalar @bytes == 1) {
+			for (my $b0=0; $b0 < 256; $b0++) {
+				$row0[$b0] = 0x80 if (($b0 & $mask0) == $val0);
+			}
+			next;
+		}
+
+		my ($mask1, $val1) = @{$bytes[1]};
+		for (my $b0=0; $b0 < 256; $b0++) {
+			if ((($b0 & $mask0) == $val0) != ($idx[$b0] != 0)) {
+				printf STDERR "--len: [val] pattern that isn't about all index prefixes.\n";
+				exit 1;
+			}
+		}
+		for (my $b1=0; $b1 < 256; $b1++) {
+			$row1[$b1] = 0x80 if (($b1 & $mask1) == $val1);
+		}
+	}
+
+	printf "/* generated by operands.pl from operands.spec -- %s */\n", strftime("%Y-%m-%d %H:%M:%S", localtime);
+	printf "\n";
+	printf "/* operand specifier lengths, [0][first byte] and [1][byte after an index prefix]\n";
+	printf "\n";
+	printf "   OPL_BYTES  specifier byte + displacement/address bytes\n";
+	printf "   OPL_IMM    + the operand width (I^#)\n";
+	printf "   OPL_IDX    index prefix, the base specifier is in [1][next byte]\n";
+	printf "   OPL_BAD    reserved addressing mode, regardless of the operand width\n";
+	printf " */\n";
+	printf "#define OPL_BYTES\t0x1F\n";
+	printf "#define OPL_IMM\t\t0x20\n";
+	printf "#define OPL_IDX\t\t0x40\n";
+	printf "#define OPL_BAD\t\t0x80\n";
+	printf "\n";
+	printf "static const uint8_t op_len_tab[2][256] = {\n";
+	foreach my $row (\@row0, \@row1) {
+		printf "{\n";
+		for (my $i=0; $i < 256; $i += 16) {
+			printf "/* %02X */ %s,\n", $i,
+				join(", ", map { sprintf "0x%02X", $_ } @{$row}[$i .. $i+15]);
+		}
+		printf "},\n";
+	}
+	printf "};\n";
+}
+
+
 
 
 ########
@@ -1190,6 +1334,7 @@ sub help() {
 	print "    --dis     generate code to disassemble an operand\n";
 	print "    --sim     generate code to decode an operand\n";
 	print "    --val     generate code to validate an operand\n";
+	print "    --len     generate table of operand lengths\n";
 	print "\n";
 	print "    --dump    show how the sections were interpreted\n";
 	print "    --check   check that [asm], [dis], and [sim] sections are in agreement\n";
@@ -1235,6 +1380,11 @@ if      ($ARGV[0] eq "--check") {
 
 	read_file();
 	handle_val();
+} elsif ($ARGV[0] eq "--len") {
+	shift @ARGV;
+
+	read_file();
+	handle_len();
 } else {
 	help();
 }
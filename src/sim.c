@@ -23,11 +23,31 @@
 
 
 
+/* necessary for MAP_ANONYMOUS and MAP_NORESERVE.
+
+   (They are not part of POSIX so _POSIX_C_SOURCE isn't enough.)
+ */
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define access	unistd_access	/* we have our own access() */
+#include <unistd.h>
+#undef access
 
 #include "macros.h"
 
@@ -46,6 +66,8 @@
 #include "op-val-support.h"
 #include "op-val.h"
 
+#include "instr-len.h"
+
 
 /***/
 
@@ -60,9 +82,264 @@
 #define MF_READ		1
 #define MF_WRITE	2
 
+/* the decode cache has instructions from the page.
+
+   D-TLB entries for the page don't grant write access so stores go the slow
+   way and drop the cached instructions first.
+ */
+#define MF_CODE		4
+
+
+/* physical page directory
+
+   The physical address space is 2^31 bytes = 4 M pages of 512 bytes.  A flat
+   table of page pointers + flags would be 36 MB on a 64-bit machine and nearly
+   all of it would never be looked at, so the table is split in two levels:
+
+     pfn <21:12>	index into dir[]
+     pfn <11:0>		index into the leaf's pages[]/flags[]
+
+   Leaves are allocated on demand.  RAM leaves are allocated (and filled in)
+   the first time anybody looks up a page in them, so the size of the tables
+   follows how much memory the guest touches, not how much it has.
+
+   RAM itself is a single anonymous mapping made with MAP_NORESERVE.  The host
+   kernel only gives us real pages when the guest touches them.
+ */
+#define MEM_PAGE_BITS	9
+#define MEM_LEAF_BITS	12
+#define MEM_DIR_BITS	10
+
+#define MEM_PAGE_SZE	(1 << MEM_PAGE_BITS)
+#define MEM_LEAF_CNT	(1 << MEM_LEAF_BITS)
+#define MEM_DIR_CNT	(1 << MEM_DIR_BITS)
+
+struct mem_leaf {
+	void	*pages[MEM_LEAF_CNT];	/* 4 K entries => 32 KB on a 64-bit machine */
+	uint8_t	 flags[MEM_LEAF_CNT];
+};
+
 struct mem_table {
-	void	*pages[1 << 22];	/* 4 M entries => 32 MB on a 64-bit machine */
-	uint8_t	 flags[1 << 22];
+	struct mem_leaf	*dir[MEM_DIR_CNT];
+
+	/* contiguous RAM from physical address 0 and up */
+	uint8_t		*ram;
+	size_t		 ram_pagecnt;
+};
+
+
+/* get the leaf that covers pfn -- allocate it if necessary.
+
+   A new leaf gets filled in with RAM pages if it overlaps with RAM.  It is
+   published with a compare-and-swap because the run-ahead decoder thread
+   (--run-ahead) looks up pages too.  If the other thread got there first,
+   its leaf wins and ours is freed.
+
+   NULL if pfn is outside the physical address space.
+ */
+static struct mem_leaf *mem_leaf(struct mem_table *mem, uint32_t pfn)
+{
+	uint32_t	dirno = pfn >> MEM_LEAF_BITS;
+
+	if (dirno >= MEM_DIR_CNT)
+		return NULL;
+
+	struct mem_leaf	*leaf = __atomic_load_n(&mem->dir[dirno], __ATOMIC_ACQUIRE);
+	if (leaf)
+		return leaf;
+
+	leaf = calloc(1, sizeof(struct mem_leaf));
+	if (!leaf) {
+		fprintf(stderr, "mem_leaf(pfn: %04X_%04X), out of memory.\n", SPLIT(pfn));
+		exit(1);
+	}
+
+	uint32_t	first = dirno << MEM_LEAF_BITS;
+	for (uint32_t i=0; i < MEM_LEAF_CNT; i++) {
+		if (first + i >= mem->ram_pagecnt)
+			break;
+
+		leaf->pages[i] = mem->ram + (size_t) (first + i) * MEM_PAGE_SZE;
+		leaf->flags[i] = MF_READ | MF_WRITE;
+	}
+
+	struct mem_leaf	*old = NULL;
+
+	if (!__atomic_compare_exchange_n(&mem->dir[dirno], &old, leaf, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(leaf);
+		leaf = old;
+	}
+	return leaf;
+}
+
+
+/* host pointer to physical page pfn -- NULL if there is no memory there */
+static inline void *mem_page(struct mem_table *mem, uint32_t pfn)
+{
+	struct mem_leaf	*leaf = mem_leaf(mem, pfn);
+
+	return leaf ? leaf->pages[pfn & (MEM_LEAF_CNT-1)] : NULL;
+}
+
+
+/* MF_READ/MF_WRITE for physical page pfn -- 0 if there is no memory there */
+static inline uint8_t mem_flags(struct mem_table *mem, uint32_t pfn)
+{
+	struct mem_leaf	*leaf = mem_leaf(mem, pfn);
+
+	return leaf ? leaf->flags[pfn & (MEM_LEAF_CNT-1)] : 0;
+}
+
+
+/* set/clear flags for physical page pfn (which must have memory) */
+static inline void mem_set_flags(struct mem_table *mem, uint32_t pfn, uint8_t set, uint8_t clr)
+{
+	struct mem_leaf	*leaf = mem_leaf(mem, pfn);
+
+	assert(leaf);
+	leaf->flags[pfn & (MEM_LEAF_CNT-1)] = (leaf->flags[pfn & (MEM_LEAF_CNT-1)] & ~clr) | set;
+}
+
+
+/* map a host page at physical page pfn (for ROMs and the like) */
+static void mem_map(struct mem_table *mem, uint32_t pfn, void *page, uint8_t flags)
+{
+	struct mem_leaf	*leaf = mem_leaf(mem, pfn);
+
+	assert(leaf);
+	leaf->pages[pfn & (MEM_LEAF_CNT-1)] = page;
+	leaf->flags[pfn & (MEM_LEAF_CNT-1)] = flags;
+}
+
+
+/* guest memory that the other thread may be using at the same time -- the
+   run-ahead decoder reads code and page tables while the executor stores.
+   Both sides go byte by byte with relaxed atomics, so it isn't a data race.
+   The decoder may still see old bytes, see ra_next() for why that's fine.
+ */
+static inline void mem_read_shared(uint8_t *dst, const uint8_t *src, int cnt)
+{
+	for (int i=0; i < cnt; i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+
+static inline void mem_write_shared(uint8_t *dst, const uint8_t *src, int cnt)
+{
+	for (int i=0; i < cnt; i++)
+		__atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+}
+
+
+/***/
+
+
+/* software TLBs
+
+   xlat() is slow: region check, length check, PTE read (which for P0/P1 is
+   itself a translated read in S0 space), protection check.  The TLBs remember
+   the outcome per virtual page:
+
+     tag	va <31:9> (region + vpn), TLB_INVALID if the entry is empty
+     page	host pointer to the physical page, NULL for I/O space
+     pfn	physical page number
+     rights	read/write permission for each of the 4 access modes
+
+   Write permission is only granted if the PTE's M bit is already set and
+   the physical page is writable.  Everything else has to go the slow way
+   through xlat() so the M bit gets set/the write gets refused.
+
+   There are two TLBs, one for instruction fetches and one for data.  Both
+   are 2-way set-associative with round-robin replacement.
+
+   They are flushed by MTPR to TBIA (everything), TBIS (one page), MAPEN
+   (everything), and P0BR/P0LR/P1BR/P1LR (process space only -- that's what
+   LDPCTX needs).
+ */
+#define TLB_SETS	64
+#define TLB_WAYS	2
+
+#define TLB_INVALID	0xFFFFFFFF
+
+/* access modes, PSL<25:24> */
+#define MODE_KERNEL	0
+#define MODE_EXEC	1
+#define MODE_SUPER	2
+#define MODE_USER	3
+
+#define TLB_R(mode)	(0x01 << (mode))
+#define TLB_W(mode)	(0x10 << (mode))
+
+struct tlb_entry {
+	uint32_t	 tag;
+	uint32_t	 pfn;
+	uint8_t		*page;
+	uint8_t		 rights;
+};
+
+struct tlb {
+	struct tlb_entry	set[TLB_SETS][TLB_WAYS];
+	uint8_t			victim[TLB_SETS];
+};
+
+
+/* instruction fetch window
+
+   The fetch unit keeps a pointer to the host copy of the current code page so
+   the decoder can read the instruction bytes in place.  It only translates
+   again when the PC moves to another page (sequentially or because of a
+   control transfer), when the access mode changes, or after a TLB flush.
+
+   Instructions that might run into the next page are copied into buf[] first,
+   together with as many bytes from the next page as it will give us.  The
+   decoder only faults if it actually needs a byte it didn't get, so a fault on
+   the next page is only taken by instructions that really straddle it.
+ */
+#define IB_MAX		(2 + 6*MAX_OPLEN)	/* no instruction is longer */
+
+struct ifetch {
+	uint32_t	 tag;		/* va >> MEM_PAGE_BITS, TLB_INVALID if empty */
+	int		 mode;		/* access mode it was translated for */
+	uint8_t		*page;		/* host copy of the page */
+	uint32_t	 pfn;		/* physical page -- for the decode cache */
+
+	/* page straddling instructions */
+	uint8_t		 buf[IB_MAX];
+	uint32_t	 err_va;	/* first byte we couldn't fetch */
+	int		 err;		/* why */
+};
+
+
+/* lazy condition codes -- see flags_get() */
+#define LF_NONE		0	/* psl[] has the flags */
+#define LF_RES		1	/* N/Z from res, V = v */
+#define LF_ADD		2	/* N/Z from res, V/C from a + b + cin */
+#define LF_SUB		3	/* N/Z from res, V/C from a - (b + cin) */
+#define LF_CMP		4	/* N/Z/C from a <=> b, V = 0 */
+
+struct lflags {
+	uint8_t		op;		/* LF_xxx */
+	uint8_t		width;
+	uint8_t		v;
+	uint32_t	a, b, res;
+
+	/* where C comes from -- µops that leave C alone just copy this */
+	struct {
+		uint8_t		op;	/* LF_ADD/LF_SUB/LF_CMP, LF_NONE: it's c */
+		uint8_t		width;
+		uint8_t		cin, c;
+		uint32_t	a, b;
+	} carry;
+};
+
+
+#define JNL_CNT		8	/* power of 2, > autoinc/dec per instruction */
+
+struct jnl_entry {
+	uint32_t	val;		/* before the change */
+	uint16_t	idx;		/* µop that changed it */
+	uint8_t		reg;
 };
 
 struct cpu {
@@ -72,6 +349,37 @@ struct cpu {
 	uint32_t	psl[2];		/* psl[1] is only valid in the lower 4 bits */
 	uint32_t	preg[64];
 
+	/* flag-setting µop not folded into psl[] yet, arch/µ */
+	struct lflags	lf[2];
+	long		lf_ops, lf_evals;
+
+	struct tlb	itlb, dtlb;
+	struct ifetch	ib;
+	struct dcache	*dcache;
+	struct tcache	*tcache;
+	struct jit	*jit;		/* NULL if there is no JIT */
+	struct runahead	*ra;		/* NULL unless --run-ahead */
+	int		engine;		/* ENG_xxx -- --engine */
+	long		fx_instrs, fx_ucode, fx_checked;	/* instructions, handed on, compared */
+	long		fx_known;	/* not compared, known to differ -- ls_known[] */
+	long		rx_calls, rx_instrs;	/* translated ROM code -- see rx_run() */
+
+	uint32_t	events;		/* EV_xxx -- see events_post() */
+	uint32_t	irq;		/* device interrupt requests, bit n: IPL n */
+
+	uint64_t	clock;		/* instructions retired */
+	uint64_t	due;		/* next time the timers need attention */
+	struct timers	*timers;
+
+	/* GPRs changed by autoinc/autodec since the last commit -- jnl_log() */
+	struct jnl_entry	jnl[JNL_CNT];
+	unsigned		jnl_cnt, jnl_base;	/* entries jnl_base..jnl_cnt-1 */
+
+	/* last memory management fault -- for the exception frame */
+	uint32_t	mm_va;
+	int		mm_err;
+
+	int		uidx;		/* where datapath() stopped */
 	int		stopped;
 };
 
@@ -139,434 +447,5635 @@ static int io(uint32_t pa, int mode, int len, uint32_t *data, int *err)
 
 
 
-/* 0:  can't translate -- exception of some kind, info in pa
-   1:  translated ok
+/* PTE fields */
+#define PTE_V(pte)	(((pte) >> 31) & 1)
+#define PTE_PROT(pte)	(((pte) >> 27) & 0xF)
+#define PTE_M		(1u << 26)
+#define PTE_PFN(pte)	((pte) & 0x1FFFFF)
 
-   Every translation checks whether mapping is enabled, then checks the region,
-   then the region length, then the pte.
+/* current access mode */
+#define PSL_IV		(1u << 5)	/* integer overflow trap enable */
+#define CUR_MODE(cpu)	(((cpu)->r[R_PSL] >> 24) & 3)
+
+
+/* translation faults, returned in *err
 
-   It calls itself recursively, once, if asked to translate P0 or P1 addresses
-   and mapping is enabled.  Process page tables are pageable and reside in S.
-   System page tables are not pageable.
+   The low 3 bits are the same as the memory management fault parameter the
+   VAX pushes on the stack.  MMF_TNV tells translation-not-valid apart from
+   access-control-violation.  MMF_NXM is for non-existent memory (and writes
+   to ROM) -- it's a machine check, not a memory management fault.
  */
-static int xlat(struct cpu *cpu, uint32_t va, uint32_t *pa) __attribute__((unused));
-static int xlat(struct cpu *cpu, uint32_t va, uint32_t *pa)
-{
-	if (cpu->preg[PR_MAPEN] & 1) {
-		/* mapping enabled */
-		uint32_t	base;
-		uint32_t	len;
+#define MMF_LEN		0x01	/* length violation */
+#define MMF_PTE		0x02	/* fault was on the process PTE reference */
+#define MMF_WRITE	0x04	/* write or modify intent */
+#define MMF_TNV		0x100
+#define MMF_NXM		0x200
 
-		(void) base, (void) len;
 
-		/* check region */
-		switch ((va >> 30) & 0x3) {
-		case 0: /* P0 */
-			base = cpu->preg[PR_P0BR];
-			len  = cpu->preg[PR_P0LR];
-			break;
-		case 1: /* P1 */
-			base = cpu->preg[PR_P1BR];
-			len  = cpu->preg[PR_P1LR];
-			break;
-		case 2: /* S0 */
-			base = cpu->preg[PR_SBR];
-			len  = cpu->preg[PR_SLR];
-			break;
-		case 3:	/* reserved region */
-			return 0;
-		default:
-			UNREACHABLE();
-		}
+/* rights per protection code -- TLB_R()/TLB_W() bits for K/E/S/U
 
-		return 0;
+   The codes are "<read-mode><write-mode>": ERKW = executive read, kernel
+   write.  A mode that can access a page can also access it from every more
+   privileged mode.  Code 1 is reserved, treat it like NA.
+ */
+#define RD(m)	(0x0F >> (3-(m)))	/* read  for mode m and all inner modes */
+#define WR(m)	((0xF0 >> (3-(m))) & 0xF0)	/* write for mode m and all inner modes */
+
+static const uint8_t prot_rights[16] = {
+	[ 0] = 0,			/* NA   */
+	[ 1] = 0,			/* ---- */
+	[ 2] = RD(0) | WR(0),		/* KW   */
+	[ 3] = RD(0),			/* KR   */
+	[ 4] = RD(3) | WR(3),		/* UW   */
+	[ 5] = RD(1) | WR(1),		/* EW   */
+	[ 6] = RD(1) | WR(0),		/* ERKW */
+	[ 7] = RD(1),			/* ER   */
+	[ 8] = RD(2) | WR(2),		/* SW   */
+	[ 9] = RD(2) | WR(1),		/* SREW */
+	[10] = RD(2) | WR(0),		/* SRKW */
+	[11] = RD(2),			/* SR   */
+	[12] = RD(3) | WR(2),		/* URSW */
+	[13] = RD(3) | WR(1),		/* UREW */
+	[14] = RD(3) | WR(0),		/* URKW */
+	[15] = RD(3),			/* UR   */
+};
 
-	} else {
-		/* no translation */
-		*pa = va;
-		return 1;
-	}
-}
+#undef RD
+#undef WR
 
 
-/* 1: success
-   0: failure -- no memory at address, no I/O device at address, unaligned
-      I/O access, invalid page, no read/write access to page, ...
+/* read an aligned longword from physical memory -- 0 if there is no memory */
+static int phys_ld32(struct mem_table *mem, uint32_t pa, uint32_t *val)
+{
+	uint8_t	*page = mem_page(mem, pa >> MEM_PAGE_BITS);
+	uint8_t	 buf[4];
 
-   len: 1/2/4/8
-   datahi ignored unless len == 8
-   err only set on failure
+	assert((pa & 3) == 0);
+	if (!page || !(mem_flags(mem, pa >> MEM_PAGE_BITS) & MF_READ))
+		return 0;
 
-   The VAX defines something called "interlock granularity" which may be something
-   as big as a whole 512-byte page.  All interlocks within an interlock granularity
-   act as a single interlock.
+	/* page tables -- the run-ahead decoder reads them too */
+	mem_read_shared(buf, page + (pa & (MEM_PAGE_SZE-1)), 4);
+	*val = L(buf[0]);
+	return 1;
+}
 
- */
-static int access(struct cpu *cpu, int mode, uint32_t va, int len,
-           uint32_t *data, uint32_t *datahi, int *err)
+
+/* write an aligned longword to physical memory -- 0 if there is no memory */
+static int phys_st32(struct mem_table *mem, uint32_t pa, uint32_t val)
 {
-	(void) cpu, (void) mode, (void) va, (void) len, (void) data, (void) datahi, (void) err;
+	uint8_t	*page = mem_page(mem, pa >> MEM_PAGE_BITS);
+	uint8_t	 buf[4] = {BYTE(val, 0), BYTE(val, 1), BYTE(val, 2), BYTE(val, 3)};
 
-	/* xlat/access check, once or twice */
-	/* mem or I/O calls, once or twice
-	   handle mem with memcpy()?  or with aligned access?  the latter.
-	   I/O definitely needs aligned access
+	assert((pa & 3) == 0);
+	if (!page || !(mem_flags(mem, pa >> MEM_PAGE_BITS) & MF_WRITE))
+		return 0;
 
-           use mem pages even for I/O space.  if a page is present, go use it,
-           otherwise call I/O system.
-	 */
-	return 0;
+	mem_write_shared(page + (pa & (MEM_PAGE_SZE-1)), buf, 4);
+	return 1;
 }
 
 
-/* fetch block
+/* 0:  can't find the pte -- exception of some kind, info in err
+   1:  found it
 
+   Checks the region, then the region length, then reads the pte.
 
-  bool fetch(uint32_t addr, unsigned bytecnt, uint8_t dst[bytecnt])
+   It calls xlat() recursively, once, if asked to find the pte for a P0 or P1
+   address.  Process page tables are pageable and reside in S0.  System page
+   tables are not pageable.
 
-  alternative:
+   Only called with mapping enabled.
+ */
+static int xlat(struct cpu *cpu, uint32_t va, int write, int mode, uint32_t *pa, uint32_t *pte, int *err);
 
-    fetch n bytes from addr into dstbuf
-    if that is impossible, fill remaining bytes with 0x00
+static int pte_find(struct cpu *cpu, uint32_t va, uint32_t *pte, uint32_t *pte_pa, int *err)
+{
+	uint32_t	vpn = (va >> MEM_PAGE_BITS) & 0x1FFFFF;
+	uint32_t	base;
+
+	/* check region + length */
+	switch ((va >> 30) & 0x3) {
+	case 0: /* P0 -- grows up */
+		if (vpn >= cpu->preg[PR_P0LR]) {
+			*err = MMF_LEN;
+			return 0;
+		}
+		base = cpu->preg[PR_P0BR];
+		break;
+	case 1: /* P1 -- grows down */
+		if (vpn < cpu->preg[PR_P1LR]) {
+			*err = MMF_LEN;
+			return 0;
+		}
+		base = cpu->preg[PR_P1BR];
+		break;
+	case 2: /* S0 */
+		if (vpn >= cpu->preg[PR_SLR]) {
+			*err = MMF_LEN;
+			return 0;
+		}
+		/* SBR is a physical address */
+		*pte_pa = cpu->preg[PR_SBR] + vpn*4;
+		if (!phys_ld32(cpu->mem, *pte_pa, pte)) {
+			*err = MMF_NXM;
+			return 0;
+		}
+		return 1;
+	case 3:	/* reserved region */
+		*err = MMF_LEN;
+		return 0;
+	default:
+		UNREACHABLE();
+	}
 
-    return no of valid bytes?
-    return last valid addr?
+	/* P0/P1: the pte lives at a virtual address in S0.  The hardware
+	   doesn't check the protection of that page, only that it is there.
+	 */
+	uint32_t	spte;
+	int		err2;
+	if (!xlat(cpu, base + vpn*4, 0, -1, pte_pa, &spte, &err2)) {
+		*err = (err2 & (MMF_LEN | MMF_TNV | MMF_NXM)) | MMF_PTE;
+		return 0;
+	}
+	if (!phys_ld32(cpu->mem, *pte_pa, pte)) {
+		*err = MMF_NXM;
+		return 0;
+	}
+	return 1;
+}
 
-   in sim, we actually need to fetch() to go through address translation and
-   access checks.  Possibly more than one address translation and address check.
-   at some point, simulated bus cycles should be generated.
- */
 
-/* fetch with memory translation, handle unaligned access.
-   stop at non-existing memory or non-mapped page.
+/* 0:  can't translate -- exception of some kind, info in err
+   1:  translated ok
 
-   let's ignore I/O space for now, except for ROMs.
+   Every translation checks whether mapping is enabled, then checks the region,
+   then the region length, then the protection, then the valid bit.  Writes
+   set the M bit in the pte.
+
+   mode is the access mode to check the protection for, -1 for no check.
+   The pte is passed back to the caller (as it was before the M bit got set)
+   so the TLB can work out the rights for the other modes.  It is 0 if
+   mapping is disabled.
  */
-static void mem_fetch(struct cpu *cpu, uint32_t va, void *buf, size_t req_sze, size_t *fetch_sze)
+static int xlat(struct cpu *cpu, uint32_t va, int write, int mode, uint32_t *pa, uint32_t *ptep, int *err)
 {
-	(void) cpu, (void) va, (void) buf, (void) req_sze, (void) fetch_sze;
-}
+	if (!(cpu->preg[PR_MAPEN] & 1)) {
+		/* no translation */
+		*pa   = va;
+		*ptep = 0;
+		return 1;
+	}
 
+	/* mapping enabled */
+	uint32_t	pte, pte_pa;
 
-/* how much contiguous memory? */
-static void mem_init(struct cpu *cpu, size_t sze)
-{
-	/* how many pages? */
-	if (sze & (512-1)) {
-		fprintf(stderr, "mem_init(sze: %zu), not an integral number of pages.\n", sze);
-		exit(1);
+	if (!pte_find(cpu, va, &pte, &pte_pa, err)) {
+		*err |= MMF_WRITE * !!write;
+		return 0;
 	}
 
-	size_t	 pagecnt = sze >> 9;
-	uint8_t	*blob    = calloc(pagecnt, 512);
+	/* access violations take precedence over invalid translations */
+	if ((mode >= 0) &&
+	    !(prot_rights[PTE_PROT(pte)] & (write ? TLB_W(mode) : TLB_R(mode)))) {
+		*err = MMF_WRITE * !!write;
+		return 0;
+	}
+
+	if (!PTE_V(pte)) {
+		*err = MMF_TNV | MMF_WRITE * !!write;
+		return 0;
+	}
 
-	for (size_t page=0; page < pagecnt; page++) {
-		cpu->mem->pages[page] = blob + page*512;
-		cpu->mem->flags[page] = MF_READ | MF_WRITE;
+	if (write && !(pte & PTE_M)) {
+		if (!phys_st32(cpu->mem, pte_pa, pte | PTE_M)) {
+			*err = MMF_NXM;
+			return 0;
+		}
 	}
+
+	*pa   = (PTE_PFN(pte) << MEM_PAGE_BITS) | (va & (MEM_PAGE_SZE-1));
+	*ptep = pte | PTE_M * !!write;
+	return 1;
 }
 
 
-/* load a ROM */
-static void rom_load(struct cpu *cpu, uint32_t pa, const char *fname) __attribute__((unused));
-static void rom_load(struct cpu *cpu, uint32_t pa, const char *fname)
+/* flush the whole TLB */
+static void tlb_flush(struct tlb *tlb)
 {
-	(void) cpu, (void) pa, (void) fname;
+	for (int i=0; i < TLB_SETS; i++)
+		for (int j=0; j < TLB_WAYS; j++)
+			tlb->set[i][j].tag = TLB_INVALID;
 }
 
 
+/* flush the entries for P0/P1 */
+static void tlb_flush_process(struct tlb *tlb)
+{
+	for (int i=0; i < TLB_SETS; i++)
+		for (int j=0; j < TLB_WAYS; j++)
+			if (tlb->set[i][j].tag < (0x80000000 >> MEM_PAGE_BITS))
+				tlb->set[i][j].tag = TLB_INVALID;
+}
 
 
-/***/
-
-#include "dis-uop.h"
+/* flush the entry for a single page */
+static void tlb_flush_page(struct tlb *tlb, uint32_t va)
+{
+	uint32_t	tag = va >> MEM_PAGE_BITS;
 
+	for (int j=0; j < TLB_WAYS; j++)
+		if (tlb->set[tag % TLB_SETS][j].tag == tag)
+			tlb->set[tag % TLB_SETS][j].tag = TLB_INVALID;
+}
 
-/* instruction decode -- opcode => µop/index, expected operands */
 
-static void decode(struct cpu *cpu, int *uop_cnt, struct uop uop[])
+/* TLB hit -- NULL if miss */
+static inline struct tlb_entry *tlb_lookup(struct tlb *tlb, uint32_t va)
 {
-	(void) cpu, (void) uop_cnt, (void) uop;
+	uint32_t		 tag = va >> MEM_PAGE_BITS;
+	struct tlb_entry	*set = tlb->set[tag % TLB_SETS];
 
-	*uop_cnt = 0;
+	for (int j=0; j < TLB_WAYS; j++)
+		if (set[j].tag == tag)
+			return &set[j];
+	return NULL;
 }
 
 
+/* TLB miss (or not enough rights in the entry we have): translate the slow
+   way and (re)load the entry.
 
+   NULL if the access faults -- info in err.
+ */
+static struct tlb_entry *tlb_fill(struct cpu *cpu, struct tlb *tlb, uint32_t va, int write, int *err)
+{
+	uint32_t	pa, pte;
 
-/***/
+	if (!xlat(cpu, va, write, CUR_MODE(cpu), &pa, &pte, err))
+		return NULL;
 
+	/* the translation went well, find out what the rights are for all
+	   modes so the next access can skip xlat().
+	 */
+	uint32_t	pfn    = pa >> MEM_PAGE_BITS;
+	uint8_t		rights = 0xFF;
 
-/* data width for uop */
-static int uop_width(int len)
-{
-	switch (len) {
-	case UW_8 :	return 1;
-	case UW_16:	return 2;
-	case UW_32:	return 4;
-	default:
-		UNREACHABLE();
+	if (cpu->preg[PR_MAPEN] & 1) {
+		rights = prot_rights[PTE_PROT(pte)];
+		if (!(pte & PTE_M))
+			rights &= 0x0F;
+	}
+
+	uint8_t		flags = mem_flags(cpu->mem, pfn);
+	if (!(flags & MF_READ))
+		rights &= 0xF0;
+	if (!(flags & MF_WRITE) || (flags & MF_CODE))
+		rights &= 0x0F;
+
+	/* reuse the entry for the page if there is one, otherwise evict */
+	uint32_t		 tag = va >> MEM_PAGE_BITS;
+	struct tlb_entry	*e   = tlb_lookup(tlb, va);
+
+	if (!e) {
+		e = &tlb->set[tag % TLB_SETS][tlb->victim[tag % TLB_SETS]];
+		tlb->victim[tag % TLB_SETS] = (tlb->victim[tag % TLB_SETS] + 1) % TLB_WAYS;
 	}
+
+	e->tag    = tag;
+	e->pfn    = pfn;
+	e->page   = mem_page(cpu->mem, pfn);
+	e->rights = rights;
+	return e;
 }
 
 
-/* check flags according to cc -- used by bcc-arch/bcc-µ */
-static int match_cc(int flags, int cc)
+static void dcache_drop_page(struct cpu *cpu, uint32_t pfn);
+
+
+/* translate through a TLB -- 0 if the access faults, info in err */
+static int tlb_xlat(struct cpu *cpu, struct tlb *tlb, uint32_t va, int write,
+                    struct tlb_entry **entry, int *err)
 {
-	switch (cc) {
-	case  2: /* NEG   !=          */  return ! Z(flags);
-	case  3: /* EQL   =           */  return   Z(flags);
-	case  4: /* GTR   >  signed   */  return !(N(flags) | Z(flags));
-	case  5: /* LEQ   <= signed   */  return  (N(flags) | Z(flags));
-	case  8: /* GRQ   >= signed   */  return ! N(flags);
-	case  9: /* LSS   <  signed   */  return   N(flags);
-	case 10: /* GTRU  >  unsigned */  return !(C(flags) | Z(flags));
-	case 11: /* LEQU  <= unsigned */  return  (C(flags) | Z(flags));
-	case 12: /* VC   ovrflw clear */  return ! V(flags);
-	case 13: /* VS   ovrflw set   */  return   V(flags);
-	case 14: /* GEQU  >= unsigned */  return ! C(flags);
-	case 15: /* BLSSU <  unsigned */  return   C(flags);
-	default:
-		UNREACHABLE();
+	struct tlb_entry	*e   = tlb_lookup(tlb, va);
+	uint8_t			 need = write ? TLB_W(CUR_MODE(cpu)) : TLB_R(CUR_MODE(cpu));
+
+	if (!e || !(e->rights & need)) {
+		e = tlb_fill(cpu, tlb, va, write, err);
+		if (!e)
+			return 0;
+		if (!(e->rights & need) && write && e->page &&
+		    (mem_flags(cpu->mem, e->pfn) & MF_CODE)) {
+			/* store to a page with decoded instructions */
+			dcache_drop_page(cpu, e->pfn);
+			e = tlb_fill(cpu, tlb, va, write, err);
+			if (!e)
+				return 0;
+		}
+		if (!(e->rights & need)) {
+			/* translation ok but the physical page refuses */
+			*err = MMF_NXM;
+			return 0;
+		}
 	}
+
+	*entry = e;
+	return 1;
 }
 
 
+/* pending events
 
-#define UADDR_DONE	0xFFFF
+   Everything that can make the CPU do something other than run the next
+   instruction is a bit in cpu->events.  The executor looks at that one word
+   once per trace (or per instruction it runs on its own) instead of polling
+   the interrupt lines, SISR, PSL<T>, the timers and the console before every
+   instruction.
 
-/* UADDR_DONE for "done"
-   nn for "please fetch me the µop flow starting at nn"
+   Devices, signal handlers and other threads set bits with events_post()
+   and irq_post().  The bits that also depend on the CPU state -- is there a
+   software or device interrupt above IPL, is PSL<T> set -- are worked out
+   again by events_update() when that state changes: MTPR to IPL/SIRR/SISR
+   and instructions that write PSL.  MTPR ends a trace and PSL writers are
+   never put in one, so an interrupt that becomes deliverable that way is
+   taken before the next instruction.  One that is requested by a device in
+   the middle of a trace waits for the end of it, which is at most
+   TR_MAXINSTR instructions later -- still at an instruction boundary.
  */
-static int datapath(struct cpu *cpu, int uop_cnt, struct uop uop[uop_cnt])
+#define EV_HALT		0x01	/* halt request (console, ^C) */
+#define EV_IRQ		0x02	/* device interrupt request above IPL */
+#define EV_SIRQ		0x04	/* software interrupt request above IPL */
+#define EV_TRACE	0x08	/* PSL<T> -- one instruction at a time */
+#define EV_TP		0x10	/* PSL<TP> -- trace trap before the next one */
+#define EV_TIMER	0x20	/* a device timer expired */
+#define EV_STATS	0x40	/* write the --stats report (SIGUSR1) */
+#define EV_PROF		0x80	/* take a --profile sample (SIGPROF) */
+
+#define PSL_T		(1u << 4)
+#define PSL_TP		(1u << 30)
+#define PSL_IPL(psl)	(((psl) >> 16) & 0x1F)
+
+static inline void events_post(struct cpu *cpu, uint32_t ev)
 {
-	for (int i=0; i < uop_cnt; i++) {
-		struct uop	u = uop[i];
+	__atomic_fetch_or(&cpu->events, ev, __ATOMIC_RELEASE);
+}
 
-		/* µcode is never allowed to refer to r15/PC directly */
-		assert(u.s1  != 15);
-		assert(u.s2  != 15);
-		assert(u.dst != 15);
 
-		switch (u.op) {
-		/* no operands */
-		case U_NOP:
-			break;
-		case U_STOP:
-			cpu->stopped = 1;
-			return UADDR_DONE;
-		case U_COMMIT:
-		case U_ROLLBACK:
-			/* FIXME -- not supported yet, may not need to be µops */
-			assert(0);
-			break;
+static inline void events_clear(struct cpu *cpu, uint32_t ev)
+{
+	__atomic_fetch_and(&cpu->events, ~ev, __ATOMIC_RELEASE);
+}
 
-		/* imm32, dst */
-		case U_IMM:
-			cpu->r[u.dst] = u.imm;
-			break;
 
-		/* cc, utarget -- flags */
-		case U_BCC:
-			switch (u.cc) {
-			case U_CC_CC:
-				assert(0);
-				break;
-			case U_CC_ALWAYS:
-				return u.utarget;
+/* a device requests an interrupt at ipl (0x10..0x17) */
+static void irq_post(struct cpu *cpu, int ipl) __attribute__((unused));
+static void irq_post(struct cpu *cpu, int ipl)
+{
+	__atomic_fetch_or(&cpu->irq, 1u << ipl, __ATOMIC_RELEASE);
+	events_post(cpu, EV_IRQ);
+}
 
-			case U_CC_CALL:
-			case U_CC_RET:
-				/* FIXME -- not supported/necessary yet */
-				assert(0);
+
+/* any request in the mask above the current IPL? */
+static bool above_ipl(struct cpu *cpu, uint32_t mask)
+{
+	uint32_t	ipl = PSL_IPL(cpu->r[R_PSL]);
+
+	return (mask >> ipl) > 1;
+}
+
+
+/* the CPU state the events depend on has changed */
+static void events_update(struct cpu *cpu)
+{
+	uint32_t	set = 0;
+
+	if (above_ipl(cpu, __atomic_load_n(&cpu->irq, __ATOMIC_ACQUIRE)))
+		set |= EV_IRQ;
+	if (above_ipl(cpu, cpu->preg[PR_SISR]))
+		set |= EV_SIRQ;
+	if (cpu->r[R_PSL] & PSL_T)
+		set |= EV_TRACE;
+	if (cpu->r[R_PSL] & PSL_TP)
+		set |= EV_TP;
+
+	events_clear(cpu, (EV_IRQ | EV_SIRQ | EV_TRACE | EV_TP) & ~set);
+	if (set)
+		events_post(cpu, set);
+}
+
+
+/* device timers
+
+   Devices don't get polled, they post timers: "call me back n instructions
+   from now" (interval timer ticks, disk transfer done, console ready to
+   transmit again).  Time is cpu->clock, the number of instructions retired.
+
+   The timers are kept in a hierarchical timer wheel: TW_LEVELS levels of
+   TW_SLOTS slots each, level L covers TW_SLOTS^(L+1) instructions.  A timer
+   goes into the lowest level where its expiry time has the same upper bits
+   as the wheel's current time, in the slot picked by its digit at that
+   level.  Timers further away than the whole wheel go on a list of their
+   own, which is put back on the wheel when time moves into the next window.
+   Adding is O(1).
+
+   When time reaches a slot on a higher level, its timers are moved down to
+   the levels below (they are now closer); when it reaches a level 0 slot,
+   they fire.  Each level has a bitmap of the slots in use, so finding the
+   next slot that needs attention is a ctz per level and the wheel jumps
+   straight to it -- empty slots are never visited.
+
+   cpu->due is that next point in time, the executor compares it with
+   cpu->clock once per trace and posts EV_TIMER when it is reached.  It
+   doesn't start a trace that would run past it, so timers fire on time.
+ */
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_LEVELS	4			/* 2^24 instructions */
+
+struct timer {
+	uint64_t	 when;			/* cpu->clock value it fires at */
+	void		(*fire)(struct cpu *cpu, struct timer *t);
+	void		*dev;			/* for the device */
+
+	/* wheel bookkeeping */
+	struct timer	*next;
+};
+
+struct timers {
+	uint64_t	 now;			/* time the wheel is at */
+	struct timer	*slot[TW_LEVELS][TW_SLOTS];
+	uint64_t	 used[TW_LEVELS];	/* bitmap of non-empty slots */
+	struct timer	*far;			/* beyond the last level */
+
+	long		 fired, cascaded;
+};
+
+
+static void timers_init(struct cpu *cpu)
+{
+	cpu->timers = calloc(1, sizeof(struct timers));
+	if (!cpu->timers) {
+		fprintf(stderr, "timers_init(), out of memory.\n");
+		exit(1);
+	}
+	cpu->due = UINT64_MAX;
+}
+
+
+static void tw_link(struct timer **head, struct timer *t)
+{
+	t->next = *head;
+	*head   = t;
+}
+
+
+/* put t in the slot for its expiry time, relative to tw->now */
+static void tw_insert(struct timers *tw, struct timer *t)
+{
+	if (t->when <= tw->now)
+		t->when = tw->now + 1;		/* already due -- next step */
+
+	int	l = (63 - __builtin_clzll(t->when ^ tw->now)) / TW_BITS;
+
+	if (l >= TW_LEVELS) {
+		tw_link(&tw->far, t);
+		return;
+	}
+
+	unsigned	s = (t->when >> (l * TW_BITS)) & (TW_SLOTS-1);
+
+	tw_link(&tw->slot[l][s], t);
+	tw->used[l] |= 1ull << s;
+}
+
+
+/* the next time the wheel has to do something -- UINT64_MAX if never */
+static uint64_t tw_next(struct timers *tw)
+{
+	for (int l=0; l < TW_LEVELS; l++) {
+		unsigned	digit = (tw->now >> (l * TW_BITS)) & (TW_SLOTS-1);
+		uint64_t	later = tw->used[l] & ~((2ull << digit) - 1);
+
+		/* everything on a level is in the same TW_SLOTS-slot window
+		   as now, after now's digit
+		 */
+		if (later) {
+			uint64_t	span = (uint64_t) 1 << (l * TW_BITS);
+			uint64_t	base = tw->now & ~(span * TW_SLOTS - 1);
+
+			return base + __builtin_ctzll(later) * span;
+		}
+	}
+
+	uint64_t	min = UINT64_MAX;
+
+	for (struct timer *t = tw->far; t; t = t->next)
+		if (t->when < min)
+			min = t->when;
+	return min;
+}
+
+
+/* run the wheel up to cpu->clock: fire what's due, move the rest down */
+static void timers_run(struct cpu *cpu)
+{
+	struct timers	*tw = cpu->timers;
+
+	while (1) {
+		uint64_t	next = tw_next(tw);
+
+		if (next > cpu->clock) {
+			/* nothing due yet -- but if that moves the wheel into
+			   the next window, the far list may have timers for it
+			 */
+			if (tw->far && ((tw->now ^ cpu->clock) >> (TW_LEVELS * TW_BITS))) {
+				struct timer	*far = tw->far;
+
+				tw->far = NULL;
+				tw->now = cpu->clock;
+				while (far) {
+					struct timer	*t = far;
+
+					far = t->next;
+					tw->cascaded++;
+					tw_insert(tw, t);
+				}
+				continue;
+			}
+			tw->now  = cpu->clock;
+			cpu->due = next;
+			return;
+		}
+		tw->now = next;
+
+		/* which level is it for?  the lowest with a slot starting here */
+		struct timer	*list = NULL;
+		int		 l;
+
+		for (l=0; l < TW_LEVELS; l++) {
+			unsigned	s = (next >> (l * TW_BITS)) & (TW_SLOTS-1);
+
+			if ((tw->used[l] >> s) & 1) {
+				list = tw->slot[l][s];
+				tw->slot[l][s] = NULL;
+				tw->used[l] &= ~(1ull << s);
 				break;
-			default:
-				if (match_cc(cpu->psl[u.flags], u.cc))
-					return u.utarget;
 			}
-			break;
+		}
+		if (l == TW_LEVELS) {
+			list    = tw->far;
+			tw->far = NULL;
+		}
 
-		/* src */
-		case U_JMP:
-			cpu->r[15] = cpu->r[u.s1];
+		while (list) {
+			struct timer	*t = list;
+
+			list = t->next;
+			if (t->when == next) {
+				/* may post timers again */
+				tw->fired++;
+				t->fire(cpu, t);
+			} else {
+				tw->cascaded++;
+				tw_insert(tw, t);
+			}
+		}
+	}
+}
+
+
+/* call t->fire() delay instructions from now */
+static void timer_add(struct cpu *cpu, struct timer *t, uint64_t delay)
+{
+	/* the wheel may be behind cpu->clock, that's fine -- the slot is
+	   picked relative to where the wheel is
+	 */
+	t->when = cpu->clock + delay;
+	tw_insert(cpu->timers, t);
+	if (t->when < cpu->due)
+		cpu->due = t->when;
+}
+
+
+/* side effects of writing to an internal processor register */
+static void mtpr(struct cpu *cpu, uint32_t preg, uint32_t val)
+{
+	if (preg >= ARRAY_SIZE(cpu->preg))
+		return;		/* FIXME reserved operand */
+
+	switch (preg) {
+	case PR_TBIA:
+		tlb_flush(&cpu->itlb);
+		tlb_flush(&cpu->dtlb);
+		cpu->ib.tag = TLB_INVALID;
+		return;
+	case PR_TBIS:
+		tlb_flush_page(&cpu->itlb, val);
+		tlb_flush_page(&cpu->dtlb, val);
+		cpu->ib.tag = TLB_INVALID;
+		return;
+	case PR_MAPEN:
+		cpu->preg[preg] = val & 1;
+		tlb_flush(&cpu->itlb);
+		tlb_flush(&cpu->dtlb);
+		cpu->ib.tag = TLB_INVALID;
+		return;
+	case PR_P0BR:
+	case PR_P0LR:
+	case PR_P1BR:
+	case PR_P1LR:
+		cpu->preg[preg] = val;
+		tlb_flush_process(&cpu->itlb);
+		tlb_flush_process(&cpu->dtlb);
+		cpu->ib.tag = TLB_INVALID;
+		return;
+	case PR_IPL:
+		cpu->preg[preg] = val & 0x1F;
+		cpu->r[R_PSL]   = (cpu->r[R_PSL] & ~(0x1Fu << 16)) | ((val & 0x1F) << 16);
+		events_update(cpu);
+		return;
+	case PR_SIRR:
+		if (val & 0xF)
+			cpu->preg[PR_SISR] |= 1u << (val & 0xF);
+		events_update(cpu);
+		return;
+	case PR_SISR:
+		cpu->preg[preg] = val & 0xFFFE;
+		events_update(cpu);
+		return;
+	default:
+		cpu->preg[preg] = val;
+	}
+}
+
+
+/* 1: success
+   0: failure -- no memory at address, no I/O device at address, unaligned
+      I/O access, invalid page, no read/write access to page, ...
+
+   len: 1/2/4/8
+   datahi ignored unless len == 8
+   err only set on failure
+
+   The VAX defines something called "interlock granularity" which may be something
+   as big as a whole 512-byte page.  All interlocks within an interlock granularity
+   act as a single interlock.  There is only one CPU so interlocked accesses are
+   just normal accesses.
+
+   Both pages of a page crossing access are checked before any bytes are moved
+   so a fault on the second page doesn't leave the first one half-written.
+
+   This is the general case.  Most accesses go through access() below and
+   never get here.
+ */
+static int access_slow(struct cpu *cpu, int mode, uint32_t va, int len,
+                       uint32_t *data, uint32_t *datahi, int *err) __attribute__((noinline));
+static int access_slow(struct cpu *cpu, int mode, uint32_t va, int len,
+                       uint32_t *data, uint32_t *datahi, int *err)
+{
+	int		write = mode & MODE_WRITE;
+	uint8_t		 buf[8]  = {0};
+	uint8_t		*page[2] = {NULL, NULL};
+	uint32_t	 pa[2];
+	int		 cnt[2];
+
+	assert((len == 1) || (len == 2) || (len == 4) || (len == 8));
+
+	/* how many bytes on each page? */
+	cnt[0] = MEM_PAGE_SZE - (va & (MEM_PAGE_SZE-1));
+	if (cnt[0] > len)
+		cnt[0] = len;
+	cnt[1] = len - cnt[0];
+
+	/* xlat/access check, once or twice */
+	for (int i=0; i < 2; i++) {
+		uint32_t	 va2 = i ? va + cnt[0] : va;
+
+		if (cnt[i] == 0)
 			break;
 
-		/* dst */
-		case U_READPC:
-			/* Only works correctly if the operand decoder isn't
-			   allowed to run ahead, i.e., only if the decoder
-			   digests an operand, determines what microcode to
-			   run, and it then gets run before the decoder looks
-			   at more operands.
-			 */
-			cpu->r[u.dst] = cpu->r[15];
+		if (mode & MODE_LDU) {
+			pa[i]   = va2;
+			page[i] = mem_page(cpu->mem, va2 >> MEM_PAGE_BITS);
+			if (page[i] && !(mem_flags(cpu->mem, va2 >> MEM_PAGE_BITS) & (write ? MF_WRITE : MF_READ))) {
+				*err = MMF_NXM;
+				return 0;
+			}
+			if (page[i] && write && (mem_flags(cpu->mem, va2 >> MEM_PAGE_BITS) & MF_CODE))
+				dcache_drop_page(cpu, va2 >> MEM_PAGE_BITS);
+		} else {
+			struct tlb_entry	*e;
+
+			if (!tlb_xlat(cpu, &cpu->dtlb, va2, write, &e, err))
+				return 0;
+			pa[i]   = (e->pfn << MEM_PAGE_BITS) | (va2 & (MEM_PAGE_SZE-1));
+			page[i] = e->page;
+		}
+	}
+
+	if (write) {
+		for (int i=0; i < 4; i++)
+			buf[i]   = BYTE(*data,   i);
+		if (len == 8)
+			for (int i=0; i < 4; i++)
+				buf[i+4] = BYTE(*datahi, i);
+	}
+
+	/* mem or I/O calls, once or twice
+
+	   I/O needs naturally aligned accesses that don't cross pages.
+	 */
+	for (int i=0, ofs=0; i < 2; ofs += cnt[i], i++) {
+		if (cnt[i] == 0)
 			break;
 
-		/* src, src', dst -- len flags */
-		case U_MOV:
-			/* merge src and src' according to len */
-			switch (u.width) {
-			case UW_8:
-				cpu->r[u.dst] = (cpu->r[u.s1] & 0xFFFFFF00) | (cpu->r[u.s2] &    0xFF);
-				break;
-			case UW_16:
-				cpu->r[u.dst] = (cpu->r[u.s1] & 0xFFFFFF00) | (cpu->r[u.s2] & 0xFFFF);
-				break;
-			case UW_32:
-				cpu->r[u.dst] = cpu->r[u.s1];
-				break;
-			default:
-				assert(0);
+		if (page[i]) {
+			if (write && cpu->ra)
+				mem_write_shared(page[i] + (pa[i] & (MEM_PAGE_SZE-1)), buf + ofs, cnt[i]);
+			else if (write)
+				memcpy(page[i] + (pa[i] & (MEM_PAGE_SZE-1)), buf + ofs, cnt[i]);
+			else
+				memcpy(buf + ofs, page[i] + (pa[i] & (MEM_PAGE_SZE-1)), cnt[i]);
+		} else {
+			uint32_t	tmp = 0;
+
+			if ((cnt[i] != len) || (len > 4) || (pa[i] & (len-1))) {
+				*err = MMF_NXM;
+				return 0;
 			}
+			if (write)
+				tmp = *data;
+			if (!io(pa[i], mode & MODE_WRITE, len, &tmp, err))
+				return 0;
+			if (!write)
+				*data = tmp;
+			return 1;
+		}
+	}
+
+	if (!write) {
+		*data = L(buf[0]);
+		if (len == 8)
+			*datahi = L(buf[4]);
+	}
+	return 1;
+}
+
+
+/* same interface as access_slow()
+
+   Fast path: a b/w/l access that stays within one RAM page whose D-TLB entry
+   already grants the access.  That's a tag compare, a rights check, and a
+   single host load/store -- gcc turns the byte assembly into one mov.
+
+   Everything else (TLB miss, missing rights, page crossing, quads, I/O,
+   unmapped accesses) goes to access_slow().  So do all stores while the
+   run-ahead decoder runs, see mem_write_shared().
+ */
+static inline int access(struct cpu *cpu, int mode, uint32_t va, int len,
+                         uint32_t *data, uint32_t *datahi, int *err)
+{
+	uint32_t		 ofs = va & (MEM_PAGE_SZE-1);
+	struct tlb_entry	*e;
+
+	if ((mode & MODE_LDU) || (len > 4) || (ofs > MEM_PAGE_SZE - 4) ||
+	    ((mode & MODE_WRITE) && cpu->ra))
+		return access_slow(cpu, mode, va, len, data, datahi, err);
+
+	e = tlb_lookup(&cpu->dtlb, va);
+	if (!e || !e->page ||
+	    !(e->rights & ((mode & MODE_WRITE) ? TLB_W(CUR_MODE(cpu)) : TLB_R(CUR_MODE(cpu)))))
+		return access_slow(cpu, mode, va, len, data, datahi, err);
+
+	uint8_t	*p = e->page + ofs;
+
+	if (mode & MODE_WRITE) {
+		uint32_t	x = *data;
+
+		switch (len) {
+		case 1:	p[0] = x;
+			break;
+		case 2:	p[0] = BYTE(x, 0);  p[1] = BYTE(x, 1);
+			break;
+		case 4:	p[0] = BYTE(x, 0);  p[1] = BYTE(x, 1);
+			p[2] = BYTE(x, 2);  p[3] = BYTE(x, 3);
 			break;
+		}
+	} else {
+		switch (len) {
+		case 1:	*data = p[0];			break;
+		case 2:	*data = (uint16_t) W(p[0]);	break;
+		case 4:	*data = L(p[0]);		break;
+		}
+	}
+	return 1;
+}
+
+
+/* fetch block
+
+
+  bool fetch(uint32_t addr, unsigned bytecnt, uint8_t dst[bytecnt])
+
+  alternative:
+
+    fetch n bytes from addr into dstbuf
+    if that is impossible, fill remaining bytes with 0x00
+
+    return no of valid bytes?
+    return last valid addr?
+
+   in sim, we actually need to fetch() to go through address translation and
+   access checks.  Possibly more than one address translation and address check.
+   at some point, simulated bus cycles should be generated.
+ */
+
+/* point the fetch window at the page va is on -- 0 if the page can't be
+   fetched from, info in err.
+
+   let's ignore I/O space for now, except for ROMs.
+ */
+static int ifetch_page(struct cpu *cpu, uint32_t va, uint8_t **page, uint32_t *pfn, int *err)
+{
+	struct tlb_entry	*e;
+
+	if (!tlb_xlat(cpu, &cpu->itlb, va, 0, &e, err))
+		return 0;
+	if (!e->page) {
+		*err = MMF_NXM;
+		return 0;
+	}
+	*page = e->page;
+	*pfn  = e->pfn;
+	return 1;
+}
+
+
+/* instruction bytes at va
+
+   Returns a pointer to the bytes and how many of them are valid.  The pointer
+   is always good for IB_MAX bytes, the ones past *avail are 0x00.
+
+   *avail = 0 means the very first byte couldn't be fetched.  In that case, and
+   whenever the decoder wants more than *avail bytes, cpu->ib.err/err_va tell
+   why.
+ */
+static const uint8_t *ifetch(struct cpu *cpu, uint32_t va, int *avail)
+{
+	struct ifetch	*ib  = &cpu->ib;
+	uint32_t	 ofs = va & (MEM_PAGE_SZE-1);
+
+	if ((ib->tag != va >> MEM_PAGE_BITS) || (ib->mode != (int) CUR_MODE(cpu))) {
+		if (!ifetch_page(cpu, va, &ib->page, &ib->pfn, &ib->err)) {
+			ib->tag    = TLB_INVALID;
+			ib->err_va = va;
+			*avail     = 0;
+			return NULL;
+		}
+		ib->tag  = va >> MEM_PAGE_BITS;
+		ib->mode = CUR_MODE(cpu);
+	}
+
+	/* common case: the decoder can read directly from the page */
+	if (MEM_PAGE_SZE - ofs >= IB_MAX) {
+		*avail = MEM_PAGE_SZE - ofs;
+		return ib->page + ofs;
+	}
+
+	/* might straddle: rest of this page + as much of the next as possible */
+	int		 cnt = MEM_PAGE_SZE - ofs;
+	uint8_t		*next;
+	uint32_t	 next_pfn;
+
+	memcpy(ib->buf, ib->page + ofs, cnt);
+	if (ifetch_page(cpu, va + cnt, &next, &next_pfn, &ib->err)) {
+		memcpy(ib->buf + cnt, next, IB_MAX - cnt);
+		*avail = IB_MAX;
+	} else {
+		memset(ib->buf + cnt, 0x00, IB_MAX - cnt);
+		ib->err_va = va + cnt;
+		*avail = cnt;
+	}
+	return ib->buf;
+}
+
+
+/* how much contiguous memory? */
+static void mem_init(struct cpu *cpu, size_t sze)
+{
+	/* how many pages? */
+	if (sze & (MEM_PAGE_SZE-1)) {
+		fprintf(stderr, "mem_init(sze: %zu), not an integral number of pages.\n", sze);
+		exit(1);
+	}
+
+	size_t	 pagecnt = sze >> MEM_PAGE_BITS;
+	if (pagecnt > (size_t) MEM_DIR_CNT * MEM_LEAF_CNT) {
+		fprintf(stderr, "mem_init(sze: %zu), bigger than the physical address space.\n", sze);
+		exit(1);
+	}
+
+	/* zero-filled on first touch, no swap reserved up front */
+	void	*blob = mmap(NULL, sze, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (blob == MAP_FAILED) {
+		perror("mmap()");
+		fprintf(stderr, "mem_init(sze: %zu), can't map guest RAM.\n", sze);
+		exit(1);
+	}
+
+	cpu->mem->ram         = blob;
+	cpu->mem->ram_pagecnt = pagecnt;
+}
+
+
+/* load a ROM -- its pages are mapped read-only at physical address pa */
+#define ROM_BASE	0x20040000	/* KA655 */
+#define ROM_MAX		(256 * 1024)
+
+static void rom_load(struct cpu *cpu, uint32_t pa, const char *fname)
+{
+	FILE	*f;
+	uint8_t	*rom = calloc(1, ROM_MAX);
+	size_t	 sze;
+
+	assert(!(pa & (MEM_PAGE_SZE-1)));
+	if (!rom) {
+		fprintf(stderr, "rom_load(), out of memory.\n");
+		exit(1);
+	}
+
+	if ((f = fopen(fname, "rb")) == NULL) {
+		perror("fopen()");
+		fprintf(stderr, "can't open ROM file '%s'.\n", fname);
+		exit(1);
+	}
+	sze = fread(rom, 1, ROM_MAX, f);
+	if (ferror(f) || (sze == 0)) {
+		fprintf(stderr, "can't read ROM file '%s'.\n", fname);
+		exit(1);
+	}
+	fclose(f);
+
+	for (size_t off = 0; off < sze; off += MEM_PAGE_SZE)
+		mem_map(cpu->mem, (pa + off) >> MEM_PAGE_BITS, rom + off, MF_READ);
+}
+
+
+
+
+/***/
+
+#include "dis-uop.h"
+
+/* fragment groups + per opcode fragment group lists */
+#include "fragments.h"
+#include "vax-fraglists.h"
+
+
+/* instruction decode -- opcode => µop/index, expected operands
+
+   The decoder turns a VAX instruction into three µop flows: pre (operand
+   fetch/address calculation), exe, and post (write back).  They are built by
+   copying fragments from ucode[] and filling in the templated fields.
+
+   Template registers (see doc/implementation.txt):
+
+     <Rn> <Rx>  registers from the operand specifier.  <Rn> and <reg> count
+                upwards in the regread/regwrite fragments so the quad versions
+                get Rn, Rn+1.
+     <pre>      operand registers p1..p7.  Each operand gets one or two value
+                registers.  Modify operands in memory get an extra one for the
+                address so the post phase can still find it.  In the exe
+                phase, each <pre> reference (s1, s2, dst order) takes the next
+                value register.
+     <exe>      result registers e1..e3, handed out in order in the exe phase
+                and given back to the write operands in the post phase.
+
+   <imm> is handed out in 32-bit pieces, <width> is the operand width in
+   pre/post and the instruction width in exe, <cc> comes from the low 4 bits of
+   the opcode (Bcc).
+
+   readpc is turned into an imm µop with the PC value the µcode would see at
+   that point: right after the operand specifier in the pre phase, the address
+   of the next instruction otherwise.
+ */
+
+#define R_P1		16
+#define R_P_CNT		 7
+#define R_E1		23
+#define R_E_CNT		 3
+
+#define DI_MAXUOPS	128
+#define DI_MAXBR	  4
+
+/* pre/exe/post */
+#define PH_PRE		0
+#define PH_EXE		1
+#define PH_POST		2
+
+/* the parts of a decoded instruction that only depend on the opcode and the
+   operand classes
+ */
+struct dflow {
+	int		cnt[3];		/* µops in the pre/exe/post flows */
+
+	/* what it takes to expand the target of a µbranch in the exe phase */
+	int		vreg[2*R_P_CNT], vcnt;
+	int		ereg[R_E_CNT],   ecnt;
+	int		width;
+	int		cc;
+	bool		wpsl;		/* writes PSL -- see events_update() */
+
+	struct {
+		uint16_t	utarget;
+		uint8_t		vidx, eidx;	/* template counters at the bcc */
+	} br[DI_MAXBR];
+	int		brcnt;
+};
+
+struct dinstr {
+	uint32_t	pc;		/* address of the instruction */
+	int		len;		/* in bytes */
+	int		op;		/* 0..511 */
+
+	struct flow_tmpl *tmpl;		/* what uop[] was made from */
+	struct dflow	f;
+	struct uop	uop[DI_MAXUOPS];
+};
+
+
+/* flow templates
+
+   Everything about the expanded flows except the contents of the operand
+   specifiers depends only on the opcode and the class of each operand
+   (CLASS_IMM, CLASS_REG, the addressing mode label, or branch): which
+   fragments to stitch together, the p/e register allocation, <pre>, <exe>,
+   <cc>, <width>.  So the flows are stitched together once per (opcode,
+   classes) tuple and kept in a hash table.
+
+   There are far too many possible tuples to build them all up front -- most
+   of them never show up -- so a template is built the first time its tuple is
+   seen.  Tuples that can't be decoded (reserved addressing modes, too many
+   registers) are cached as well, with the exception to raise.
+
+   What's left for decode() are patch slots for the values that come from the
+   operand specifiers: <Rn>/<Rx>, the <imm> pieces, and the PC values that
+   replace readpc (the specifier lengths aren't part of the classes).
+ */
+#define PATCH_RN	0	/* register field := Rn + k */
+#define PATCH_RX	1	/* register field := Rx     */
+#define PATCH_IMM	2	/* imm := <imm> piece k     */
+#define PATCH_PC	3	/* imm := PC after the operand specifier (opnd -1: instruction) */
+
+#define PF_S1		0
+#define PF_S2		1
+#define PF_DST		2
+
+#define CL_BRANCH	-3	/* class of branch displacement operands */
+
+struct patch {
+	uint8_t		idx;		/* µop */
+	uint8_t		kind;
+	uint8_t		field;		/* PF_xxx for PATCH_RN/PATCH_RX */
+	int8_t		opnd;
+	uint8_t		k;
+};
+
+#define TMPL_BITS	10
+#define TMPL_CNT	(1 << TMPL_BITS)
+
+struct flow_tmpl {
+	struct flow_tmpl	*next;		/* hash chain */
+	int			 op;
+	int			 cl[6];
+
+	int			 exc;		/* 0 or exception µaddr */
+
+	struct dflow		 f;
+	int			 patchcnt;
+	struct patch		*patch;
+
+	uint16_t		*uaddr;		/* ucode[] index of each µop */
+	long			*heat;		/* --stats, see stats_tmpl() */
+	struct uop		 uop[];
+};
+
+static struct flow_tmpl	*tmpl_hash[TMPL_CNT];
+static long		 tmpl_cnt;
+
+
+/* template state while expanding a fragment */
+struct tmpl {
+	int		 phase;
+	int		 addr;		/* addr fragment? */
+	int		 opnd;		/* for the patch slots, -1 in exe */
+
+	int		 rk;
+	int		 areg;		/* operand address register */
+	int		 vreg, vk;	/* operand value register(s) */
+	int		 ereg, ek;	/* operand result register(s) */
+
+	int		 ik;
+	int		 width;
+	uint32_t	 pc;		/* readpc if there are no patch slots */
+
+	struct dflow	*f;		/* exe phase: vreg[]/ereg[]/cc */
+	int		 vidx, eidx;
+
+	struct patch	*patch;		/* NULL: no patch slots */
+	int		*patchcnt;
+	uint16_t	*uaddr;		/* NULL: µbranch target, not a template */
+};
+
+
+/* operand width in bytes => µop width */
+static int uw(int bytes)
+{
+	switch (bytes) {
+	case  1:	return UW_8;
+	case  2:	return UW_16;
+	case  4:	return UW_32;
+	case  8:	return UW_64;
+	case 16:	return UW_128;
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+/* record a patch slot -- readpc outside the pre phase wants the address of
+   the next instruction, Rn/Rx/imm outside an operand stay 0 (as before).
+ */
+static void add_patch(struct tmpl *t, int idx, int kind, int field, int k)
+{
+	int	opnd = (kind == PATCH_PC) && (t->phase != PH_PRE) ? -1 : t->opnd;
+
+	if (!t->patch || ((kind != PATCH_PC) && (opnd < 0)))
+		return;
+	t->patch[(*t->patchcnt)++] = (struct patch) {
+		.idx = idx, .kind = kind, .field = field, .opnd = opnd, .k = k};
+}
+
+
+/* fill in a templated register field -- -1 if we run out of registers */
+static int tmpl_reg(struct tmpl *t, int idx, int field, int reg)
+{
+	switch (reg) {
+	case R_RN:
+		add_patch(t, idx, PATCH_RN, field, t->addr ? 0 : t->rk++);
+		return 0;
+	case R_RX:
+		add_patch(t, idx, PATCH_RX, field, 0);
+		return 0;
+	case R_REG:
+		add_patch(t, idx, PATCH_RN, field, t->rk++);
+		return 0;
+	case R_PRE:
+		if (t->phase == PH_EXE)
+			return (t->vidx < t->f->vcnt) ? t->f->vreg[t->vidx++] : -1;
+		if ((t->phase == PH_POST) || t->addr || (field != PF_DST))
+			return t->areg;
+		return t->vreg + t->vk++;
+	case R_EXE:
+		if (t->phase == PH_EXE)
+			return (t->eidx < t->f->ecnt) ? t->f->ereg[t->eidx++] : -1;
+		return t->ereg + t->ek++;
+	default:
+		return reg;
+	}
+}
+
+
+/* expand the ucode[] flow at uaddr into flow[], first µop has index base
+
+   the number of µops or -1.
+ */
+static int expand(struct tmpl *t, int uaddr, int base, int max, struct uop flow[max])
+{
+	int	n = 0;
+
+	for (int i=uaddr; ; i++) {
+		struct uop	u = ucode[i];
+
+		if (n == max)
+			return -1;
+
+		/* s1, s2, dst order matters for the counters -- the fields
+		   are too narrow for -1, so check before storing
+		 */
+		int	s1 = 0, s2 = 0, dst = 0;
+
+		if (t->uaddr)
+			t->uaddr[base+n] = i;
+		if (uop[u.op].fields & (UF_S1 | UF_M1))
+			u.s1  = s1  = tmpl_reg(t, base+n, PF_S1,  u.s1);
+		if (uop[u.op].fields & (UF_S2 | UF_M2))
+			u.s2  = s2  = tmpl_reg(t, base+n, PF_S2,  u.s2);
+		if (uop[u.op].fields & UF_DST)
+			u.dst = dst = tmpl_reg(t, base+n, PF_DST, u.dst);
+		if ((s1 < 0) || (s2 < 0) || (dst < 0))
+			return -1;
+
+		if (u.width == UW_TEMPL)
+			u.width = t->width;
+
+		switch (u.op) {
+		case U_IMM:
+			if (u.imm == U_IMM_IMM) {
+				add_patch(t, base+n, PATCH_IMM, 0, t->ik++);
+				u.imm = 0;
+			}
+			break;
+		case U_READPC:
+			u.op  = U_IMM;
+			u.imm = t->pc;
+			if (t->patch)
+				add_patch(t, base+n, PATCH_PC, 0, 0);
+			break;
+		case U_BCC:
+			if (u.cc == U_CC_CC)
+				u.cc = t->f->cc;
+			/* only while building the template, not when expanding
+			   a µbranch target later on
+			 */
+			if ((t->phase == PH_EXE) && t->patch && !(u.utarget & U_EXC_MASK) &&
+			    (t->f->brcnt < DI_MAXBR)) {
+				t->f->br[t->f->brcnt].utarget = u.utarget;
+				t->f->br[t->f->brcnt].vidx    = t->vidx;
+				t->f->br[t->f->brcnt].eidx    = t->eidx;
+				t->f->brcnt++;
+			}
+			break;
+		default:
+			break;
+		}
+
+		flow[n++] = u;
+		if (u.last)
+			return n;
+	}
+}
+
+
+/* stitch together the flows for an (opcode, operand classes) tuple
+
+   0 or the exception µaddr the tuple should raise.
+ */
+static int tmpl_stitch(int op, const int cl[6], struct dflow *f, struct uop flow[DI_MAXUOPS],
+                       uint16_t uaddr[DI_MAXUOPS], struct patch patch[3*DI_MAXUOPS], int *patchcnt)
+{
+	struct {
+		const struct fragment_desc	*grp;
+		int				 areg, vreg, ereg;
+	} opnd[6];
+
+	memset(f, 0, sizeof(*f));
+	f->width  = op_cnt[op] ? uw(op_width[op][0]) : UW_32;
+	f->cc     = op & 0xF;
+	*patchcnt = 0;
+
+	/* register allocation */
+	int	pcnt = 0;
+
+	for (unsigned i=0; i < op_cnt[op]; i++) {
+		const struct fragment_desc	*grp = &fragment_group[frag_list[op][i]];
+
+		int	isbranch  = grp->isbranch;
+		int	isaddr    = !isbranch && (grp->frags[FRAG_PRE][1] == FRAG_ERR);
+		int	iswrite   = !isbranch && (grp->frags[FRAG_POST][1] != FRAG_NONE);
+		int	isread    = isbranch || isaddr || (grp->frags[FRAG_PRE][1] != FRAG_NONE);
+		int	ismem     = !isbranch && (cl[i] != CLASS_IMM) && (cl[i] != CLASS_REG);
+		int	nval      = (isbranch || isaddr || (op_width[op][i] <= 4)) ? 1 : op_width[op][i] / 4;
+
+		opnd[i].grp  = grp;
+		opnd[i].vreg = R_P1 + pcnt;
+		opnd[i].areg = R_P1 + pcnt;
+		if (isread)
+			pcnt += nval;
+		if (iswrite && ismem && isread)
+			opnd[i].areg = R_P1 + pcnt++;
+		else if (!isread && ismem)
+			pcnt++;
+
+		if (isread)
+			for (int j=0; j < nval; j++)
+				f->vreg[f->vcnt++] = opnd[i].vreg + j;
+
+		opnd[i].ereg = R_E1 + f->ecnt;
+		if (iswrite) {
+			if (f->ecnt + nval > R_E_CNT)
+				return LBL_EXC_RESERVED | U_EXC_MASK;
+			for (int j=0; j < nval; j++)
+				f->ereg[f->ecnt++] = opnd[i].ereg + j;
+		}
+	}
+	if (pcnt > R_P_CNT)
+		return LBL_EXC_RESERVED | U_EXC_MASK;
+
+	int	n = 0;
+
+#define EXPAND(t, uaddr)							\
+	do {									\
+		int	cnt = expand(t, uaddr, n, DI_MAXUOPS - n, flow + n);	\
+		if (cnt < 0)							\
+			return LBL_EXC_RESERVED | U_EXC_MASK;			\
+		n += cnt;							\
+	} while (0)
+
+	/* PRE phase */
+	for (unsigned i=0; i < op_cnt[op]; i++) {
+		const struct fragment_desc	*grp = opnd[i].grp;
+		struct tmpl			 t   = {
+			.phase    = PH_PRE,
+			.opnd     = i,
+			.areg     = opnd[i].areg,
+			.vreg     = opnd[i].vreg,
+			.width    = uw(op_width[op][i]),
+			.f        = f,
+			.patch    = patch,
+			.patchcnt = patchcnt,
+			.uaddr    = uaddr,
+		};
+
+		if (grp->isbranch) {
+			EXPAND(&t, LBL_BRANCH);
+			continue;
+		}
+
+		int	frag;
+
+		switch (cl[i]) {
+		case CLASS_IMM:	frag = grp->frags[FRAG_PRE][0];	break;
+		case CLASS_REG:	frag = grp->frags[FRAG_PRE][1];	break;
+		default:	frag = grp->frags[FRAG_PRE][2];	break;
+		}
+
+		switch (frag) {
+		case FRAG_NONE:
+			break;
+		case FRAG_ERR:
+			return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+		case FRAG_ADDR:
+			{
+			struct tmpl	ta = t;
+
+			ta.addr = 1;
+			EXPAND(&ta, cl[i]);
+			}
+			break;
+		default:
+			EXPAND(&t, frag);
+		}
+
+		if ((cl[i] != CLASS_IMM) && (cl[i] != CLASS_REG) &&
+		    (grp->frags[FRAG_PRE][3] != FRAG_NONE))
+			EXPAND(&t, grp->frags[FRAG_PRE][3]);
+	}
+	f->cnt[PH_PRE] = n;
+
+	/* EXE phase */
+	struct tmpl	te = {
+		.phase    = PH_EXE,
+		.opnd     = -1,
+		.width    = f->width,
+		.f        = f,
+		.patch    = patch,
+		.patchcnt = patchcnt,
+		.uaddr    = uaddr,
+	};
+
+	EXPAND(&te, ustart[op]);
+	f->cnt[PH_EXE] = n - f->cnt[PH_PRE];
+
+	/* POST phase */
+	for (unsigned i=0; i < op_cnt[op]; i++) {
+		const struct fragment_desc	*grp = opnd[i].grp;
+
+		if (grp->isbranch)
+			continue;
+
+		int	frag;
+
+		switch (cl[i]) {
+		case CLASS_IMM:	frag = grp->frags[FRAG_POST][0];	break;
+		case CLASS_REG:	frag = grp->frags[FRAG_POST][1];	break;
+		default:	frag = grp->frags[FRAG_POST][2];	break;
+		}
+
+		if (frag == FRAG_NONE)
+			continue;
+		if (frag < 0)
+			return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+
+		struct tmpl	t = {
+			.phase    = PH_POST,
+			.opnd     = i,
+			.areg     = opnd[i].areg,
+			.ereg     = opnd[i].ereg,
+			.width    = uw(op_width[op][i]),
+			.f        = f,
+			.patch    = patch,
+			.patchcnt = patchcnt,
+			.uaddr    = uaddr,
+		};
+		EXPAND(&t, frag);
+	}
+	f->cnt[PH_POST] = n - f->cnt[PH_PRE] - f->cnt[PH_EXE];
+#undef EXPAND
+
+	for (int i=0; i < n; i++)
+		if (flow[i].dst == R_PSL)
+			f->wpsl = true;
+
+	return 0;
+}
+
+
+/* template for an (opcode, operand classes) tuple -- built on first use */
+static struct flow_tmpl *tmpl_get(int op, const int cl[6])
+{
+	unsigned	h = op;
+
+	for (unsigned i=0; i < op_cnt[op]; i++)
+		h = h * 31 + (cl[i] & 0xFF);
+	h %= TMPL_CNT;
+
+	for (struct flow_tmpl *t = tmpl_hash[h]; t; t = t->next)
+		if ((t->op == op) && (memcmp(t->cl, cl, sizeof(t->cl)) == 0))
+			return t;
+
+	/* stitch it together */
+	static struct uop	flow[DI_MAXUOPS];
+	static uint16_t		uaddr[DI_MAXUOPS];
+	static struct patch	patch[3*DI_MAXUOPS];
+	struct dflow		f;
+	int			patchcnt;
+	int			exc = tmpl_stitch(op, cl, &f, flow, uaddr, patch, &patchcnt);
+	int			cnt = exc ? 0 : f.cnt[PH_PRE] + f.cnt[PH_EXE] + f.cnt[PH_POST];
+
+	struct flow_tmpl	*t = malloc(sizeof(struct flow_tmpl) + cnt * sizeof(struct uop));
+	struct patch		*p = malloc((patchcnt + 1) * sizeof(struct patch));
+	uint16_t		*u = malloc((cnt + 1) * sizeof(uint16_t));
+	long			*heat = calloc(cnt + 1, sizeof(long));
+	if (!t || !p || !u || !heat) {
+		fprintf(stderr, "tmpl_get(op: %03X), out of memory.\n", op);
+		exit(1);
+	}
+
+	t->op       = op;
+	memcpy(t->cl, cl, sizeof(t->cl));
+	t->exc      = exc;
+	t->f        = f;
+	t->patchcnt = exc ? 0 : patchcnt;
+	t->patch    = p;
+	t->uaddr    = u;
+	t->heat     = heat;
+	memcpy(t->uop, flow, cnt * sizeof(struct uop));
+	memcpy(t->uaddr, uaddr, cnt * sizeof(uint16_t));
+	memcpy(t->patch, patch, t->patchcnt * sizeof(struct patch));
+
+	t->next      = tmpl_hash[h];
+	tmpl_hash[h] = t;
+	tmpl_cnt++;
+	return t;
+}
+
+
+/* the decoder wants bytes the fetch unit couldn't give it */
+static int fetch_fault(struct cpu *cpu)
+{
+	cpu->mm_va  = cpu->ib.err_va;
+	cpu->mm_err = cpu->ib.err;
+	return LBL_EXC_ACCESS | U_EXC_MASK;
+}
+
+
+/* decode the instruction at pc, avail bytes in b[]
+
+   Decodes the opcode and the operand specifiers, gets the template for the
+   (opcode, operand classes) tuple, and fills in its patch slots.
+
+   0 or the µaddr of an exception (with U_EXC_MASK set).
+ */
+static int decode(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail, struct dinstr *di)
+{
+	int	idx = 0;
+	int	op;
+
+#define NEED(n)		do { if (idx + (n) > avail) return fetch_fault(cpu); } while (0)
+
+	/* decode opcode */
+	NEED(1);
+	switch (b[0]) {
+	case 0xFD:	/* normal two-byte instruction */
+		NEED(2);
+		op  = b[1] + 0x100;
+		idx = 2;
+		break;
+	case 0xFC:	/* XFC nn */
+	case 0xFE:
+	case 0xFF:	/* reserved two-byte instruction */
+		return LBL_EXC_RESERVED | U_EXC_MASK;
+	default:
+		op  = b[0];
+		idx = 1;
+	}
+
+	if (ustart[op] == LBL_EXC_RESERVED)
+		return LBL_EXC_RESERVED | U_EXC_MASK;
+
+	/* decode operands */
+	int	cl[6] = {0};
+	struct {
+		int		Rn, Rx;
+		uint32_t	imm[4];
+		uint32_t	pc;	/* after the specifier */
+	} opnd[6];
+
+	for (unsigned i=0; i < op_cnt[op]; i++) {
+		if (fragment_group[frag_list[op][i]].isbranch) {
+			/* the decoder sign extends the displacement */
+			cl[i] = CL_BRANCH;
+			if (ops[op][i*3+1] == 'b') {
+				NEED(1);
+				opnd[i].imm[0] = B(b[idx]);
+				idx += 1;
+			} else {
+				NEED(2);
+				opnd[i].imm[0] = W(b[idx]);
+				idx += 2;
+			}
+		} else {
+			/* op_sim() and op_val() may look at up to MAX_OPLEN bytes,
+			   ifetch() guarantees that they are there.
+			 */
+			uint8_t		*spec = (uint8_t *) b + idx;
+			struct fields	 fields;
+			struct sim_ret	 sim_ret;
+
+			memset(&fields, 0xFF, sizeof(fields));
+			sim_ret = op_sim(spec, &fields, op_width[op][i], op_ifp[op][i]);
+			if (sim_ret.cnt <= 0)
+				return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+			NEED(sim_ret.cnt);
+			if (!op_val(spec, op_width[op][i]))
+				return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+
+			cl[i]         = sim_ret.cl;
+			opnd[i].Rn    = fields.Rn;
+			opnd[i].Rx    = fields.Rx;
+			if ((cl[i] == LBL_ADDR__ADDR_) || (cl[i] == LBL_ADDR__ADDR_____XINDEX_RX__))
+				opnd[i].imm[0] = fields.addr;
+			else if (cl[i] == CLASS_IMM)
+				memcpy(opnd[i].imm, fields.imm.val, sizeof(opnd[i].imm));
+			else
+				opnd[i].imm[0] = fields.disp;
+			idx += sim_ret.cnt;
+		}
+		opnd[i].pc = pc + idx;
+	}
+#undef NEED
+
+	struct flow_tmpl	*t = tmpl_get(op, cl);
+
+	if (t->exc)
+		return t->exc;
+
+	di->pc   = pc;
+	di->len  = idx;
+	di->op   = op;
+	di->tmpl = t;
+	di->f    = t->f;
+	memcpy(di->uop, t->uop, (t->f.cnt[PH_PRE] + t->f.cnt[PH_EXE] + t->f.cnt[PH_POST]) * sizeof(struct uop));
+
+	/* fill in the patch slots */
+	for (int i=0; i < t->patchcnt; i++) {
+		struct patch	 p = t->patch[i];
+		struct uop	*u = &di->uop[p.idx];
+		int		 val;
+
+		switch (p.kind) {
+		case PATCH_RN:
+		case PATCH_RX:
+			val = (p.kind == PATCH_RN) ? opnd[p.opnd].Rn + p.k : opnd[p.opnd].Rx;
+			switch (p.field) {
+			case PF_S1:	u->s1  = val;	break;
+			case PF_S2:	u->s2  = val;	break;
+			case PF_DST:	u->dst = val;	break;
+			}
+			break;
+		case PATCH_IMM:
+			u->imm = opnd[p.opnd].imm[p.k % 4];
+			break;
+		case PATCH_PC:
+			u->imm = (p.opnd < 0) ? pc + idx : opnd[p.opnd].pc;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+/* expand the target of a taken µbranch in the exe phase of an instruction
+
+   f is the instruction's dflow, npc the address of the next instruction.
+ */
+static int decode_branch(const struct dflow *f, uint32_t npc, int utarget, int max, struct uop flow[max])
+{
+	struct tmpl	t = {
+		.phase = PH_EXE,
+		.opnd  = -1,
+		.width = f->width,
+		.pc    = npc,
+		.f     = (struct dflow *) f,
+	};
+
+	for (int i=0; i < f->brcnt; i++)
+		if (f->br[i].utarget == utarget) {
+			t.vidx = f->br[i].vidx;
+			t.eidx = f->br[i].eidx;
+			break;
+		}
+
+	return expand(&t, utarget, 0, max, flow);
+}
+
+
+
+
+/* decode cache
+
+   Decoded instructions, indexed by the physical address of the instruction.
+   The virtual address has to match as well because the flows have PC values
+   baked into them.
+
+   Instructions that straddle a page boundary are not cached.
+
+   Pages with cached instructions are marked with MF_CODE.  A store to such a
+   page drops all cached instructions from it (see tlb_xlat()), so
+   self-modifying code and program loading just work.
+ */
+#define DC_BITS		10
+#define DC_CNT		(1 << DC_BITS)
+#define DC_INVALID	0xFFFFFFFF
+
+struct dcache {
+	struct {
+		uint32_t	pa;	/* DC_INVALID if empty */
+		struct dinstr	di;
+	} e[DC_CNT];
+
+	long	hits, misses;
+};
+
+
+static void dcache_init(struct cpu *cpu)
+{
+	cpu->dcache = calloc(1, sizeof(struct dcache));
+	if (!cpu->dcache) {
+		fprintf(stderr, "dcache_init(), out of memory.\n");
+		exit(1);
+	}
+
+	for (int i=0; i < DC_CNT; i++)
+		cpu->dcache->e[i].pa = DC_INVALID;
+}
+
+
+/* the page has cached instructions now -- writes to it must go the slow way */
+static void dcache_mark_page(struct cpu *cpu, uint32_t pfn)
+{
+	if (mem_flags(cpu->mem, pfn) & MF_CODE)
+		return;
+
+	mem_set_flags(cpu->mem, pfn, MF_CODE, 0);
+	for (int i=0; i < TLB_SETS; i++)
+		for (int j=0; j < TLB_WAYS; j++)
+			if ((cpu->dtlb.set[i][j].tag != TLB_INVALID) &&
+			    (cpu->dtlb.set[i][j].pfn == pfn))
+				cpu->dtlb.set[i][j].rights &= 0x0F;
+}
+
+
+static void tcache_drop_page(struct cpu *cpu, uint32_t pfn);
+
+
+/* something is about to write to the page -- forget its instructions */
+static void dcache_drop_page(struct cpu *cpu, uint32_t pfn)
+{
+	for (int i=0; i < DC_CNT; i++)
+		if ((cpu->dcache->e[i].pa != DC_INVALID) &&
+		    ((cpu->dcache->e[i].pa >> MEM_PAGE_BITS) == pfn))
+			cpu->dcache->e[i].pa = DC_INVALID;
+	tcache_drop_page(cpu, pfn);
+
+	mem_set_flags(cpu->mem, pfn, 0, MF_CODE);
+}
+
+
+/* decode the instruction at pc (bytes from ifetch()), from the cache if possible
+
+   Only instructions that really straddle a page are decoded every time.  The
+   ones near the end of the page also come from ib.buf but all their bytes
+   are on this page, so they are cached like any other.
+
+   0 or the µaddr of an exception.
+ */
+static int decode_cached(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail,
+                         struct dinstr **di)
+{
+	static struct dinstr	 straddle;
+	struct dcache		*dc  = cpu->dcache;
+	uint32_t		 ofs = pc & (MEM_PAGE_SZE-1);
+
+	if ((b == cpu->ib.buf) && (instr_len(b, MEM_PAGE_SZE - ofs) <= 0)) {
+		*di = &straddle;
+		return decode(cpu, pc, b, avail, &straddle);
+	}
+
+	uint32_t	 pa = (cpu->ib.pfn << MEM_PAGE_BITS) | ofs;
+	int		 i  = pa % DC_CNT;
+
+	*di = &dc->e[i].di;
+	if ((dc->e[i].pa == pa) && (dc->e[i].di.pc == pc)) {
+		dc->hits++;
+		return 0;
+	}
+
+	dc->misses++;
+
+	int	exc = decode(cpu, pc, b, avail, &dc->e[i].di);
+	if (exc) {
+		dc->e[i].pa = DC_INVALID;
+		return exc;
+	}
+
+	dc->e[i].pa = pa;
+	dcache_mark_page(cpu, cpu->ib.pfn);
+	return 0;
+}
+
+
+
+
+/* trace cache
+
+   A trace is the pre/exe/post flows of consecutive instructions joined into
+   one linear block of µops, up to and including the next control transfer.
+   datapath() runs it in one go; a taken µbranch or an exception is a side
+   exit that finishes (or faults) the instruction it happened in the slow way.
+
+   The flows have all their readpc values baked in as immediates and the
+   µcode never looks at r15 otherwise, so r15 only has to be right when the
+   trace is left: it is set to the end of the trace up front and fixed up on
+   side exits.
+
+   Traces are indexed by physical address like the decode cache and never
+   leave the code page they start on, so dropping the decoded instructions of
+   a page drops its traces too.  A store into the trace that is running only
+   affects the instructions after it once the trace is left again -- the VAX
+   only promises anything after an REI anyway.
+ */
+#define TC_BITS		8
+#define TC_CNT		(1 << TC_BITS)
+
+#define TR_MAXUOPS	512
+#define TR_MAXINSTR	32
+
+struct trace {
+	uint32_t	pa;		/* DC_INVALID if empty */
+	uint32_t	pc;
+	uint32_t	end;		/* address after the last instruction */
+
+	int		cnt;		/* µops */
+	int		icnt;		/* instructions */
+
+	struct {
+		uint32_t	pc;
+		int		len;
+		int		pre, exe, post, end;	/* µop indices */
+		struct dflow	f;			/* for µbranches */
+		struct flow_tmpl *tmpl;			/* --stats */
+	} instr[TR_MAXINSTR];
+
+	struct uop	uop[TR_MAXUOPS];
+	const void	*h[TR_MAXUOPS+1];	/* see datapath_resolve() */
+
+	long		execs;
+	int		(*jit)(struct cpu *cpu);	/* compiled code or NULL */
+};
+
+struct tcache {
+	struct trace	e[TC_CNT];
+
+	long	hits, misses;
+	long	instrs;		/* instructions run from traces */
+};
+
+
+static void datapath_resolve(int uop_cnt, const struct uop uop[uop_cnt], const void *h[uop_cnt+1]);
+
+
+static void tcache_init(struct cpu *cpu)
+{
+	cpu->tcache = calloc(1, sizeof(struct tcache));
+	if (!cpu->tcache) {
+		fprintf(stderr, "tcache_init(), out of memory.\n");
+		exit(1);
+	}
+
+	for (int i=0; i < TC_CNT; i++)
+		cpu->tcache->e[i].pa = DC_INVALID;
+}
+
+
+static void tcache_drop_page(struct cpu *cpu, uint32_t pfn)
+{
+	for (int i=0; i < TC_CNT; i++)
+		if ((cpu->tcache->e[i].pa != DC_INVALID) &&
+		    ((cpu->tcache->e[i].pa >> MEM_PAGE_BITS) == pfn))
+			cpu->tcache->e[i].pa = DC_INVALID;
+}
+
+
+/* control transfer, or something that may change the translation or stop
+   the CPU -- the trace ends with this instruction
+ */
+static int trace_ends(const struct dinstr *di)
+{
+	int	cnt = di->f.cnt[PH_PRE] + di->f.cnt[PH_EXE] + di->f.cnt[PH_POST];
+
+	for (int i=0; i < cnt; i++)
+		switch (di->uop[i].op) {
+		case U_JMP:
+		case U_STOP:
+		case U_MTPR:
+			return 1;
+		case U_BCC:
+			if (!(di->uop[i].utarget & U_EXC_MASK))
+				return 1;
+			break;
+		default:
+			break;
+		}
+	return 0;
+}
+
+
+/* join the instructions from pc onwards -- 0 if not even the first one can
+   go into a trace (fetch fault, decode exception, straddles a page)
+ */
+static int trace_build(struct cpu *cpu, uint32_t pc, struct trace *tr)
+{
+	uint32_t	pfn = cpu->ib.pfn;
+
+	tr->pc    = pc;
+	tr->cnt   = 0;
+	tr->icnt  = 0;
+	tr->execs = 0;
+	tr->jit   = NULL;
+
+	while (tr->icnt < TR_MAXINSTR) {
+		const uint8_t	*b;
+		struct dinstr	*di;
+		int		 avail;
+
+		if ((pc >> MEM_PAGE_BITS) != (tr->pc >> MEM_PAGE_BITS))
+			break;
+
+		b = ifetch(cpu, pc, &avail);
+		if (!avail || (cpu->ib.pfn != pfn))
+			break;
+
+		/* an instruction that straddles the page can't go in, no need
+		   to decode it to find out
+		 */
+		int	len = instr_len(b, avail);
+
+		if ((len <= 0) || ((pc & (MEM_PAGE_SZE-1)) + len > MEM_PAGE_SZE))
+			break;
+		if (decode_cached(cpu, pc, b, avail, &di))
+			break;
+
+		/* PSL writers run on their own, for events_update() */
+		if (di->f.wpsl)
+			break;
+
+		int	cnt = di->f.cnt[PH_PRE] + di->f.cnt[PH_EXE] + di->f.cnt[PH_POST];
+
+		if (tr->cnt + cnt > TR_MAXUOPS)
+			break;
+
+		tr->instr[tr->icnt].pc   = pc;
+		tr->instr[tr->icnt].len  = di->len;
+		tr->instr[tr->icnt].pre  = tr->cnt;
+		tr->instr[tr->icnt].exe  = tr->cnt + di->f.cnt[PH_PRE];
+		tr->instr[tr->icnt].post = tr->cnt + di->f.cnt[PH_PRE] + di->f.cnt[PH_EXE];
+		tr->instr[tr->icnt].end  = tr->cnt + cnt;
+		tr->instr[tr->icnt].f    = di->f;
+		tr->instr[tr->icnt].tmpl = di->tmpl;
+		tr->icnt++;
+
+		memcpy(tr->uop + tr->cnt, di->uop, cnt * sizeof(struct uop));
+		tr->cnt += cnt;
+
+		pc += di->len;
+		if (trace_ends(di))
+			break;
+	}
+	tr->end = pc;
+	datapath_resolve(tr->cnt, tr->uop, tr->h);
+
+	/* every instruction in it went through the decode cache, so the page
+	   is marked already
+	 */
+	return tr->icnt;
+}
+
+
+/* the trace starting at pc (ifetch() has just been called for it) -- NULL
+   if the instruction has to be run on its own
+ */
+static struct trace *trace_get(struct cpu *cpu, uint32_t pc)
+{
+	struct tcache	*tc = cpu->tcache;
+	uint32_t	 pa = (cpu->ib.pfn << MEM_PAGE_BITS) | (pc & (MEM_PAGE_SZE-1));
+	struct trace	*tr = &tc->e[pa % TC_CNT];
+
+	if ((tr->pa == pa) && (tr->pc == pc)) {
+		tc->hits++;
+		return tr;
+	}
+
+	tc->misses++;
+	if (!trace_build(cpu, pc, tr)) {
+		tr->pa = DC_INVALID;
+		return NULL;
+	}
+
+	/* building it moved the fetch window */
+	int	avail;
+
+	ifetch(cpu, pc, &avail);
+	tr->pa = pa;
+	return tr;
+}
+
+
+/* run-ahead decoder (--run-ahead)
+
+   A second host thread walks the predicted instruction stream and decodes
+   it into a single-producer/single-consumer ring of dinstrs; cpu_run() takes
+   them from the ring instead of decoding (and doesn't use traces).  On a
+   multicore host the decoding overlaps with the datapath.
+
+   The decoder thread has its own copy of the parts of struct cpu that
+   ifetch() and decode() use: the I-TLB, the fetch window, PSL and the
+   processor registers for xlat().  It shares the guest memory and the
+   physical page directory, mem_leaf() publishes new leaves atomically.  The
+   page flags don't change while it runs: only decode_cached() marks code
+   pages and the executor doesn't use it in this mode.
+
+   Guest memory itself is shared with mem_read_shared()/mem_write_shared():
+   the decoder copies the instruction bytes out with ra_fetch() and decodes
+   the copy, page table reads go through phys_ld32(), and the executor's
+   stores all take access_slow() while the decoder runs.
+
+   Prediction: BRB/BRW/BSBB/BSBW are followed, conditional branches are
+   taken if they go backwards.  Anything else that would end a trace (jumps
+   with computed targets, HALT, MTPR) is put in the ring and then the
+   decoder parks.  So does an instruction it can't decode -- fetch faults and
+   reserved instructions/modes are left to the executor.
+
+   Every entry is checked when it is taken out: same pc, and the bytes the
+   executor fetches itself are the ones it was decoded from.  decode() only
+   depends on the pc and the bytes, so an entry that passes is exactly what
+   decode() would have made -- no matter what the decoder saw of stores to
+   code pages, stale TLB entries, or changes to the page tables.  The check
+   is what makes it harmless that the decoder's bytes may be old.
+
+   A mismatch is a redirect: the executor posts a request (pc, PSL, preg[])
+   under the mutex and bumps the epoch.  The decoder picks it up between two
+   instructions and starts over; entries from older epochs are skipped by
+   the executor.  The ring itself is lock-free, the mutex is only taken for
+   redirects.
+
+   The template cache behind decode() isn't thread safe.  Only one side
+   decodes at a time: the executor only decodes on its own when the decoder
+   is parked, and the decoder only wakes up when the epoch changes, which
+   only the executor does.
+ */
+#define RA_RING		64			/* entries, power of 2 */
+
+struct ra_slot {
+	unsigned	epoch;
+	uint8_t		bytes[IB_MAX];		/* what di was decoded from */
+	struct dinstr	di;
+};
+
+struct runahead {
+	struct ra_slot	ring[RA_RING];
+	unsigned	head;			/* written by the decoder  */
+	unsigned	tail;			/* written by the executor */
+
+	/* redirect requests -- executor -> decoder */
+	pthread_mutex_t	lock;
+	unsigned	epoch;			/* bumped for each request */
+	struct {
+		unsigned	epoch;
+		uint32_t	pc;
+		uint32_t	psl;
+		uint32_t	preg[64];
+		bool		park;		/* executor wants to decode pc itself */
+	} req;
+	bool		quit;
+
+	/* decoder -> executor */
+	unsigned	parked;			/* epoch the decoder is parked in */
+	uint32_t	park_pc;		/* where it stopped */
+
+	/* executor only */
+	unsigned	cur;			/* epoch of the entries we want */
+	bool		used;			/* ring[tail] is the running instruction */
+	struct dinstr	own;			/* decoded by the executor */
+	long		hits, stale, redirects, owncnt;
+
+	struct cpu	fe;			/* the decoder's view of the CPU */
+	pthread_t	thread;
+};
+
+
+/* ifetch() for the decoder thread -- the bytes are a copy, made with
+   mem_read_shared(), and decode() only ever sees the copy
+ */
+static const uint8_t *ra_fetch(struct cpu *fe, uint32_t va, int *avail)
+{
+	struct ifetch	*ib  = &fe->ib;
+	uint32_t	 ofs = va & (MEM_PAGE_SZE-1);
+	int		 cnt = MEM_PAGE_SZE - ofs;
+
+	if ((ib->tag != va >> MEM_PAGE_BITS) || (ib->mode != (int) CUR_MODE(fe))) {
+		if (!ifetch_page(fe, va, &ib->page, &ib->pfn, &ib->err)) {
+			ib->tag = TLB_INVALID;
+			*avail  = 0;
+			return NULL;
+		}
+		ib->tag  = va >> MEM_PAGE_BITS;
+		ib->mode = CUR_MODE(fe);
+	}
+
+	if (cnt >= IB_MAX) {
+		mem_read_shared(ib->buf, ib->page + ofs, IB_MAX);
+		*avail = IB_MAX;
+		return ib->buf;
+	}
+
+	/* might straddle, see ifetch() */
+	uint8_t		*next;
+	uint32_t	 next_pfn;
+
+	mem_read_shared(ib->buf, ib->page + ofs, cnt);
+	if (ifetch_page(fe, va + cnt, &next, &next_pfn, &ib->err)) {
+		mem_read_shared(ib->buf + cnt, next, IB_MAX - cnt);
+		*avail = IB_MAX;
+	} else {
+		memset(ib->buf + cnt, 0x00, IB_MAX - cnt);
+		*avail = cnt;
+	}
+	return ib->buf;
+}
+
+
+/* is it a BRB/BRW/BSBB/BSBW? */
+static bool ra_uncond(int op)
+{
+	return (op == 0x10) || (op == 0x11) || (op == 0x30) || (op == 0x31);
+}
+
+
+/* the decoder thread */
+static void *ra_thread(void *arg)
+{
+	struct runahead	*ra    = arg;
+	struct cpu	*fe    = &ra->fe;
+	unsigned	 epoch = 0;
+	uint32_t	 pc    = 0;
+	bool		 parked = true;
+	bool		 stale  = false;	/* decoded an MTPR since the I-TLB flush */
+
+	while (!__atomic_load_n(&ra->quit, __ATOMIC_ACQUIRE)) {
+		if (__atomic_load_n(&ra->epoch, __ATOMIC_ACQUIRE) != epoch) {
+			pthread_mutex_lock(&ra->lock);
+			epoch = ra->req.epoch;
+			pc    = ra->req.pc;
+			fe->r[R_PSL] = ra->req.psl;
+			if (stale || memcmp(fe->preg, ra->req.preg, sizeof(fe->preg))) {
+				memcpy(fe->preg, ra->req.preg, sizeof(fe->preg));
+				tlb_flush(&fe->itlb);
+				stale = false;
+			}
+			parked = ra->req.park;
+			pthread_mutex_unlock(&ra->lock);
+
+			fe->ib.tag = TLB_INVALID;
+			if (parked) {
+				ra->park_pc = pc;
+				__atomic_store_n(&ra->parked, epoch, __ATOMIC_RELEASE);
+			}
+		}
+
+		unsigned	 head = ra->head;
+
+		if (parked || (head - __atomic_load_n(&ra->tail, __ATOMIC_ACQUIRE) == RA_RING)) {
+			sched_yield();
+			continue;
+		}
+
+		struct ra_slot	*s = &ra->ring[head % RA_RING];
+		const uint8_t	*b;
+		int		 avail;
+
+		b = ra_fetch(fe, pc, &avail);
+		if (!avail || decode(fe, pc, b, avail, &s->di)) {
+			/* the executor will have to do this one */
+			parked      = true;
+			ra->park_pc = pc;
+			__atomic_store_n(&ra->parked, epoch, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		int		 op  = s->di.op;
+		int		 len = s->di.len;
+		uint32_t	 npc = pc + len;
+
+		s->epoch = epoch;
+		memcpy(s->bytes, b, len);
+		__atomic_store_n(&ra->head, head + 1, __ATOMIC_RELEASE);
+
+		/* where next? */
+		if (op_cnt[op] && (ops[op][(op_cnt[op]-1)*3] == 'b')) {
+			int		width  = op_width[op][op_cnt[op]-1];
+			uint32_t	target = npc + ((width == 1) ? B(b[len-1]) : W(b[len-2]));
+
+			pc = (ra_uncond(op) || (target <= pc)) ? target : npc;
+		} else if (trace_ends(&s->di)) {
+			for (int i=0; i < s->di.f.cnt[PH_PRE] + s->di.f.cnt[PH_EXE] + s->di.f.cnt[PH_POST]; i++)
+				if (s->di.uop[i].op == U_MTPR)
+					stale = true;
+			parked      = true;
+			ra->park_pc = npc;
+			__atomic_store_n(&ra->parked, epoch, __ATOMIC_RELEASE);
+		} else {
+			pc = npc;
+		}
+	}
+	return NULL;
+}
+
+
+/* send the decoder to pc -- or park it there if the executor wants to
+   decode pc itself
+ */
+static void ra_redirect(struct cpu *cpu, uint32_t pc, bool park)
+{
+	struct runahead	*ra = cpu->ra;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->cur++;
+	ra->req.epoch = ra->cur;
+	ra->req.pc    = pc;
+	ra->req.psl   = cpu->r[R_PSL];
+	ra->req.park  = park;
+	memcpy(ra->req.preg, cpu->preg, sizeof(cpu->preg));
+	pthread_mutex_unlock(&ra->lock);
+
+	__atomic_store_n(&ra->epoch, ra->cur, __ATOMIC_RELEASE);
+	ra->redirects++;
+}
+
+
+/* the instruction at pc (bytes from ifetch()), from the ring if the decoder
+   got it right
+
+   0 or the µaddr of an exception, like decode_cached().
+ */
+static int ra_next(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail,
+                   struct dinstr **di)
+{
+	struct runahead	*ra = cpu->ra;
+
+	/* done with the previous one */
+	if (ra->used) {
+		__atomic_store_n(&ra->tail, ra->tail + 1, __ATOMIC_RELEASE);
+		ra->used = false;
+	}
+
+	while (1) {
+		if (ra->tail != __atomic_load_n(&ra->head, __ATOMIC_ACQUIRE)) {
+			struct ra_slot	*s = &ra->ring[ra->tail % RA_RING];
+
+			if (s->epoch != ra->cur) {
+				__atomic_store_n(&ra->tail, ra->tail + 1, __ATOMIC_RELEASE);
+				ra->stale++;
+				continue;
+			}
+
+			if ((s->di.pc == pc) && (avail >= s->di.len) && !memcmp(s->bytes, b, s->di.len)) {
+				*di      = &s->di;
+				ra->used = true;
+				ra->hits++;
+				return 0;
+			}
+
+			/* same pc but other bytes: the code or the translation
+			   changed under the decoder.  Don't ask it again.
+			 */
+			ra_redirect(cpu, pc, s->di.pc == pc);
+			continue;
+		}
+
+		if (__atomic_load_n(&ra->parked, __ATOMIC_ACQUIRE) == ra->cur) {
+			/* nothing more is coming -- the decoder may have put
+			   something in the ring just before it parked
+			 */
+			if (ra->tail != __atomic_load_n(&ra->head, __ATOMIC_ACQUIRE))
+				continue;
+
+			if (ra->park_pc == pc) {
+				ra->owncnt++;
+				*di = &ra->own;
+				return avail ? decode(cpu, pc, b, avail, &ra->own) : fetch_fault(cpu);
+			}
+			ra_redirect(cpu, pc, false);
+			continue;
+		}
+
+		/* the decoder is working on it */
+		sched_yield();
+	}
+}
+
+
+static void ra_start(struct cpu *cpu)
+{
+	struct runahead	*ra = calloc(1, sizeof(struct runahead));
+
+	if (!ra) {
+		fprintf(stderr, "ra_start(), out of memory.\n");
+		exit(1);
+	}
+
+	ra->fe.mem    = cpu->mem;
+	tlb_flush(&ra->fe.itlb);
+	ra->fe.ib.tag = TLB_INVALID;
+	pthread_mutex_init(&ra->lock, NULL);
+
+	cpu->ra = ra;
+	if (pthread_create(&ra->thread, NULL, ra_thread, ra) != 0) {
+		fprintf(stderr, "ra_start(), can't start the decoder thread.\n");
+		exit(1);
+	}
+	ra_redirect(cpu, cpu->r[15], false);
+}
+
+
+static void ra_stop(struct cpu *cpu)
+{
+	struct runahead	*ra = cpu->ra;
+
+	__atomic_store_n(&ra->quit, true, __ATOMIC_RELEASE);
+	pthread_join(ra->thread, NULL);
+	pthread_mutex_destroy(&ra->lock);
+}
+
+
+
+
+/***/
+
+
+/* data width for uop */
+static int uop_width(int len)
+{
+	switch (len) {
+	case UW_8 :	return 1;
+	case UW_16:	return 2;
+	case UW_32:	return 4;
+	case UW_64:	return 8;
+	case UW_128:	return 16;
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+/* check flags according to cc -- used by bcc-arch/bcc-µ */
+static int match_cc(int flags, int cc)
+{
+	switch (cc) {
+	case  2: /* NEG   !=          */  return ! Z(flags);
+	case  3: /* EQL   =           */  return   Z(flags);
+	case  4: /* GTR   >  signed   */  return !(N(flags) | Z(flags));
+	case  5: /* LEQ   <= signed   */  return  (N(flags) | Z(flags));
+	case  8: /* GRQ   >= signed   */  return ! N(flags);
+	case  9: /* LSS   <  signed   */  return   N(flags);
+	case 10: /* GTRU  >  unsigned */  return !(C(flags) | Z(flags));
+	case 11: /* LEQU  <= unsigned */  return  (C(flags) | Z(flags));
+	case 12: /* VC   ovrflw clear */  return ! V(flags);
+	case 13: /* VS   ovrflw set   */  return   V(flags);
+	case 14: /* GEQU  >= unsigned */  return ! C(flags);
+	case 15: /* BLSSU <  unsigned */  return   C(flags);
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+
+/* mask for the low 8/16/32 bits of a register */
+static uint32_t width_mask(int width)
+{
+	switch (width) {
+	case UW_8 :	return 0xFF;
+	case UW_16:	return 0xFFFF;
+	case UW_32:	return 0xFFFFFFFF;
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+/* sign extend the low 8/16/32 bits */
+static int32_t signext(uint32_t x, int width)
+{
+	switch (width) {
+	case UW_8 :	return (int8_t)  x;
+	case UW_16:	return (int16_t) x;
+	case UW_32:	return (int32_t) x;
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+/* partial width register write -- the untouched bits keep their value */
+static void reg_write(struct cpu *cpu, int dst, uint32_t val, int width)
+{
+	uint32_t	mask = width_mask(width);
+
+	cpu->r[dst] = (cpu->r[dst] & ~mask) | (val & mask);
+}
+
+
+/* register write journal
+
+   An instruction that faults after an autoincrement/autodecrement has to
+   leave the GPRs as they were.  Those are the only GPR changes that can come
+   before a fault (the µcode guarantees it, see doc/implementation.txt), so
+   only inc/dec µops with a GPR as the destination log the old value -- one
+   or two entries for most instructions, nothing at all for most.
+
+   Commit forgets the log, rollback undoes it newest first.  The log is a
+   ring that is bigger than any single instruction needs (6 operands), so a
+   trace doesn't have to commit between its instructions: after a side exit
+   the newest entries are the ones from the instruction that left, and
+   jnl_keep() commits the rest by moving jnl_base up past them.  The kept
+   entries stay where they are, the range may wrap around the end of the
+   ring.  Older entries may already have been overwritten, which doesn't
+   matter since they are committed anyway.
+
+   jnl_cnt only counts up between commits and entry n is in slot
+   n % JNL_CNT.  The JIT's copy of jnl_log() relies on that.
+ */
+static inline void jnl_log(struct cpu *cpu, int reg, int idx)
+{
+	unsigned	n = cpu->jnl_cnt++ % JNL_CNT;
+
+	cpu->jnl[n].val = cpu->r[reg];
+	cpu->jnl[n].idx = idx;
+	cpu->jnl[n].reg = reg;
+}
+
+
+static inline void jnl_commit(struct cpu *cpu)
+{
+	cpu->jnl_cnt  = 0;
+	cpu->jnl_base = 0;
+}
+
+
+/* uncommitted entries that are still in the ring */
+static inline unsigned jnl_live(struct cpu *cpu)
+{
+	unsigned	cnt = cpu->jnl_cnt - cpu->jnl_base;
+
+	return (cnt < JNL_CNT) ? cnt : JNL_CNT;
+}
+
+
+static void jnl_rollback(struct cpu *cpu)
+{
+	unsigned	cnt = jnl_live(cpu);
+
+	while (cnt--) {
+		unsigned	n = --cpu->jnl_cnt % JNL_CNT;
+
+		cpu->r[cpu->jnl[n].reg] = cpu->jnl[n].val;
+	}
+	jnl_commit(cpu);
+}
+
+
+/* commit the entries from the µops before idx, keep the newer ones */
+static void jnl_keep(struct cpu *cpu, int idx)
+{
+	unsigned	cnt  = jnl_live(cpu);
+	unsigned	keep = 0;
+
+	while ((keep < cnt) && (cpu->jnl[(cpu->jnl_cnt - keep - 1) % JNL_CNT].idx >= idx))
+		keep++;
+
+	cpu->jnl_base = cpu->jnl_cnt - keep;
+}
+
+
+/* lazy condition codes
+
+   ALU µops don't compute NZVC, they just record what they did in cpu->lf[]
+   (one per flag set).  The flags are worked out when something looks at
+   them, and then only the ones it needs: a bcc usually only needs one or
+   two of them.  Most flag results are overwritten before anybody looks.
+
+   C has its own record because the mz0- µops leave it alone -- they copy the
+   carry record instead of computing the old C.
+
+   Anything that reads psl[] directly has to call flags_sync() first.
+ */
+
+/* which flags each cc looks at */
+static const uint8_t	cc_need[16] = {
+	[U_CC_NEG]  = NZVC(0,1,0,0),	[U_CC_EQL]  = NZVC(0,1,0,0),
+	[U_CC_GTR]  = NZVC(1,1,0,0),	[U_CC_LEQ]  = NZVC(1,1,0,0),
+	[U_CC_GEQ]  = NZVC(1,0,0,0),	[U_CC_LSS]  = NZVC(1,0,0,0),
+	[U_CC_GTRU] = NZVC(0,1,0,1),	[U_CC_LEQU] = NZVC(0,1,0,1),
+	[U_CC_VC]   = NZVC(0,0,1,0),	[U_CC_VS]   = NZVC(0,0,1,0),
+	[U_CC_GEQU] = NZVC(0,0,0,1),	[U_CC_LSSU] = NZVC(0,0,0,1),
+};
+
+
+static int lf_carry(const struct lflags *lf)
+{
+	uint32_t	mask = width_mask(lf->carry.width);
+
+	switch (lf->carry.op) {
+	case LF_ADD:
+		return (uint64_t) (lf->carry.a & mask) + (lf->carry.b & mask) + lf->carry.cin > mask;
+	case LF_SUB:
+	case LF_CMP:
+		return (lf->carry.a & mask) < (uint64_t) (lf->carry.b & mask) + lf->carry.cin;
+	default:
+		return lf->carry.c;
+	}
+}
+
+
+/* the flags in need (NZVC mask) from flag set 'set' -- the others are 0 */
+static int flags_get(struct cpu *cpu, int set, int need)
+{
+	const struct lflags	*lf = &cpu->lf[set];
+
+	if (lf->op == LF_NONE)
+		return cpu->psl[set];
+
+	cpu->lf_evals++;
+
+	uint32_t	mask = width_mask(lf->width);
+	uint32_t	a = lf->a, b = lf->b, res = lf->res;
+	int		n = 0, z = 0, v = 0, c = 0;
+
+	if (lf->op == LF_CMP) {
+		n = N(need) && (signext(a, lf->width) < signext(b, lf->width));
+		z = Z(need) && (((a ^ b) & mask) == 0);
+	} else {
+		n = N(need) && (signext(res, lf->width) < 0);
+		z = Z(need) && ((res & mask) == 0);
+	}
+
+	if (V(need))
+		switch (lf->op) {
+		case LF_RES:	v = lf->v;	break;
+		case LF_ADD:	v = ((a ^ res) & (b ^ res) & ~(mask >> 1) & mask) != 0;	break;
+		case LF_SUB:	v = ((a ^ b) & (a ^ res) & ~(mask >> 1) & mask) != 0;	break;
+		default:	v = 0;
+		}
+
+	if (C(need))
+		c = lf_carry(lf);
+
+	return NZVC(n, z, v, c);
+}
+
+
+/* a flag-setting result for flag set 'set' -- kind is LF_xxx, c the new C
+   for LF_RES (-1 leaves C alone)
+ */
+static inline void lf_record(struct cpu *cpu, int set, int kind, int width,
+                             uint32_t a, uint32_t b, uint32_t res, int v, int c, int cin)
+{
+	struct lflags	*lf = &cpu->lf[set];
+
+	/* where does C come from? */
+	if ((kind == LF_ADD) || (kind == LF_SUB) || (kind == LF_CMP)) {
+		lf->carry.op    = kind;
+		lf->carry.width = width;
+		lf->carry.cin   = cin;
+		lf->carry.a     = a;
+		lf->carry.b     = b;
+	} else if (c >= 0) {
+		lf->carry.op    = LF_NONE;
+		lf->carry.c     = c;
+	} else if (lf->op == LF_NONE) {
+		lf->carry.op    = LF_NONE;
+		lf->carry.c     = C(cpu->psl[set]);
+	}
+
+	lf->op    = kind;
+	lf->width = width;
+	lf->v     = v;
+	lf->a     = a;
+	lf->b     = b;
+	lf->res   = res;
+	cpu->lf_ops++;
+}
+
+
+/* fold the pending flag-setting µop into psl[set] */
+static void flags_sync(struct cpu *cpu, int set)
+{
+	if (cpu->lf[set].op != LF_NONE) {
+		cpu->psl[set]    = flags_get(cpu, set, NZVC(1,1,1,1));
+		cpu->lf[set].op  = LF_NONE;
+	}
+}
+
+
+
+/* The ALU.  See uops.spec for operand order and flag modes.
+
+   0 or the µaddr of an exception (with U_EXC_MASK set).
+
+   Integer overflow only traps if the architected flags are written and
+   PSL<IV> is set.  The result is written anyway -- it is a trap, not a fault.
+ */
+static int alu(struct cpu *cpu, struct uop u)
+{
+	uint32_t	 a     = cpu->r[u.s1];
+	uint32_t	 b     = cpu->r[u.s2];
+	int		 width = u.width;
+	uint32_t	 res;
+	int		 kind = LF_RES;
+	int		 v = 0, c = -1;		/* -1: C is left alone */
+	int		 cin = 0;
+	int		 exc = 0;
+
+	switch (u.op) {
+	/* mz0- */
+	case U_MOV :	res = a;		break;
+	case U_AND :	res = a &  b;		break;
+	case U_BIC :	res = a & ~b;		break;
+	case U_BIS :	res = a |  b;		break;
+	case U_XOR :	res = a ^  b;		break;
+	case U_ROTL:
+		width = UW_32;
+		res   = (a << (b & 31)) | (a >> ((32 - (b & 31)) & 31));
+		break;
+
+	/* -Z0- */
+	case U_MOVX:
+		{
+		uint32_t	*flags = &cpu->psl[u.flags];
+
+		reg_write(cpu, u.dst, a, width);
+		flags_sync(cpu, u.flags);
+		*flags = NZVC(N(*flags), Z(*flags) && !(a & width_mask(width)), 0, C(*flags));
+		cpu->lf_ops++;
+		}
+		return 0;
+
+	/* mz00 */
+	case U_SIGNBW:	res = (int8_t)  a;	width = UW_16;	c = 0;	break;
+	case U_SIGNBL:	res = (int8_t)  a;	width = UW_32;	c = 0;	break;
+	case U_SIGNWL:	res = (int16_t) a;	width = UW_32;	c = 0;	break;
+	case U_ZEROBW:	res = (uint8_t)  a;	width = UW_16;	c = 0;	break;
+	case U_ZEROBL:	res = (uint8_t)  a;	width = UW_32;	c = 0;	break;
+	case U_ZEROWL:	res = (uint16_t) a;	width = UW_32;	c = 0;	break;
+
+	/* mzv0 */
+	case U_TRUNCWB:	res = a;  width = UW_8;   v = (int16_t) a != (int8_t)  a;  c = 0;  break;
+	case U_TRUNCLB:	res = a;  width = UW_8;   v = (int32_t) a != (int8_t)  a;  c = 0;  break;
+	case U_TRUNCLW:	res = a;  width = UW_16;  v = (int32_t) a != (int16_t) a;  c = 0;  break;
+
+	case U_ASHL:
+		{
+		int	cnt = (int8_t) b;
+
+		width = UW_32;
+		c     = 0;
+		if (cnt >= 32) {
+			res = 0;
+			v   = a != 0;
+		} else if (cnt >= 0) {
+			res = a << cnt;
+			v   = ((int32_t) res >> cnt) != (int32_t) a;
+		} else if (cnt > -32) {
+			res = (int32_t) a >> -cnt;
+		} else {
+			res = (int32_t) a >> 31;
+		}
+		}
+		break;
+
+	case U_MUL:
+		{
+		int64_t	p = (int64_t) signext(a, width) * signext(b, width);
+
+		res = p;
+		v   = p != signext(res, width);
+		c   = 0;
+		}
+		break;
+
+	case U_DIV:
+		c = 0;
+		if (signext(b, width) == 0) {
+			/* quotient replaced by dividend */
+			res = a;
+			v   = 1;
+			exc = LBL_EXC_INT_DIV_BY_ZERO | U_EXC_MASK;
+		} else if ((signext(b, width) == -1) &&
+			   ((a & width_mask(width)) == ((width_mask(width) >> 1) + 1))) {
+			res = a;
+			v   = 1;
+		} else {
+			res = signext(a, width) / signext(b, width);
+		}
+		break;
+
+	/* mzvc */
+	case U_ADD:
+	case U_ADC:
+		kind = LF_ADD;
+		cin  = (u.op == U_ADC) ? C(flags_get(cpu, u.flags, NZVC(0,0,0,1))) : 0;
+		res  = (a & width_mask(width)) + (b & width_mask(width)) + cin;
+		break;
+	case U_SUB:
+	case U_SBB:
+		kind = LF_SUB;
+		cin  = (u.op == U_SBB) ? C(flags_get(cpu, u.flags, NZVC(0,0,0,1))) : 0;
+		res  = a - ((b & width_mask(width)) + cin);
+		break;
+
+	/* <=0< */
+	case U_CMP:
+		kind = LF_CMP;
+		res  = 0;
+		break;
+
+	default:
+		/* ASHQ/EMUL/EDIV -- FIXME not supported yet */
+		assert(0);
+		return 0;
+	}
+
+	if (u.op != U_CMP)
+		reg_write(cpu, u.dst, res, width);
+	lf_record(cpu, u.flags, kind, width, a, b, res, v, c, cin);
+
+	/* the trap needs V now */
+	if (!exc && (u.flags == U_ARCH) && (cpu->r[R_PSL] & PSL_IV) &&
+	    V(flags_get(cpu, u.flags, NZVC(0,0,1,0))))
+		exc = LBL_EXC_INTO | U_EXC_MASK;
+	return exc;
+}
+
+
+
+#define UADDR_DONE	0xFFFF
+
+
+/* µcode is never allowed to refer to r15/PC directly -- only look at the
+   fields the µop has, imm shares its bits with s1/s2.  Only used in assert().
+ */
+static int uop_no_pc(const struct uop *u) __attribute__((unused));
+static int uop_no_pc(const struct uop *u)
+{
+	unsigned	fields = uop[u->op].fields;
+
+	return !((fields & (UF_S1 | UF_M1)) && (u->s1  == 15)) &&
+	       !((fields & (UF_S2 | UF_M2)) && (u->s2  == 15)) &&
+	       !((fields & UF_DST)          && (u->dst == 15));
+}
+
+
+/* --trace, see trc_instr().  trc is NULL while the run isn't traced. */
+struct trc;
+static struct trc	*trc, *trc_file;
+static void trc_store(uint32_t va, int len, uint32_t lo, uint32_t hi);
+
+/* --engine lockstep, see lockstep() */
+struct ls_state;
+static struct ls_state	*ls;
+static void ls_store(uint32_t va, int len, uint32_t lo, uint32_t hi, uint32_t olo, uint32_t ohi);
+static void ls_diverges(const char *why);
+
+
+/* the memory µops, shared by the datapath and the JIT helpers.  false on an
+   access exception.
+ */
+static inline bool uop_ld(struct cpu *cpu, const struct uop *u)
+{
+	uint32_t	tmp, tmphi;
+	int		err;
+
+	if (!access(cpu,
+		    MODE_READ +
+		    (MODE_LDI * (u->op == U_LDI)) +
+		    (MODE_LDU * (u->op == U_LDU)),
+		    cpu->r[u->s1], uop_width(u->width), &tmp, &tmphi, &err))
+		return false;
+
+	reg_write(cpu, u->dst, tmp, u->width);
+	return true;
+}
+
+
+static inline bool uop_st(struct cpu *cpu, const struct uop *u)
+{
+	uint32_t	tmp = cpu->r[u->s1], tmphi = 0;
+	int		err;
+
+	if (!access(cpu,
+		    MODE_WRITE +
+		    (MODE_LDI * (u->op == U_STI)) +
+		    (MODE_LDU * (u->op == U_STU)),
+		    cpu->r[u->s2], uop_width(u->width), &tmp, &tmphi, &err))
+		return false;
+	if (trc)
+		trc_store(cpu->r[u->s2], uop_width(u->width), tmp, tmphi);
+	if (ls)
+		ls_store(cpu->r[u->s2], uop_width(u->width), tmp, tmphi, 0, 0);
+	return true;
+}
+
+
+/* µop profile -- how often each µop pair and triple runs, for uasm.pl --fuse.
+
+   Only the µops that actually ran count: a flow that is left early stops at
+   the µop that left it.  Pairs across the flows of a trace count, pairs
+   across separate datapath() calls don't -- they can't be fused.
+ */
+#define UPROF_CNT	ARRAY_SIZE(uop)
+
+static bool	uprof;
+static long	uprof_pair[UPROF_CNT][UPROF_CNT];
+static long	uprof_triple[UPROF_CNT][UPROF_CNT][UPROF_CNT];
+
+
+/* cpu->uidx is where the flow stopped */
+static void uprof_flow(struct cpu *cpu, int uop_cnt, const struct uop flow[uop_cnt])
+{
+	int	ran = (cpu->uidx < uop_cnt) ? cpu->uidx + 1 : uop_cnt;
+
+	for (int i=0; i+1 < ran; i++) {
+		uprof_pair[flow[i].op][flow[i+1].op]++;
+		if (i+2 < ran)
+			uprof_triple[flow[i].op][flow[i+1].op][flow[i+2].op]++;
+	}
+}
+
+
+struct uprof_seq {
+	long	cnt;
+	int	len;
+	int	op[3];
+};
+
+
+static int uprof_cmp(const void *a, const void *b)
+{
+	const struct uprof_seq	*x = a, *y = b;
+
+	return (x->cnt < y->cnt) - (x->cnt > y->cnt);
+}
+
+
+/* one line per pair/triple that ran, most frequent first */
+static void uprof_dump(const char *fname)
+{
+	static struct uprof_seq	seq[UPROF_CNT * UPROF_CNT * (UPROF_CNT + 1)];
+	int			cnt = 0;
+	FILE			*f;
+
+	for (unsigned a=0; a < UPROF_CNT; a++)
+		for (unsigned b=0; b < UPROF_CNT; b++) {
+			if (uprof_pair[a][b])
+				seq[cnt++] = (struct uprof_seq) {uprof_pair[a][b], 2, {a, b}};
+			for (unsigned c=0; c < UPROF_CNT; c++)
+				if (uprof_triple[a][b][c])
+					seq[cnt++] = (struct uprof_seq) {uprof_triple[a][b][c], 3, {a, b, c}};
+		}
+	qsort(seq, cnt, sizeof(seq[0]), uprof_cmp);
+
+	if ((f = fopen(fname, "w")) == NULL) {
+		perror("fopen()");
+		fprintf(stderr, "can't create µop profile.\n");
+		exit(1);
+	}
+
+	fprintf(f, "# µop pairs and triples by run count -- revax-sim --uop-profile\n");
+	for (int i=0; i < cnt; i++) {
+		fprintf(f, "%-6s  %10ld ", seq[i].len == 2 ? "pair" : "triple", seq[i].cnt);
+		for (int j=0; j < seq[i].len; j++)
+			fprintf(f, " %s", uop[seq[i].op[j]].name);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+
+
+/* execution counts -- revax-sim --stats
+
+   How often each opcode (FD xx is 1xx), each (fragment group, operand class)
+   pair, and each ucode[] entry ran.  Nothing is counted per µop: a template
+   notes the span of its µops that ran as differences, heat[from]++ and
+   heat[from+ran]--, and µbranch targets -- expanded straight from ucode[] --
+   do the same in stats_ucode[].  The sums are only taken for the report.
+   When --stats isn't given it costs a test of a global per datapath() call,
+   same as --uop-profile.
+
+   The first µop of a template runs once per instruction, that's the opcode
+   count.  Instructions that decode() turns into exceptions aren't counted.
+
+   The report is written when the simulator stops, and on SIGUSR1 at the next
+   instruction boundary (EV_STATS).  One record per line, counts > 0 only:
+
+     op     <opcode> <mnemonic> <count>
+     opnd   <fragment group> <class> <count>
+     ucode  <index> <ucode.vu line> <count>
+
+   misc/ucode-heat.pl puts the ucode counts next to the lines of ucode.vu.
+   With --run-ahead, a template the decoder thread is adding while the report
+   is written may be missed.
+ */
+static bool		 stats;
+static const char	*stats_file;
+static long		 stats_ucode[ARRAY_SIZE(ucode) + 1];
+
+
+/* how many µops of a cnt µop flow ran -- cpu->uidx is where it stopped */
+static int uran(struct cpu *cpu, int cnt)
+{
+	return (cpu->uidx < cnt) ? cpu->uidx + 1 : cnt;
+}
+
+
+/* µops [from, from+ran) of template t ran */
+static void stats_tmpl(struct flow_tmpl *t, int from, int ran)
+{
+	if (ran) {
+		t->heat[from]++;
+		t->heat[from + ran]--;
+	}
+}
+
+
+/* the first ran µops of the µbranch target flow at uaddr ran */
+static void stats_branch(int uaddr, int ran)
+{
+	if (ran) {
+		stats_ucode[uaddr]++;
+		stats_ucode[uaddr + ran]--;
+	}
+}
+
+
+static const char *ulabel(int uaddr);
+
+
+static const char *stats_class(int cl)
+{
+	switch (cl) {
+	case CLASS_IMM:	return "imm";
+	case CLASS_REG:	return "reg";
+	case CL_BRANCH:	return "branch";
+	default:	return ulabel(cl);
+	}
+}
+
+
+static void stats_dump(void)
+{
+	static long	opcnt[512];
+	static long	ucnt[ARRAY_SIZE(ucode)];
+	static long	clcnt[ARRAY_SIZE(fragment_group)][3 + ARRAY_SIZE(ucode)];	/* cl+3 */
+	FILE		*f;
+
+	memset(opcnt, 0, sizeof(opcnt));
+	memset(clcnt, 0, sizeof(clcnt));
+
+	for (long i=0, sum=0; i < (long) ARRAY_SIZE(ucode); i++)
+		ucnt[i] = sum += stats_ucode[i];
+
+	for (int h=0; h < TMPL_CNT; h++)
+		for (struct flow_tmpl *t = tmpl_hash[h]; t; t = t->next) {
+			int	cnt  = t->f.cnt[PH_PRE] + t->f.cnt[PH_EXE] + t->f.cnt[PH_POST];
+			long	runs = cnt ? t->heat[0] : 0;
+
+			if (!runs)
+				continue;
+
+			for (int i=0, sum=0; i < cnt; i++)
+				ucnt[t->uaddr[i]] += sum += t->heat[i];
+
+			opcnt[t->op] += runs;
+			for (unsigned i=0; i < op_cnt[t->op]; i++)
+				clcnt[frag_list[t->op][i]][t->cl[i] + 3] += runs;
+		}
+
+	if ((f = fopen(stats_file, "w")) == NULL) {
+		perror("fopen()");
+		fprintf(stderr, "can't create stats report.\n");
+		exit(1);
+	}
+
+	fprintf(f, "# execution counts -- revax-sim --stats\n");
+	for (int op=0; op < 512; op++)
+		if (opcnt[op])
+			fprintf(f, "op     %03X %-8s %12ld\n", op, mne[op], opcnt[op]);
+	for (unsigned g=0; g < ARRAY_SIZE(fragment_group); g++)
+		for (unsigned c=0; c < ARRAY_SIZE(clcnt[0]); c++)
+			if (clcnt[g][c])
+				fprintf(f, "opnd   %-12s %-30s %12ld\n",
+					fragment_group[g].name, stats_class((int) c - 3), clcnt[g][c]);
+	for (unsigned i=0; i < ARRAY_SIZE(ucode); i++)
+		if (ucnt[i])
+			fprintf(f, "ucode  %4u %5u %12ld\n", i, ulineno[i], ucnt[i]);
+	fclose(f);
+}
+
+
+/* sampling profiler -- revax-sim --profile <out> [--symbols <file>]
+
+   A host interval timer (ITIMER_PROF, PROF_HZ per second of CPU time) posts
+   EV_PROF.  cpu_run() takes the sample at the next instruction boundary: the
+   PC, the instruction there, and the return PCs of the CALLG/CALLS frame
+   chain.  The events word is only looked at once per trace, so samples land
+   on the first instruction of a trace -- the function is right, the exact
+   instruction less so.  There is no µaddress at a boundary, the leaf frame is
+   the mnemonic of the instruction (its exe flow in ucode.vu).
+
+   The walk follows 12(FP) (the caller's FP) and reads 16(FP) (the return
+   PC).  It reads guest memory without faulting or touching the TLBs, and it
+   stops at FP 0, at a frame it can't read, and when FP doesn't go up.
+   JSB/BSB don't make frames, so their callers don't show up.
+
+   The output is folded stacks, one line per distinct stack, outermost frame
+   first -- what flamegraph.pl wants:
+
+     main;Proc_1;Proc_3;MOVL 12
+
+   Frames are named from the text symbols of an a.out (Ultrix or OpenBSD/
+   NetBSD), or from the procedures in a revax-dis .map file (an entry mask,
+   'dd', followed by a code label, '@' -- all the '@' labels if there are
+   no procedures).  A PC below all the symbols, or without --symbols, is
+   shown as its address.
+ */
+#define PROF_HZ		1000
+#define PROF_DEPTH	32
+#define PROF_HASH	4096
+
+struct prof_stack {
+	struct prof_stack	*next;
+	long			 cnt;
+	int			 op;			/* -1: not an instruction */
+	int			 depth;
+	uint32_t		 pc[PROF_DEPTH];	/* innermost first */
+};
+
+struct prof_sym {
+	uint32_t	 addr;
+	bool		 ext;		/* a.out N_EXT, preferred on ties */
+	char		*name;
+};
+
+static bool			 prof;
+static const char		*prof_file;
+static struct prof_stack	*prof_hash[PROF_HASH];
+static struct prof_sym		*prof_sym;
+static int			 prof_symcnt;
+
+
+/* an aligned longword at va -- false if it isn't there, never faults */
+static bool prof_peek(struct cpu *cpu, uint32_t va, uint32_t *val)
+{
+	uint32_t	pa, pte;
+	int		err;
+
+	if ((va & 3) || !xlat(cpu, va, 0, -1, &pa, &pte, &err))
+		return false;
+	return phys_ld32(cpu->mem, pa, val);
+}
+
+
+/* a sample at pc, b[0..avail-1] are the bytes there */
+static void prof_sample(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail)
+{
+	struct prof_stack	s  = {.op = -1, .depth = 1, .pc = {pc}};
+	uint32_t		fp = cpu->r[13];
+
+	events_clear(cpu, EV_PROF);
+
+	if ((avail >= 1) && (b[0] != 0xFD))
+		s.op = b[0];
+	else if (avail >= 2)
+		s.op = 0x100 | b[1];
+	if ((s.op >= 0) && !mne[s.op][0])
+		s.op = -1;
+
+	while (fp && (s.depth < PROF_DEPTH)) {
+		uint32_t	nfp, npc;
+
+		if (!prof_peek(cpu, fp + 12, &nfp) || !prof_peek(cpu, fp + 16, &npc))
+			break;
+		s.pc[s.depth++] = npc;
+		if (nfp <= fp)
+			break;
+		fp = nfp;
+	}
+
+	unsigned	h = s.op + s.depth;
+
+	for (int i=0; i < s.depth; i++)
+		h = h * 31 + s.pc[i];
+	h %= PROF_HASH;
+
+	for (struct prof_stack *p = prof_hash[h]; p; p = p->next)
+		if ((p->op == s.op) && (p->depth == s.depth) &&
+		    (memcmp(p->pc, s.pc, s.depth * sizeof(s.pc[0])) == 0)) {
+			p->cnt++;
+			return;
+		}
+
+	struct prof_stack	*p = malloc(sizeof(struct prof_stack));
+
+	if (!p) {
+		fprintf(stderr, "prof_sample(), out of memory.\n");
+		exit(1);
+	}
+	*p           = s;
+	p->cnt       = 1;
+	p->next      = prof_hash[h];
+	prof_hash[h] = p;
+}
+
+
+static void prof_add_sym(uint32_t addr, bool ext, const char *name, int len)
+{
+	prof_sym = realloc(prof_sym, (prof_symcnt + 1) * sizeof(struct prof_sym));
+	if (!prof_sym || !(prof_sym[prof_symcnt].name = strndup(name, len))) {
+		fprintf(stderr, "prof_add_sym(), out of memory.\n");
+		exit(1);
+	}
+	prof_sym[prof_symcnt].addr = addr;
+	prof_sym[prof_symcnt].ext  = ext;
+	prof_symcnt++;
+}
+
+
+#define AOUT_ZMAGIC	0x010B		/* 0413 */
+#define AOUT_NMAGIC	0x0108		/* 0410 */
+#define AOUT_OMAGIC	0x0107		/* 0407 */
+
+#define AOUT_N_EXT	0x01
+#define AOUT_N_TYPE	0x1E
+#define AOUT_N_TEXT	0x04
+#define AOUT_N_STAB	0xE0
+
+/* the text symbols of an a.out -- false if it isn't one
+
+   The header is 8 longwords: magic, text, data, bss, syms, entry, trsize,
+   drsize.  OpenBSD/NetBSD have a big-endian midmag and the header inside the
+   text, Ultrix has a little-endian magic and the text at 1024.  The symbol
+   table is after the text, data and relocations, the string table right
+   after it.  The object file names in the table are text symbols too, they
+   are the ones with '.' or '/' in them.  C names lose their leading '_'.
+ */
+static bool prof_aout(const uint8_t *buf, size_t sze)
+{
+	if (sze < 32)
+		return false;
+
+	uint32_t	hdr[8];
+
+	for (int i=0; i < 8; i++)
+		hdr[i] = L(buf[i*4]);
+
+	unsigned	magic_be = (buf[2] << 8) | buf[3];
+	unsigned	magic_le = hdr[0] & 0xFFFF;
+	size_t		txtoff;
+
+	if (magic_be == AOUT_ZMAGIC)
+		txtoff = 0;
+	else if (magic_le == AOUT_ZMAGIC)
+		txtoff = 1024;
+	else if ((magic_le == AOUT_NMAGIC) || (magic_le == AOUT_OMAGIC))
+		txtoff = 32;
+	else
+		return false;
+
+	size_t	symoff = txtoff + (size_t) hdr[1] + hdr[2] + hdr[6] + hdr[7];
+	size_t	stroff = symoff + hdr[4];
+
+	if ((stroff < symoff) || (stroff + 4 > sze))
+		return true;	/* stripped or truncated */
+
+	size_t	strsze = L(buf[stroff]);
+
+	if (strsze > sze - stroff)
+		strsze = sze - stroff;
+
+	for (size_t i = symoff; i + 12 <= stroff; i += 12) {
+		uint32_t	strx = L(buf[i]);
+		uint8_t		type = buf[i+4];
+		uint32_t	val  = L(buf[i+8]);
+
+		if ((type & AOUT_N_STAB) || ((type & AOUT_N_TYPE) != AOUT_N_TEXT) || (strx >= strsze))
+			continue;
+
+		const char	*name = (const char *) buf + stroff + strx;
+		int		 len  = strnlen(name, strsze - strx);
+
+		if ((len == 0) || memchr(name, '.', len) || memchr(name, '/', len))
+			continue;
+		if ((name[0] == '_') && (len > 1)) {
+			name++;
+			len--;
+		}
+		prof_add_sym(val, type & AOUT_N_EXT, name, len);
+	}
+	return true;
+}
+
+
+/* the procedures of a revax-dis .map file
+
+     XXXX_XXXX  <16 map chars> <16> <16> <16>
+
+   An entry mask is exactly two 'd's (CASE tables are runs of them) followed
+   by '@'.  The names are the addresses, like in the revax-dis output.
+ */
+static void prof_map(const char *buf)
+{
+	for (int pass = 0; (pass < 2) && (prof_symcnt == 0); pass++) {
+		char	prev[3] = "...";	/* the chars before the current one */
+
+		for (const char *line = buf; *line; ) {
+			const char	*end = strchr(line, '\n');
+			unsigned	 hi, lo;
+
+			if (!end)
+				end = line + strlen(line);
+			if ((end - line > 11) && (sscanf(line, "%4X_%4X", &hi, &lo) == 2)) {
+				uint32_t	addr = (hi << 16) | lo;
+
+				for (const char *c = line + 11; c < end; c++) {
+					if (*c == ' ')
+						continue;
+
+					bool	proc = (prev[0] != 'd') && (prev[1] == 'd') && (prev[2] == 'd');
+
+					if ((*c == '@') && ((pass == 1) || proc)) {
+						char	name[10];
+						uint32_t sym = pass ? addr : addr - 2;
+
+						snprintf(name, sizeof(name), "%04X_%04X", SPLIT(sym));
+						prof_add_sym(sym, true, name, 9);
+					}
+					prev[0] = prev[1];
+					prev[1] = prev[2];
+					prev[2] = *c;
+					addr++;
+				}
+			}
+			line = *end ? end + 1 : end;
+		}
+	}
+}
+
+
+static int prof_symcmp(const void *a, const void *b)
+{
+	const struct prof_sym	*x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return (x->addr > y->addr) - (x->addr < y->addr);
+	return y->ext - x->ext;
+}
+
+
+/* read the symbols for the frame names -- an a.out or a .map file */
+static void prof_symbols(const char *fname)
+{
+	FILE	*f;
+	uint8_t	*buf = NULL;
+	size_t	 sze = 0, n;
+
+	if ((f = fopen(fname, "rb")) == NULL) {
+		perror("fopen()");
+		fprintf(stderr, "can't open symbol file '%s'.\n", fname);
+		exit(1);
+	}
+	do {
+		if (!(buf = realloc(buf, sze + 65536 + 1))) {
+			fprintf(stderr, "prof_symbols(), out of memory.\n");
+			exit(1);
+		}
+		sze += n = fread(buf + sze, 1, 65536, f);
+	} while (n);
+	fclose(f);
+	buf[sze] = '\0';
+
+	if (!prof_aout(buf, sze))
+		prof_map((const char *) buf);
+	free(buf);
+
+	/* sorted, one per address (N_EXT first) */
+	qsort(prof_sym, prof_symcnt, sizeof(prof_sym[0]), prof_symcmp);
+
+	int	cnt = 0;
+
+	for (int i=0; i < prof_symcnt; i++)
+		if ((cnt == 0) || (prof_sym[cnt-1].addr != prof_sym[i].addr))
+			prof_sym[cnt++] = prof_sym[i];
+		else
+			free(prof_sym[i].name);
+	prof_symcnt = cnt;
+}
+
+
+/* the frame name for pc -- the nearest symbol at or below it */
+static const char *prof_name(uint32_t pc, char buf[10])
+{
+	int	lo = 0, hi = prof_symcnt;
+
+	while (lo < hi) {
+		int	mid = (lo + hi) / 2;
+
+		if (prof_sym[mid].addr <= pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo)
+		return prof_sym[lo-1].name;
+	snprintf(buf, 10, "%04X_%04X", SPLIT(pc));
+	return buf;
+}
+
+
+/* one line per distinct stack */
+static void prof_dump(void)
+{
+	FILE	*f;
+
+	if ((f = fopen(prof_file, "w")) == NULL) {
+		perror("fopen()");
+		fprintf(stderr, "can't create profile.\n");
+		exit(1);
+	}
+
+	for (int h=0; h < PROF_HASH; h++)
+		for (struct prof_stack *p = prof_hash[h]; p; p = p->next) {
+			char	buf[10];
+
+			for (int i = p->depth - 1; i >= 0; i--)
+				fprintf(f, "%s;", prof_name(p->pc[i], buf));
+			fprintf(f, "%s %ld\n", (p->op >= 0) ? mne[p->op] : "?", p->cnt);
+		}
+	fclose(f);
+}
+
+
+/* binary execution trace -- revax-sim --trace <file>, --trace-last <file>
+
+   One record per instruction, written into an in-memory ring of TRC_BLOCKS
+   blocks.  --trace writes each block to the file when it is full,
+   --trace-last only keeps the last TRC_BLOCKS blocks and writes them at the
+   end.  Either way, what is in the ring is written if the simulator crashes
+   (SIGSEGV, SIGBUS, SIGFPE, SIGILL, and SIGABRT from assert()).
+
+   Instructions run one at a time while tracing (no traces, no JIT), so each
+   one gets its own record.  With nothing to trace, nothing is printed per
+   instruction any more -- 'revax-sim --decode-trace <file>' turns a trace
+   back into the listing: the PC and bytes, the µops, and what changed.
+
+   Records never straddle a block, and each block starts with a sync record,
+   so a block can be decoded on its own -- which is what makes the flight
+   recorder possible.  A sync record also follows every stretch of
+   instructions that weren't traced (see rc_mode()).  Numbers are LEB128 varints, signed ones zigzag
+   encoded:
+
+     sync    01  pc  r0..r14, psl
+     instr   02  pc-npc  len  bytes[len]  regmask  (new^old)...
+                 wcnt  (va-prev_va  len  value[len])...
+     exc     03  <same as instr>  µaddr
+
+   npc is where the previous instruction would have fallen through to, so
+   the PC costs one byte unless there was a jump.  The registers are r0..r14
+   and the PSL with the arch flags in the low 4 bits (bits 0..15 of regmask)
+   -- PC changes are already covered by the PC delta.  Memory writes are the
+   st/sti µops that went through, at most TRC_MAXW per instruction.  The
+   rest of a block is filled with 00 bytes.
+ */
+#define TRC_BLOCK	65536
+#define TRC_BLOCKS	16
+#define TRC_MAXW	32		/* memory writes per record */
+#define TRC_MAXREC	(1 + 5 + 1 + IB_MAX + 3 + 16*5 + 5 + TRC_MAXW*(5 + 1 + 8) + 3)
+#define TRC_MAXSYNC	(1 + 5 + TRC_REGS*5)
+
+#define TRC_PAD		0x00
+#define TRC_SYNC	0x01
+#define TRC_INSTR	0x02
+#define TRC_EXC		0x03
+
+#define TRC_REGS	16		/* r0..r14, psl */
+
+struct trc {
+	int		 fd;
+	bool		 stream;	/* --trace, not --trace-last */
+	uint8_t		*ring;		/* TRC_BLOCKS * TRC_BLOCK */
+	unsigned	 blk;		/* current block */
+	unsigned	 used;		/* bytes used in it */
+	unsigned	 full;		/* blocks filled so far */
+
+	/* what the decoder knows after the last record */
+	uint32_t	 npc;
+	uint32_t	 r[TRC_REGS];
+
+	/* the running instruction -- its bytes before it ran (it may overwrite
+	   itself) and its memory writes
+	 */
+	uint8_t		 b[IB_MAX];
+	int		 wcnt;
+	struct {
+		uint32_t	 va;
+		int		 len;
+		uint32_t	 lo, hi;
+	} w[TRC_MAXW];
+	long		 wlost;
+
+	bool		 gap;		/* instructions ran untraced since the last record */
+};
+
+static uint8_t *trc_uleb(uint8_t *p, uint32_t v)
+{
+	do {
+		*p++ = (v & 0x7F) | ((v > 0x7F) << 7);
+		v  >>= 7;
+	} while (v);
+	return p;
+}
+
+
+static uint8_t *trc_sleb(uint8_t *p, int32_t v)
+{
+	return trc_uleb(p, ((uint32_t) v << 1) ^ (uint32_t) (v >> 31));
+}
+
+
+/* r0..r14 and the PSL as the trace sees them */
+static void trc_regs(struct cpu *cpu, uint32_t r[TRC_REGS])
+{
+	long	evals = cpu->lf_evals;	/* not a real evaluation */
+
+	memcpy(r, cpu->r, 15 * sizeof(uint32_t));
+	r[15] = (cpu->r[R_PSL] & ~0xF) | flags_get(cpu, U_ARCH, NZVC(1,1,1,1));
+	cpu->lf_evals = evals;
+}
+
+
+/* write out blocks -- only write(), it's also called from signal handlers */
+static void trc_write(const uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t	n = write(trc->fd, buf, len);
+
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+
+static void trc_sync(void)
+{
+	uint8_t	*p = trc->ring + trc->blk * TRC_BLOCK + trc->used;
+
+	*p++ = TRC_SYNC;
+	p = trc_uleb(p, trc->npc);
+	for (int i=0; i < TRC_REGS; i++)
+		p = trc_uleb(p, trc->r[i]);
+	trc->used = p - (trc->ring + trc->blk * TRC_BLOCK);
+}
+
+
+/* the current block is full -- pad it, write it (--trace), start the next */
+static void trc_next(void)
+{
+	uint8_t	*b = trc->ring + trc->blk * TRC_BLOCK;
+
+	memset(b + trc->used, TRC_PAD, TRC_BLOCK - trc->used);
+	if (trc->stream)
+		trc_write(b, TRC_BLOCK);
+	trc->blk  = (trc->blk + 1) % TRC_BLOCKS;
+	trc->full++;
+	trc->used = 0;
+	trc_sync();
+}
+
+
+/* what hasn't been written yet -- at the end and after a crash */
+static void trc_flush(void)
+{
+	if (!trc->stream && (trc->full >= TRC_BLOCKS))
+		for (unsigned i=1; i < TRC_BLOCKS; i++)
+			trc_write(trc->ring + ((trc->blk + i) % TRC_BLOCKS) * TRC_BLOCK, TRC_BLOCK);
+	else if (!trc->stream)
+		for (unsigned i=0; i < trc->full; i++)
+			trc_write(trc->ring + i * TRC_BLOCK, TRC_BLOCK);
+	trc_write(trc->ring + trc->blk * TRC_BLOCK, trc->used);
+}
+
+
+static void trc_crash(int sig)
+{
+	trc = trc_file;
+	trc_flush();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+
+static void trc_start(const char *fname, bool stream)
+{
+	if (!(trc = trc_file = calloc(1, sizeof(struct trc))) || !(trc->ring = malloc(TRC_BLOCKS * TRC_BLOCK))) {
+		fprintf(stderr, "trc_start(), out of memory.\n");
+		exit(1);
+	}
+	if ((trc->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		perror("open()");
+		fprintf(stderr, "can't create trace file.\n");
+		exit(1);
+	}
+	trc->stream = stream;
+
+	signal(SIGSEGV, trc_crash);
+	signal(SIGBUS,  trc_crash);
+	signal(SIGFPE,  trc_crash);
+	signal(SIGILL,  trc_crash);
+	signal(SIGABRT, trc_crash);
+}
+
+
+static void trc_stop(void)
+{
+	trc = trc_file;
+	trc_flush();
+	close(trc->fd);
+	if (trc->wlost)
+		fprintf(stderr, "trace: %ld memory writes not recorded (more than %d in an instruction)\n",
+			trc->wlost, TRC_MAXW);
+}
+
+
+/* the instruction at b[] is about to run */
+static void trc_fetch(const uint8_t *b, int avail)
+{
+	if (avail)
+		memcpy(trc->b, b, (avail > IB_MAX) ? IB_MAX : avail);
+}
+
+
+/* a st/sti µop went through */
+static void trc_store(uint32_t va, int len, uint32_t lo, uint32_t hi)
+{
+	if (trc->wcnt == TRC_MAXW) {
+		trc->wlost++;
+		return;
+	}
+	trc->w[trc->wcnt].va  = va;
+	trc->w[trc->wcnt].len = (len > 8) ? 8 : len;
+	trc->w[trc->wcnt].lo  = lo;
+	trc->w[trc->wcnt].hi  = hi;
+	trc->wcnt++;
+}
+
+
+/* the instruction at pc (len bytes, see trc_fetch()) ran -- exc is 0 or the
+   exception it raised
+ */
+static void trc_instr(struct cpu *cpu, uint32_t pc, int len, int exc)
+{
+	if (!trc->used || trc->gap) {
+		/* the state before the first instruction, or after a stretch
+		   that wasn't traced (--skip, --period)
+		 */
+		trc->npc = pc;
+		trc->gap = false;
+		trc_regs(cpu, trc->r);
+		if (trc->used + TRC_MAXSYNC + TRC_MAXREC > TRC_BLOCK)
+			trc_next();
+		else
+			trc_sync();
+	}
+	if (trc->used + TRC_MAXREC > TRC_BLOCK)
+		trc_next();
+
+	uint8_t		*p = trc->ring + trc->blk * TRC_BLOCK + trc->used;
+	uint32_t	 r[TRC_REGS];
+	uint32_t	 mask = 0;
+
+	len = (len > IB_MAX) ? IB_MAX : len;
+
+	*p++ = exc ? TRC_EXC : TRC_INSTR;
+	p    = trc_sleb(p, pc - trc->npc);
+	*p++ = len;
+	memcpy(p, trc->b, len);
+	p   += len;
+
+	trc_regs(cpu, r);
+	for (int i=0; i < TRC_REGS; i++)
+		mask |= (r[i] != trc->r[i]) << i;
+	p = trc_uleb(p, mask);
+	for (int i=0; i < TRC_REGS; i++)
+		if (mask & (1 << i))
+			p = trc_uleb(p, r[i] ^ trc->r[i]);
+	memcpy(trc->r, r, sizeof(r));
+
+	uint32_t	va = 0;
+
+	p = trc_uleb(p, trc->wcnt);
+	for (int i=0; i < trc->wcnt; i++) {
+		p    = trc_sleb(p, trc->w[i].va - va);
+		va   = trc->w[i].va;
+		*p++ = trc->w[i].len;
+		for (int j=0; j < trc->w[i].len; j++)
+			*p++ = (j < 4) ? BYTE(trc->w[i].lo, j) : BYTE(trc->w[i].hi, (j - 4));
+	}
+	trc->wcnt = 0;
+
+	if (exc)
+		p = trc_uleb(p, exc & ~U_EXC_MASK);
+
+	trc->used = p - (trc->ring + trc->blk * TRC_BLOCK);
+	trc->npc  = pc + len;
+}
+
+
+/* next varint/byte of a record -- false at the end of the block */
+static bool trc_uget(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+	*v = 0;
+	for (int shift = 0; (*p < end) && (shift < 35); shift += 7) {
+		uint8_t	b = *(*p)++;
+
+		*v |= (uint32_t) (b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+
+static bool trc_sget(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+	if (!trc_uget(p, end, v))
+		return false;
+	*v = (*v >> 1) ^ -(*v & 1);
+	return true;
+}
+
+
+/* revax-sim --decode-trace -- the trace as the listing the simulator used to
+   print while it ran, plus what each instruction changed.  The µops are the
+   flows decode() makes from the bytes (the µbranch targets that ran aren't
+   in the trace).
+ */
+static void trc_decode(const char *fname)
+{
+	static const char	*rname[TRC_REGS] = {
+		"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11",
+		"r12/AP", "r13/FP", "r14/SP", "PSL"};
+	static struct cpu	 cpu;	/* for decode() */
+
+	FILE	*f;
+	uint8_t	*buf = NULL;
+	size_t	 sze = 0, n;
+
+	if ((f = fopen(fname, "rb")) == NULL) {
+		perror("fopen()");
+		fprintf(stderr, "can't open trace file '%s'.\n", fname);
+		exit(1);
+	}
+	do {
+		if (!(buf = realloc(buf, sze + TRC_BLOCK))) {
+			fprintf(stderr, "trc_decode(), out of memory.\n");
+			exit(1);
+		}
+		sze += n = fread(buf + sze, 1, TRC_BLOCK, f);
+	} while (n);
+	fclose(f);
+
+	uint32_t	npc = 0, r[TRC_REGS] = {0};
+	long		cnt = 0;
+
+	for (size_t blk = 0; blk < sze; blk += TRC_BLOCK) {
+		const uint8_t	*p   = buf + blk;
+		const uint8_t	*end = buf + ((blk + TRC_BLOCK < sze) ? blk + TRC_BLOCK : sze);
+		bool		 ok  = true;
+
+		while (ok && (p < end) && (*p != TRC_PAD)) {
+			uint8_t		tag = *p++;
+			uint32_t	pc, len, mask, wcnt, va = 0, v;
+
+			if (tag == TRC_SYNC) {
+				ok = trc_uget(&p, end, &npc);
+				for (int i=0; ok && (i < TRC_REGS); i++)
+					ok = trc_uget(&p, end, &r[i]);
+				continue;
+			}
+			if ((tag != TRC_INSTR) && (tag != TRC_EXC))
+				break;
+
+			/* PC and bytes */
+			uint8_t		b[IB_MAX + MAX_OPLEN] = {0};
+
+			if (!trc_sget(&p, end, &pc) || (p >= end) || ((len = *p++) > IB_MAX) ||
+			    (p + len > end))
+				break;
+			pc += npc;
+			memcpy(b, p, len);
+			p += len;
+			cnt++;
+
+			printf("PC: %04X_%04X ", SPLIT(pc));
+			for (unsigned i=0; i < 12; i++)
+				printf(i < len ? "%s %02X" : "%s   ", (i % 4) ? "" : "  ", i < len ? b[i] : 0);
+			printf("\n");
+
+			/* µops */
+			struct dinstr	di;
+
+			if (len && !decode(&cpu, pc, b, len, &di))
+				dis_uinstr(0, di.f.cnt[PH_PRE] + di.f.cnt[PH_EXE] + di.f.cnt[PH_POST], DIS_CONT, di.uop);
+
+			/* registers */
+			if (!(ok = trc_uget(&p, end, &mask)))
+				break;
+			for (int i=0; ok && (i < TRC_REGS); i++)
+				if (mask & (1 << i)) {
+					ok = trc_uget(&p, end, &v);
+					r[i] ^= v;
+					printf("       %-6s  %04X_%04X\n", rname[i], SPLIT(r[i]));
+				}
+
+			/* memory */
+			ok = ok && trc_uget(&p, end, &wcnt);
+			for (unsigned i=0; ok && (i < wcnt); i++) {
+				uint32_t	d, wl;
+
+				ok = trc_sget(&p, end, &d) && trc_uget(&p, end, &wl) && (wl <= 8) && (p + wl <= end);
+				if (!ok)
+					break;
+				va += d;
+				printf("       [%04X_%04X] ", SPLIT(va));
+				for (int j = wl - 1; j >= 0; j--)
+					printf("%02X%s", p[j], (j && !(j % 2)) ? "_" : "");
+				printf("  (%u)\n", wl);
+				p += wl;
+			}
+
+			if (ok && (tag == TRC_EXC) && (ok = trc_uget(&p, end, &v)))
+				printf("exception %s at PC %04X_%04X\n", ulabel(v), SPLIT(pc));
+			npc = pc + len;
+		}
+	}
+	printf("%ld instructions\n", cnt);
+	free(buf);
+}
+
+
+/* datapath dispatch
+
+   The default is threaded code: every µop in a flow has the address of its
+   handler (a GNU C label) resolved up front in a parallel array, and each
+   handler jumps straight to the next one.  h[uop_cnt] is the end of the flow,
+   so there is no loop counter to check either.
+
+   -DDATAPATH_SWITCH (or a compiler without computed goto) gets the portable
+   version: a for loop around a switch.  Both are built from the same handler
+   code -- OP() starts a handler, NEXT goes on with the next µop.
+ */
+#if !defined(DATAPATH_SWITCH) && !defined(__GNUC__)
+#define DATAPATH_SWITCH
+#endif
+
+#ifdef DATAPATH_SWITCH
+#define OP(x)		case x
+#define OP_DEFAULT	default
+#define NEXT		continue
+#else
+#define OP(x)		L_##x
+#define OP_DEFAULT	L_DEFAULT
+#define NEXT		do { u++; goto *h[++i]; } while (0)
+#endif
+
+#define EXIT(x)		do { cpu->uidx = i; return (x); } while (0)
+
+
+/* µop bodies -- u is the µop, i its index in the flow.  The handlers in
+   datapath_run() are built from these and so are the superinstructions
+   (UFUSE_PAIRS/UFUSE_TRIPLES from uasm.pl --fuse), which run two or three
+   bodies back to back for a single dispatch.
+ */
+static inline bool bcc_taken(struct cpu *cpu, const struct uop *u)
+{
+	switch (u->cc) {
+	case U_CC_ALWAYS:
+		return true;
+	case U_CC_CC:
+	case U_CC_CALL:
+	case U_CC_RET:
+		/* FIXME -- not supported/necessary yet */
+		assert(0);
+		return false;
+	default:
+		return match_cc(flags_get(cpu, u->flags, cc_need[u->cc]), u->cc);
+	}
+}
+
+#define DO_ALU		do { int exc_addr = alu(cpu, *u); if (exc_addr) EXIT(exc_addr); } while (0)
+#define DO_LD		do { if (!uop_ld(cpu, u)) EXIT(LBL_EXC_ACCESS | U_EXC_MASK); } while (0)
+#define DO_ST		do { if (!uop_st(cpu, u)) EXIT(LBL_EXC_ACCESS | U_EXC_MASK); } while (0)
+
+/* no operands */
+#define DO_U_NOP	do { } while (0)
+#define DO_U_STOP	do { cpu->stopped = 1; EXIT(UADDR_DONE); } while (0)
+#define DO_U_COMMIT	jnl_commit(cpu)
+#define DO_U_ROLLBACK	jnl_rollback(cpu)
+
+/* imm32, dst */
+#define DO_U_IMM	(cpu->r[u->dst] = u->imm)
+
+/* cc, utarget -- flags */
+#define DO_U_BCC	do { if (bcc_taken(cpu, u)) EXIT(u->utarget); } while (0)
+
+/* src */
+#define DO_U_JMP	(cpu->r[15] = cpu->r[u->s1])
+
+/* dst
+
+   Only works correctly if the operand decoder isn't allowed to run ahead,
+   i.e., only if the decoder digests an operand, determines what microcode to
+   run, and it then gets run before the decoder looks at more operands.
+ */
+#define DO_U_READPC	(cpu->r[u->dst] = cpu->r[15])
+
+/* s1, dst -- len */
+#define DO_U_LD		DO_LD
+#define DO_U_LDI	DO_LD
+#define DO_U_LDU	DO_LD
+
+/* s1, s2 -- len */
+#define DO_U_ST		DO_ST
+#define DO_U_STI	DO_ST
+#define DO_U_STU	DO_ST
+
+/* src, dst -- width */
+#define DO_U_INC	do { if (u->dst < 16) jnl_log(cpu, u->dst, i);		\
+			     cpu->r[u->dst] += uop_width(u->width); } while (0)
+#define DO_U_DEC	do { if (u->dst < 16) jnl_log(cpu, u->dst, i);		\
+			     cpu->r[u->dst] -= uop_width(u->width); } while (0)
+#define DO_U_INDEX	(cpu->r[u->dst] = cpu->r[u->s1] * uop_width(u->width))
+
+/* s1, dst    ; s1 is a GPR with the number of a preg
+   FIXME move outside datapath_run(), merge with U_MTPR?
+ */
+#define DO_U_MFPR	(cpu->r[u->dst] = cpu->preg[cpu->r[u->s1] % ARRAY_SIZE(cpu->preg)])
+
+/* s1, dst    ; dst is a GPR with the number of a preg */
+#define DO_U_MTPR	mtpr(cpu, cpu->r[u->dst], cpu->r[u->s1])
+
+/* the ALU group, see alu() */
+#define DO_U_MOV	DO_ALU
+#define DO_U_MOVX	DO_ALU
+#define DO_U_SIGNBW	DO_ALU
+#define DO_U_SIGNBL	DO_ALU
+#define DO_U_SIGNWL	DO_ALU
+#define DO_U_ZEROBW	DO_ALU
+#define DO_U_ZEROBL	DO_ALU
+#define DO_U_ZEROWL	DO_ALU
+#define DO_U_TRUNCWB	DO_ALU
+#define DO_U_TRUNCLB	DO_ALU
+#define DO_U_TRUNCLW	DO_ALU
+#define DO_U_CMP	DO_ALU
+#define DO_U_ADD	DO_ALU
+#define DO_U_SUB	DO_ALU
+#define DO_U_MUL	DO_ALU
+#define DO_U_DIV	DO_ALU
+#define DO_U_AND	DO_ALU
+#define DO_U_BIC	DO_ALU
+#define DO_U_BIS	DO_ALU
+#define DO_U_XOR	DO_ALU
+#define DO_U_ASHL	DO_ALU
+#define DO_U_ROTL	DO_ALU
+#define DO_U_ADC	DO_ALU
+#define DO_U_SBB	DO_ALU
+#define DO_U_EMUL	DO_ALU
+#define DO_U_EDIV	DO_ALU
+#define DO_U_ASHQ	DO_ALU
+
+/* superinstructions -- the bodies in a row, u/i follow along so EXIT()
+   reports the µop that left the flow
+ */
+#define FUSE2(n, a, b)		L_FUSE2_##n: DO_##a; u++; i++; DO_##b; NEXT;
+#define FUSE3(n, a, b, c)	L_FUSE3_##n: DO_##a; u++; i++; DO_##b; u++; i++; DO_##c; NEXT;
+
+#define MATCH2(n, a, b)							\
+	if ((i+1 < uop_cnt) && (uop[i].op == a) && (uop[i+1].op == b)) {	\
+		h[i] = &&L_FUSE2_##n;					\
+		i += 2;							\
+		continue;						\
+	}
+#define MATCH3(n, a, b, c)						\
+	if ((i+2 < uop_cnt) && (uop[i].op == a) && (uop[i+1].op == b) &&	\
+	    (uop[i+2].op == c)) {						\
+		h[i] = &&L_FUSE3_##n;					\
+		i += 3;							\
+		continue;						\
+	}
+
+
+/* UADDR_DONE for "done"
+   nn for "please fetch me the µop flow starting at nn"
+
+   cpu->uidx is the index of the µop that ended the flow early (µbranch,
+   exception, stop).
+
+   h[] has the handlers for uop[] (see datapath_resolve()), it isn't used by
+   the switch version.  With cpu == NULL, datapath_run() just fills in h[].
+ */
+static int datapath_run(struct cpu *cpu, int uop_cnt, const struct uop uop[uop_cnt],
+                        const void *h[uop_cnt+1])
+{
+#ifdef DATAPATH_SWITCH
+	(void) h;
+
+	if (!cpu)
+		return UADDR_DONE;
+
+	for (int i=0; i < uop_cnt; i++) {
+		const struct uop	*u = &uop[i];
+
+		/* µcode is never allowed to refer to r15/PC directly */
+		assert(uop_no_pc(u));
+
+		switch (u->op) {
+#else
+	static const void *const handler[] = {
+		[U_NOP]     = &&L_U_NOP,	[U_STOP]    = &&L_U_STOP,
+		[U_COMMIT]  = &&L_U_COMMIT,	[U_ROLLBACK]= &&L_U_ROLLBACK,
+		[U_IMM]     = &&L_U_IMM,	[U_BCC]     = &&L_U_BCC,
+		[U_JMP]     = &&L_U_JMP,	[U_READPC]  = &&L_U_READPC,
+		[U_LD]      = &&L_U_LD,		[U_LDI]     = &&L_U_LDI,
+		[U_LDU]     = &&L_U_LDU,	[U_ST]      = &&L_U_ST,
+		[U_STI]     = &&L_U_STI,	[U_STU]     = &&L_U_STU,
+		[U_INC]     = &&L_U_INC,	[U_DEC]     = &&L_U_DEC,
+		[U_INDEX]   = &&L_U_INDEX,	[U_MFPR]    = &&L_U_MFPR,
+		[U_MTPR]    = &&L_U_MTPR,
+		[U_MOV]     = &&L_ALU,		[U_MOVX]    = &&L_ALU,
+		[U_SIGNBW]  = &&L_ALU,		[U_SIGNBL]  = &&L_ALU,
+		[U_SIGNWL]  = &&L_ALU,		[U_ZEROBW]  = &&L_ALU,
+		[U_ZEROBL]  = &&L_ALU,		[U_ZEROWL]  = &&L_ALU,
+		[U_TRUNCWB] = &&L_ALU,		[U_TRUNCLB] = &&L_ALU,
+		[U_TRUNCLW] = &&L_ALU,		[U_CMP]     = &&L_ALU,
+		[U_ADD]     = &&L_ALU,		[U_SUB]     = &&L_ALU,
+		[U_MUL]     = &&L_ALU,		[U_DIV]     = &&L_ALU,
+		[U_AND]     = &&L_ALU,		[U_BIC]     = &&L_ALU,
+		[U_BIS]     = &&L_ALU,		[U_XOR]     = &&L_ALU,
+		[U_ASHL]    = &&L_ALU,		[U_ROTL]    = &&L_ALU,
+		[U_ADC]     = &&L_ALU,		[U_SBB]     = &&L_ALU,
+		[U_EMUL]    = &&L_ALU,		[U_EDIV]    = &&L_ALU,
+		[U_ASHQ]    = &&L_ALU,
+	};
+
+	if (!cpu) {
+		for (int i=0; i < uop_cnt; i++) {
+			unsigned	op = uop[i].op;
+
+			/* µcode is never allowed to refer to r15/PC directly */
+			assert(uop_no_pc(&uop[i]));
+
+			h[i] = ((op < ARRAY_SIZE(handler)) && handler[op]) ? handler[op] : &&L_DEFAULT;
+		}
+		h[uop_cnt] = &&L_DONE;
+
+		/* superinstructions -- the first µop of a fused sequence gets
+		   the fused handler, the handlers of the others aren't used.
+		   Triples before pairs.
+		 */
+		for (int i=0; i < uop_cnt; ) {
+			UFUSE_TRIPLES(MATCH3)
+			UFUSE_PAIRS(MATCH2)
+			i++;
+		}
+		return UADDR_DONE;
+	}
+
+	int		i = 0;
+	const struct uop	*u = &uop[0];
+
+	goto *h[0];
+
+	{
+		{
+#endif
+		OP(U_NOP):	DO_U_NOP;	NEXT;
+		OP(U_STOP):	DO_U_STOP;	NEXT;
+		OP(U_COMMIT):	DO_U_COMMIT;	NEXT;
+		OP(U_ROLLBACK):	DO_U_ROLLBACK;	NEXT;
+		OP(U_IMM):	DO_U_IMM;	NEXT;
+		OP(U_BCC):	DO_U_BCC;	NEXT;
+		OP(U_JMP):	DO_U_JMP;	NEXT;
+		OP(U_READPC):	DO_U_READPC;	NEXT;
+
+		OP(U_LD):
+		OP(U_LDI):
+		OP(U_LDU):	DO_LD;		NEXT;
+		OP(U_ST):
+		OP(U_STI):
+		OP(U_STU):	DO_ST;		NEXT;
+
+		OP(U_INC):	DO_U_INC;	NEXT;
+		OP(U_DEC):	DO_U_DEC;	NEXT;
+		OP(U_INDEX):	DO_U_INDEX;	NEXT;
+
+		/* The entire ALU group is handled outside this switch for
+		   both readability reasons and in order to be nice to the
+		   compiler.  Not all compilers tolerate big functions equally
+		   well.
+		 */
+#ifdef DATAPATH_SWITCH
+		case U_MOV:
+		case U_MOVX:
+		case U_SIGNBW:
+		case U_SIGNBL:
+		case U_SIGNWL:
+		case U_ZEROBW:
+		case U_ZEROBL:
+		case U_ZEROWL:
+		case U_TRUNCWB:
+		case U_TRUNCLB:
+		case U_TRUNCLW:
+		case U_CMP:
+		case U_ADD:
+		case U_SUB:
+		case U_MUL:
+		case U_DIV:
+		case U_AND:
+		case U_BIC:
+		case U_BIS:
+		case U_XOR:
+		case U_ASHL:
+		case U_ROTL:
+		case U_ADC:
+		case U_SBB:
+		case U_EMUL:
+		case U_EDIV:
+		case U_ASHQ:
+#else
+		L_ALU:
+#endif
+				DO_ALU;		NEXT;
+
+		OP(U_MFPR):	DO_U_MFPR;	NEXT;
+		OP(U_MTPR):	DO_U_MTPR;	NEXT;
+
+#ifndef DATAPATH_SWITCH
+		UFUSE_PAIRS(FUSE2)
+		UFUSE_TRIPLES(FUSE3)
+#endif
+
+		OP_DEFAULT:
+			printf("#%3d", u->op);
+			NEXT;
+		}
+	}
+#ifndef DATAPATH_SWITCH
+L_DONE:
+#endif
+	cpu->uidx = uop_cnt;
+	return UADDR_DONE;
+}
+
+#undef OP
+#undef OP_DEFAULT
+#undef NEXT
+#undef EXIT
+#undef FUSE2
+#undef FUSE3
+#undef MATCH2
+#undef MATCH3
+
+
+/* resolve the handlers for a flow -- h[] has room for uop_cnt+1 entries */
+static void datapath_resolve(int uop_cnt, const struct uop uop[uop_cnt], const void *h[uop_cnt+1])
+{
+	datapath_run(NULL, uop_cnt, uop, h);
+}
+
+
+/* run a flow that hasn't been resolved */
+static int datapath(struct cpu *cpu, int uop_cnt, const struct uop uop[uop_cnt])
+{
+	int	utarget;
+
+#ifdef DATAPATH_SWITCH
+	utarget = datapath_run(cpu, uop_cnt, uop, NULL);
+#else
+	const void	*h[uop_cnt+1];
+
+	datapath_resolve(uop_cnt, uop, h);
+	utarget = datapath_run(cpu, uop_cnt, uop, h);
+#endif
+	if (uprof)
+		uprof_flow(cpu, uop_cnt, uop);
+	return utarget;
+}
+
+
+/* JIT -- hot traces are compiled to x86-64 code
+
+   A trace that has been run JIT_HOT times gets compiled.  The code works on
+   the same struct cpu as the datapath: the simple µops (imm, inc/dec/index,
+   jmp, stop, unconditional µbranches) are done inline on cpu->r[], the rest
+   are calls to small helpers that take the packed µop by value -- the ALU
+   has to go through alu() anyway because of the lazy flags.  Anything the
+   JIT doesn't know about is a call to datapath() with just that µop.
+
+   The compiled code behaves exactly like datapath_run(): UADDR_DONE, or the
+   µbranch/exception target with cpu->uidx set to the µop that caused it, so
+   run_trace() handles side exits the same way for both.
+
+   Only for x86-64 with GNU C (-DNO_JIT turns it off).  The code lives in one
+   mmap()'ed RWX area that is filled from the bottom and thrown away as a
+   whole when it is full.  If the mapping can't be made, traces are simply
+   never compiled.
+ */
+#define JIT_HOT		50			/* trace runs before compiling it */
+#define JIT_CODESZE	(4 * 1024 * 1024)
+#define JIT_MAXUOP	56			/* bytes of code per µop, at most */
+#define JIT_MAXEXTRA	32			/* prologue + epilogue */
+
+struct jit {
+	uint8_t	*code;
+	size_t	 used;
+	uint8_t	*p;		/* emit pointer */
+
+	long	 blocks, flushes;
+};
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(NO_JIT)
+
+static void jit_init(struct cpu *cpu)
+{
+	void	*code = mmap(NULL, JIT_CODESZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (code == MAP_FAILED)
+		return;
+
+	cpu->jit = calloc(1, sizeof(struct jit));
+	if (!cpu->jit) {
+		fprintf(stderr, "jit_init(), out of memory.\n");
+		exit(1);
+	}
+	cpu->jit->code = code;
+}
+
+
+/* throw all the code away -- no compiled code may be running */
+static void jit_flush(struct cpu *cpu)
+{
+	cpu->jit->used = 0;
+	cpu->jit->flushes++;
+
+	for (int i=0; i < TC_CNT; i++) {
+		cpu->tcache->e[i].jit   = NULL;
+		cpu->tcache->e[i].execs = 0;
+	}
+}
+
+
+/* helpers -- UADDR_DONE or the target, like datapath_run() */
+static int jit_alu(struct cpu *cpu, struct uop u)
+{
+	int	exc = alu(cpu, u);
+
+	return exc ? exc : UADDR_DONE;
+}
+
+
+static int jit_ld(struct cpu *cpu, struct uop u)
+{
+	return uop_ld(cpu, &u) ? UADDR_DONE : (LBL_EXC_ACCESS | U_EXC_MASK);
+}
+
+
+static int jit_st(struct cpu *cpu, struct uop u)
+{
+	return uop_st(cpu, &u) ? UADDR_DONE : (LBL_EXC_ACCESS | U_EXC_MASK);
+}
+
+
+static int jit_bcc(struct cpu *cpu, struct uop u)
+{
+	return match_cc(flags_get(cpu, u.flags, cc_need[u.cc]), u.cc) ? (int) u.utarget : UADDR_DONE;
+}
+
+
+static int jit_uop(struct cpu *cpu, struct uop u)
+{
+	return datapath(cpu, 1, &u);
+}
+
+
+/* emitters -- rbx is the struct cpu pointer, eax the return value */
+static void jit_u8(struct jit *j, uint8_t x)
+{
+	*j->p++ = x;
+}
+
+
+static void jit_u32(struct jit *j, uint32_t x)
+{
+	memcpy(j->p, &x, 4);
+	j->p += 4;
+}
+
+
+static void jit_u64(struct jit *j, uint64_t x)
+{
+	memcpy(j->p, &x, 8);
+	j->p += 8;
+}
+
+
+/* op, modrm [rbx+disp32] */
+static void jit_rbx(struct jit *j, uint8_t op, uint8_t modrm, size_t disp)
+{
+	jit_u8(j, op);
+	jit_u8(j, modrm);
+	jit_u32(j, disp);
+}
+
+#define JIT_R(n)	(offsetof(struct cpu, r) + 4 * (n))
+
+
+/* jnl_log(cpu, n, k) */
+static void jit_jnl(struct jit *j, int n, int k)
+{
+	size_t	cnt = offsetof(struct cpu, jnl_cnt);
+	size_t	jnl = offsetof(struct cpu, jnl);
+
+	jit_rbx(j, 0x8B, 0x83, cnt);				/* mov eax, [cnt]         */
+	jit_u8(j, 0x8D); jit_u8(j, 0x48); jit_u8(j, 0x01);	/* lea ecx, [rax+1]       */
+	jit_rbx(j, 0x89, 0x8B, cnt);				/* mov [cnt], ecx         */
+	jit_u8(j, 0x83); jit_u8(j, 0xE0); jit_u8(j, JNL_CNT-1);	/* and eax, JNL_CNT-1     */
+	jit_rbx(j, 0x8B, 0x8B, JIT_R(n));			/* mov ecx, [rN]          */
+	jit_u8(j, 0x89); jit_u8(j, 0x8C); jit_u8(j, 0xC3);	/* mov [jnl+rax*8], ecx   */
+	jit_u32(j, jnl + offsetof(struct jnl_entry, val));
+	jit_u8(j, 0xC7); jit_u8(j, 0x84); jit_u8(j, 0xC3);	/* mov [jnl+rax*8+4], k/n */
+	jit_u32(j, jnl + offsetof(struct jnl_entry, idx));
+	jit_u32(j, (uint32_t) k | ((uint32_t) n << 16));
+}
+
+
+/* mov [cpu->uidx], k; pop rbx; ret */
+static void jit_exit(struct jit *j, int k)
+{
+	jit_rbx(j, 0xC7, 0x83, offsetof(struct cpu, uidx));
+	jit_u32(j, k);
+	jit_u8(j, 0x5B);
+	jit_u8(j, 0xC3);
+}
+
+
+/* helper(cpu, *u), leave at µop k unless it returned UADDR_DONE */
+static void jit_call(struct jit *j, int (*helper)(struct cpu *, struct uop),
+                     const struct uop *u, int k)
+{
+	uint64_t	imm;
+
+	memcpy(&imm, u, sizeof(imm));
+
+	jit_u8(j, 0x48); jit_u8(j, 0x89); jit_u8(j, 0xDF);	/* mov rdi, rbx      */
+	jit_u8(j, 0x48); jit_u8(j, 0xBE); jit_u64(j, imm);	/* mov rsi, imm64    */
+	jit_u8(j, 0x48); jit_u8(j, 0xB8);			/* mov rax, helper   */
+	jit_u64(j, (uint64_t) (uintptr_t) helper);
+	jit_u8(j, 0xFF); jit_u8(j, 0xD0);			/* call rax          */
+
+	jit_u8(j, 0x3D); jit_u32(j, UADDR_DONE);		/* cmp eax, DONE     */
+	jit_u8(j, 0x74); jit_u8(j, 12);				/* je past the exit  */
+	jit_exit(j, k);
+}
+
+
+/* compile a flow, NULL if there is no JIT */
+static int (*jit_compile(struct cpu *cpu, int uop_cnt, const struct uop uop[uop_cnt]))(struct cpu *)
+{
+	struct jit	*j = cpu->jit;
+
+	if (!j)
+		return NULL;
+
+	assert(sizeof(struct uop) == 8);
+	assert(sizeof(struct jnl_entry) == 8);
+	if (j->used + uop_cnt * JIT_MAXUOP + JIT_MAXEXTRA > JIT_CODESZE)
+		jit_flush(cpu);
+
+	uint8_t	*start = j->code + j->used;
+
+	j->p = start;
+	jit_u8(j, 0x53);					/* push rbx          */
+	jit_u8(j, 0x48); jit_u8(j, 0x89); jit_u8(j, 0xFB);	/* mov rbx, rdi      */
+
+	for (int i=0; i < uop_cnt; i++) {
+		const struct uop	*u = &uop[i];
+
+		/* µcode is never allowed to refer to r15/PC directly */
+		assert(uop_no_pc(u));
+
+		switch (u->op) {
+		case U_NOP:
+			break;
+		case U_STOP:
+			jit_rbx(j, 0xC7, 0x83, offsetof(struct cpu, stopped));
+			jit_u32(j, 1);
+			jit_u8(j, 0xB8); jit_u32(j, UADDR_DONE);	/* mov eax, DONE */
+			jit_exit(j, i);
+			break;
+
+		case U_IMM:
+			jit_rbx(j, 0xC7, 0x83, JIT_R(u->dst));		/* mov [rN], imm */
+			jit_u32(j, u->imm);
+			break;
+
+		case U_BCC:
+			switch (u->cc) {
+			case U_CC_ALWAYS:
+				jit_u8(j, 0xB8); jit_u32(j, u->utarget);	/* mov eax, utarget */
+				jit_exit(j, i);
+				break;
+			case U_CC_CC:
+			case U_CC_CALL:
+			case U_CC_RET:
+				jit_call(j, jit_uop, u, i);
+				break;
+			default:
+				jit_call(j, jit_bcc, u, i);
+			}
+			break;
+
+		case U_JMP:
+			jit_rbx(j, 0x8B, 0x83, JIT_R(u->s1));		/* mov eax, [rN]  */
+			jit_rbx(j, 0x89, 0x83, JIT_R(15));		/* mov [r15], eax */
+			break;
+
+		case U_LD:
+		case U_LDI:
+		case U_LDU:
+			jit_call(j, jit_ld, u, i);
+			break;
+		case U_ST:
+		case U_STI:
+		case U_STU:
+			jit_call(j, jit_st, u, i);
+			break;
+
+		case U_INC:
+		case U_DEC:
+			if (u->dst < 16)
+				jit_jnl(j, u->dst, i);
+			if (u->op == U_INC)
+				jit_rbx(j, 0x81, 0x83, JIT_R(u->dst));	/* add [rN], imm */
+			else
+				jit_rbx(j, 0x81, 0xAB, JIT_R(u->dst));	/* sub [rN], imm */
+			jit_u32(j, uop_width(u->width));
+			break;
+		case U_INDEX:
+			jit_rbx(j, 0x8B, 0x83, JIT_R(u->s1));		/* mov eax, [rN]  */
+			jit_u8(j, 0xC1); jit_u8(j, 0xE0);		/* shl eax, log2  */
+			jit_u8(j, __builtin_ctz(uop_width(u->width)));
+			jit_rbx(j, 0x89, 0x83, JIT_R(u->dst));		/* mov [rN], eax  */
+			break;
+
+		case U_MOV:
+		case U_MOVX:
+		case U_SIGNBW:
+		case U_SIGNBL:
+		case U_SIGNWL:
+		case U_ZEROBW:
+		case U_ZEROBL:
+		case U_ZEROWL:
+		case U_TRUNCWB:
+		case U_TRUNCLB:
+		case U_TRUNCLW:
+		case U_CMP:
+		case U_ADD:
+		case U_SUB:
+		case U_MUL:
+		case U_DIV:
+		case U_AND:
+		case U_BIC:
+		case U_BIS:
+		case U_XOR:
+		case U_ASHL:
+		case U_ROTL:
+		case U_ADC:
+		case U_SBB:
+		case U_EMUL:
+		case U_EDIV:
+		case U_ASHQ:
+			jit_call(j, jit_alu, u, i);
+			break;
+
+		default:
+			jit_call(j, jit_uop, u, i);
+		}
+	}
+
+	jit_u8(j, 0xB8); jit_u32(j, UADDR_DONE);		/* mov eax, DONE */
+	jit_exit(j, uop_cnt);
+
+	assert(j->p - start <= uop_cnt * JIT_MAXUOP + JIT_MAXEXTRA);
+	j->used += j->p - start;
+	j->blocks++;
+
+	return (int (*)(struct cpu *)) start;
+}
+
+#else
+
+static void jit_init(struct cpu *cpu)
+{
+	(void) cpu;
+}
+
+
+static int (*jit_compile(struct cpu *cpu, int uop_cnt, const struct uop uop[uop_cnt]))(struct cpu *)
+{
+	(void) cpu;
+	(void) uop;
+	return NULL;
+}
+
+#endif
+
+
+/* start at a µaddr, fetch a basic block, execute it, if there was a branch,
+   fetch a new basic block and repeat.
+
+   utarget is a taken µbranch in the exe phase of the instruction with dflow
+   f, npc is the address of the next instruction.  UADDR_DONE or an
+   exception.
+ */
+static int run_branch(struct cpu *cpu, const struct dflow *f, uint32_t npc, int utarget)
+{
+	struct uop	buf[MAXFLOWLEN];
+
+	while ((utarget != UADDR_DONE) && !(utarget & U_EXC_MASK)) {
+		int	cnt = decode_branch(f, npc, utarget, ARRAY_SIZE(buf), buf);
+
+		if (cnt < 0)
+			return LBL_EXC_RESERVED | U_EXC_MASK;
+
+		int	next = datapath(cpu, cnt, buf);
+
+		if (stats)
+			stats_branch(utarget, uran(cpu, cnt));
+		utarget = next;
+	}
+	return utarget;
+}
+
+
+/* the exe flow of di is the first basic block */
+static int run_flow(struct cpu *cpu, struct dinstr *di)
+{
+	struct uop	*flow    = di->uop + di->f.cnt[PH_PRE];
+	int		 cnt     = di->f.cnt[PH_EXE];
+	int		 utarget = datapath(cpu, cnt, flow);
+
+	if (stats)
+		stats_tmpl(di->tmpl, di->f.cnt[PH_PRE], uran(cpu, cnt));
+	return run_branch(cpu, &di->f, di->pc + di->len, utarget);
+}
+
+
+/* interrupt requests and the trace flag are looked at by cpu_run() (see
+   events_run()), once per trace or per instruction run on its own.
+
+   fetch instruction
+   decode-opcode, figure out stuff
+   decode-operand, fetch basic block, run it, fetch new basic block if branch/exception, ...
+   decode next operand until we are done (or we get an exception)
+   write result(s) (if we didn't get an exception)
+
+   did we request an exception?  I think this is for faults only -- INTO, DIV0
+
+   Do we do the stack stuff and jmp to the exception vector here or do we wait
+   until the next time we get called?
+
+   0 or the µaddr of an exception.  PC points to the next instruction unless
+   the instruction changed it.
+ */
+static int run_instruction(struct cpu *cpu, struct dinstr *di)
+{
+	int	utarget;
+
+	cpu->r[15] = di->pc + di->len;
+
+	utarget = datapath(cpu, di->f.cnt[PH_PRE], di->uop);
+	if (stats)
+		stats_tmpl(di->tmpl, 0, uran(cpu, di->f.cnt[PH_PRE]));
+	if (utarget != UADDR_DONE)
+		return utarget;
+
+	utarget = run_flow(cpu, di);
+	if (utarget != UADDR_DONE)
+		return utarget;
+	if (cpu->stopped)
+		return 0;
+
+	struct uop	*post = di->uop + di->f.cnt[PH_PRE] + di->f.cnt[PH_EXE];
+
+	utarget = datapath(cpu, di->f.cnt[PH_POST], post);
+	if (stats)
+		stats_tmpl(di->tmpl, di->f.cnt[PH_PRE] + di->f.cnt[PH_EXE], uran(cpu, di->f.cnt[PH_POST]));
+	if (utarget != UADDR_DONE)
+		return utarget;
+	return 0;
+}
+
+
+/* --stats for the instructions of a trace, up to where it stopped */
+static void stats_trace(struct cpu *cpu, struct trace *tr, int utarget)
+{
+	int	end = (utarget == UADDR_DONE) ? tr->cnt : cpu->uidx + 1;
+
+	for (int k=0; (k < tr->icnt) && (tr->instr[k].pre < end); k++) {
+		int	stop = (end < tr->instr[k].end) ? end : tr->instr[k].end;
+
+		stats_tmpl(tr->instr[k].tmpl, 0, stop - tr->instr[k].pre);
+	}
+}
+
+
+/* run a trace -- 0 or the µaddr of an exception
+
+   *pc is the instruction that took the exception.
+ */
+static int run_trace(struct cpu *cpu, struct trace *tr, uint32_t *pc)
+{
+	int	utarget;
+
+	cpu->r[15] = tr->end;
+
+	if (!tr->jit && (++tr->execs == JIT_HOT))
+		tr->jit = jit_compile(cpu, tr->cnt, tr->uop);
+
+	utarget = tr->jit ? tr->jit(cpu) : datapath_run(cpu, tr->cnt, tr->uop, tr->h);
+	if (uprof)
+		uprof_flow(cpu, tr->cnt, tr->uop);
+	if (stats)
+		stats_trace(cpu, tr, utarget);
+	if (utarget == UADDR_DONE) {
+		cpu->tcache->instrs += tr->icnt;
+		cpu->clock          += tr->icnt;
+		return 0;
+	}
+
+	/* side exit -- which instruction? */
+	int	k = 0;
+
+	while (cpu->uidx >= tr->instr[k].end)
+		k++;
+	cpu->tcache->instrs += k;
+	cpu->clock          += k;
+	jnl_keep(cpu, k ? tr->instr[k-1].end : 0);
+
+	*pc        = tr->instr[k].pc;
+	cpu->r[15] = tr->instr[k].pc + tr->instr[k].len;
+
+	if ((utarget & U_EXC_MASK) || (cpu->uidx < tr->instr[k].exe) || (cpu->uidx >= tr->instr[k].post))
+		return utarget;
+
+	/* µbranch in the exe phase, finish the instruction */
+	utarget = run_branch(cpu, &tr->instr[k].f, cpu->r[15], utarget);
+	if (utarget != UADDR_DONE)
+		return utarget;
+	cpu->tcache->instrs++;
+	cpu->clock++;
+	if (cpu->stopped)
+		return 0;
+
+	struct uop	*post = tr->uop + tr->instr[k].post;
+	int		 cnt  = tr->instr[k].end - tr->instr[k].post;
+
+	utarget = datapath(cpu, cnt, post);
+	if (stats)
+		stats_tmpl(tr->instr[k].tmpl, tr->instr[k].post - tr->instr[k].pre, uran(cpu, cnt));
+	if (utarget != UADDR_DONE)
+		return utarget;
+
+	/* the rest of the trace isn't run, the next one starts at r15 */
+	return 0;
+}
+
+
+/* faults undo the autoinc/dec of the instruction, traps keep them */
+static void exc_regs(struct cpu *cpu, int exc)
+{
+	switch (exc & ~U_EXC_MASK) {
+	case LBL_EXC_INTO:
+	case LBL_EXC_INT_DIV_BY_ZERO:
+	case LBL_EXC_SUBSCRIPT_RANGE:
+		jnl_commit(cpu);
+		break;
+	default:
+		jnl_rollback(cpu);
+	}
+}
+
+
+/* the µcode engine, one instruction on its own (bytes from ifetch()) --
+   0 or the µaddr of an exception.  *len is the length of the instruction.
+ */
+static int ucode_instruction(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail, int *len)
+{
+	struct dinstr	*di;
+	int		 exc;
+
+	if (cpu->ra)
+		exc = ra_next(cpu, pc, b, avail, &di);
+	else
+		exc = avail ? decode_cached(cpu, pc, b, avail, &di) : fetch_fault(cpu);
+	if (exc)
+		return exc;
+
+	*len = di->len;
+	exc  = run_instruction(cpu, di);
+	if (di->f.wpsl)
+		events_update(cpu);
+	return exc;
+}
+
+
+/* direct interpreter -- revax-sim --engine fast
+
+   Runs VAX instructions straight from the bytes: op_cnt[], ops[] and
+   op_width[] from vax-instr.h say what the operands are, op_sim() takes the
+   specifiers apart, and a switch on fx_op[] does the work.  No templates,
+   no µops, no decode cache.
+
+   It shares struct cpu with the µcode engine -- the registers, the lazy
+   flags (lf_record()), memory and the TLBs, the autoinc/dec journal -- so
+   cpu->engine can change between any two instructions.  It only knows the
+   integer instructions that have µcode flows, plus the loop branches.
+   FX_NONE instructions are handed to the µcode engine.
+
+   The semantics are the architecture's (tables/instr.snip), not a copy of
+   what the µcode does.  That is what makes --engine lockstep a check of the
+   µcode.
+ */
+#define ENG_UCODE	0
+#define ENG_FAST	1
+#define ENG_LOCKSTEP	2
+
+#define FX_UCODE	-1	/* not here -- the µcode engine has to run it */
+
+enum {
+	FX_NONE,
+	FX_HALT, FX_NOP,
+	FX_ADD, FX_SUB, FX_MUL, FX_DIV, FX_BIC, FX_BIS, FX_XOR,
+	FX_ASHL, FX_ROTL, FX_ADWC, FX_SBWC,
+	FX_CLR, FX_INC, FX_DEC, FX_CMP, FX_TST,
+	FX_MOV, FX_MCOM, FX_MNEG, FX_CVT, FX_MOVZ, FX_MOVA, FX_PUSHL, FX_PUSHA,
+	FX_BCC, FX_BR, FX_JMP, FX_BSB, FX_JSB, FX_RSB,
+	FX_BLBS, FX_BLBC, FX_AOBLSS, FX_AOBLEQ, FX_SOBGEQ, FX_SOBGTR,
+};
+
+/* by opcode -- the two-byte opcodes are all FX_NONE */
+static const uint8_t	fx_op[256] = {
+	/* HALT NOP RSB */
+	[0x00] = FX_HALT,	[0x01] = FX_NOP,	[0x05] = FX_RSB,
+
+	/* BSBB BRB Bcc JSB JMP BSBW BRW */
+	[0x10] = FX_BSB,	[0x11] = FX_BR,		[0x12] = FX_BCC,	[0x13] = FX_BCC,
+	[0x14] = FX_BCC,	[0x15] = FX_BCC,	[0x16] = FX_JSB,	[0x17] = FX_JMP,
+	[0x18] = FX_BCC,	[0x19] = FX_BCC,	[0x1A] = FX_BCC,	[0x1B] = FX_BCC,
+	[0x1C] = FX_BCC,	[0x1D] = FX_BCC,	[0x1E] = FX_BCC,	[0x1F] = FX_BCC,
+	[0x30] = FX_BSB,	[0x31] = FX_BR,
+
+	/* CVTWL CVTWB MOVZWL MOVAW PUSHAW ADAWI ASHL CLRQ MOVQ MOVAQ PUSHAQ */
+	[0x32] = FX_CVT,	[0x33] = FX_CVT,	[0x3C] = FX_MOVZ,	[0x3E] = FX_MOVA,
+	[0x3F] = FX_PUSHA,	[0x58] = FX_ADD,	[0x78] = FX_ASHL,	[0x7C] = FX_CLR,
+	[0x7D] = FX_MOV,	[0x7E] = FX_MOVA,	[0x7F] = FX_PUSHA,
+
+	/* ADDx2 ADDx3 SUBx2 SUBx3 MULx2 MULx3 DIVx2 DIVx3 BISx2 BISx3 BICx2 BICx3
+	   XORx2 XORx3 MNEGx -- bytes, words, longwords
+	 */
+	[0x80] = FX_ADD,	[0x81] = FX_ADD,	[0x82] = FX_SUB,	[0x83] = FX_SUB,
+	[0x84] = FX_MUL,	[0x85] = FX_MUL,	[0x86] = FX_DIV,	[0x87] = FX_DIV,
+	[0x88] = FX_BIS,	[0x89] = FX_BIS,	[0x8A] = FX_BIC,	[0x8B] = FX_BIC,
+	[0x8C] = FX_XOR,	[0x8D] = FX_XOR,	[0x8E] = FX_MNEG,
+
+	[0xA0] = FX_ADD,	[0xA1] = FX_ADD,	[0xA2] = FX_SUB,	[0xA3] = FX_SUB,
+	[0xA4] = FX_MUL,	[0xA5] = FX_MUL,	[0xA6] = FX_DIV,	[0xA7] = FX_DIV,
+	[0xA8] = FX_BIS,	[0xA9] = FX_BIS,	[0xAA] = FX_BIC,	[0xAB] = FX_BIC,
+	[0xAC] = FX_XOR,	[0xAD] = FX_XOR,	[0xAE] = FX_MNEG,
+
+	[0xC0] = FX_ADD,	[0xC1] = FX_ADD,	[0xC2] = FX_SUB,	[0xC3] = FX_SUB,
+	[0xC4] = FX_MUL,	[0xC5] = FX_MUL,	[0xC6] = FX_DIV,	[0xC7] = FX_DIV,
+	[0xC8] = FX_BIS,	[0xC9] = FX_BIS,	[0xCA] = FX_BIC,	[0xCB] = FX_BIC,
+	[0xCC] = FX_XOR,	[0xCD] = FX_XOR,	[0xCE] = FX_MNEG,
+
+	/* MOVx CMPx MCOMx CLRx TSTx INCx DECx -- bytes, words, longwords */
+	[0x90] = FX_MOV,	[0x91] = FX_CMP,	[0x92] = FX_MCOM,	[0x94] = FX_CLR,
+	[0x95] = FX_TST,	[0x96] = FX_INC,	[0x97] = FX_DEC,
+
+	[0xB0] = FX_MOV,	[0xB1] = FX_CMP,	[0xB2] = FX_MCOM,	[0xB4] = FX_CLR,
+	[0xB5] = FX_TST,	[0xB6] = FX_INC,	[0xB7] = FX_DEC,
+
+	[0xD0] = FX_MOV,	[0xD1] = FX_CMP,	[0xD2] = FX_MCOM,	[0xD4] = FX_CLR,
+	[0xD5] = FX_TST,	[0xD6] = FX_INC,	[0xD7] = FX_DEC,
+
+	/* CVTBL CVTBW MOVZBW MOVZBL ROTL MOVAB PUSHAB */
+	[0x98] = FX_CVT,	[0x99] = FX_CVT,	[0x9A] = FX_MOVZ,	[0x9B] = FX_MOVZ,
+	[0x9C] = FX_ROTL,	[0x9E] = FX_MOVA,	[0x9F] = FX_PUSHA,
+
+	/* ADWC SBWC PUSHL MOVAL PUSHAL */
+	[0xD8] = FX_ADWC,	[0xD9] = FX_SBWC,	[0xDD] = FX_PUSHL,	[0xDE] = FX_MOVA,
+	[0xDF] = FX_PUSHA,
+
+	/* BLBS BLBC AOBLSS AOBLEQ SOBGEQ SOBGTR CVTLB CVTLW */
+	[0xE8] = FX_BLBS,	[0xE9] = FX_BLBC,	[0xF2] = FX_AOBLSS,	[0xF3] = FX_AOBLEQ,
+	[0xF4] = FX_SOBGEQ,	[0xF5] = FX_SOBGTR,	[0xF6] = FX_CVT,	[0xF7] = FX_CVT,
+};
+
+struct fx_opnd {
+	int		reg;		/* register mode: Rn, -1 otherwise */
+	uint32_t	va;		/* memory operands */
+	uint32_t	lo, hi;		/* value (r/m), address (a), target (b) */
+};
+
+
+/* 0 or an exception */
+static int fx_load(struct cpu *cpu, uint32_t va, int len, uint32_t *lo, uint32_t *hi)
+{
+	int	err;
+
+	*hi = 0;
+	return access(cpu, MODE_READ, va, len, lo, hi, &err) ? 0 : LBL_EXC_ACCESS | U_EXC_MASK;
+}
+
+
+static int fx_store(struct cpu *cpu, uint32_t va, int len, uint32_t lo, uint32_t hi)
+{
+	uint32_t	olo = 0, ohi = 0;
+	int		err;
+
+	/* --engine lockstep takes the write back afterwards */
+	if (ls && fx_load(cpu, va, len, &olo, &ohi))
+		return LBL_EXC_ACCESS | U_EXC_MASK;
+	if (!access(cpu, MODE_WRITE, va, len, &lo, &hi, &err))
+		return LBL_EXC_ACCESS | U_EXC_MASK;
+	if (trc && !ls)
+		trc_store(va, len, lo, hi);
+	if (ls)
+		ls_store(va, len, lo, hi, olo, ohi);
+	return 0;
+}
+
+
+/* The fast engine logs every autoinc/dec as µop 0.  That is only good enough
+   because it never calls jnl_keep() -- each instruction is committed or
+   rolled back on its own.
+ */
+static int fx_push(struct cpu *cpu, uint32_t val)
+{
+	jnl_log(cpu, 14, 0);	/* µop 0, see above */
+	cpu->r[14] -= 4;
+	return fx_store(cpu, cpu->r[14], 4, val, 0);
+}
+
+
+/* a memory operand at va (index included) -- 0 or an exception */
+static int fx_mem(struct cpu *cpu, char acc, int width, uint32_t va, struct fx_opnd *o)
+{
+	o->va = va;
+	if (acc == 'a')
+		o->lo = va;
+	else if ((acc == 'r') || (acc == 'm'))
+		return fx_load(cpu, va, width, &o->lo, &o->hi);
+	return 0;
+}
+
+
+/* operand i of op, its specifier (or displacement) is at b[*idx] -- 0 or an
+   exception.  r/m operands are read, autoinc/dec go in the journal.
+ */
+static int fx_operand(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail, int *idx,
+                      int op, int i, struct fx_opnd *o)
+{
+	char		 acc   = ops[op][i*3];
+	int		 width = op_width[op][i];
+	uint8_t		*spec  = (uint8_t *) b + *idx;
+
+	o->reg = -1;
+	o->hi  = 0;
+
+	if (acc == 'b') {
+		int	n = (ops[op][i*3+1] == 'b') ? 1 : 2;
+
+		if (*idx + n > avail)
+			return fetch_fault(cpu);
+		*idx += n;
+		o->lo = pc + *idx + ((n == 1) ? B(spec[0]) : W(spec[0]));
+		return 0;
+	}
+
+	/* op_sim() and op_val() may look at up to MAX_OPLEN bytes, ifetch()
+	   guarantees that they are there.
+	 */
+	struct fields	f;
+	struct sim_ret	r;
+
+	memset(&f, 0xFF, sizeof(f));
+	r = op_sim(spec, &f, width, op_ifp[op][i]);
+	if (r.cnt <= 0)
+		return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+	if (*idx + r.cnt > avail)
+		return fetch_fault(cpu);
+	if (!op_val(spec, width))
+		return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+	*idx += r.cnt;
+
+	uint32_t	npc = pc + *idx;	/* PC-relative modes */
+	uint32_t	x   = (f.Rx >= 0) ? cpu->r[f.Rx] * width : 0;
+	uint32_t	va, tmp;
+	int		exc;
+
+	switch (r.cl) {
+	case CLASS_IMM:
+		if (acc != 'r')
+			return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+		o->lo = f.imm.val[0];
+		o->hi = f.imm.val[1];
+		return 0;
+
+	case CLASS_REG:
+		if (acc == 'a')
+			return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+		o->reg = f.Rn;
+		o->lo  = cpu->r[f.Rn];
+		o->hi  = (width == 8) ? cpu->r[(f.Rn + 1) & 15] : 0;
+		return 0;
+
+	case LBL_ADDR__RN_:			/* (Rn) */
+	case LBL_ADDR__RN_______XINDEX_RX__:
+		va = cpu->r[f.Rn];
+		break;
+
+	/* jnl_log(..., 0) is fine here only because nothing calls jnl_keep()
+	   on the fast engine's entries, see fx_push()
+	 */
+	case LBL_ADDR____RN_:			/* -(Rn) */
+	case LBL_ADDR____RN_____XINDEX_RX__:
+		jnl_log(cpu, f.Rn, 0);
+		va = cpu->r[f.Rn] -= width;
+		break;
+
+	case LBL_ADDR__RNXX_:			/* (Rn)+ */
+	case LBL_ADDR__RNXX_____XINDEX_RX__:
+		jnl_log(cpu, f.Rn, 0);
+		va = cpu->r[f.Rn];
+		cpu->r[f.Rn] += width;
+		break;
+
+	case LBL_ADDR___RNXX__:			/* @(Rn)+ */
+	case LBL_ADDR___RNXX____XINDEX_RX__:
+		if (ls && (f.Rx >= 0))
+			ls_diverges("indexed @(Rn)+");
+		if ((exc = fx_load(cpu, cpu->r[f.Rn], 4, &va, &tmp)))
+			return exc;
+		jnl_log(cpu, f.Rn, 0);
+		cpu->r[f.Rn] += 4;
+		break;
+
+	case LBL_ADDR__ADDR_:			/* @#addr */
+	case LBL_ADDR__ADDR_____XINDEX_RX__:
+		va = f.addr;
+		break;
+
+	case LBL_ADDR__RNXDISP_:		/* disp(Rn) */
+	case LBL_ADDR__RNXDISP__XINDEX_RX__:
+		va = cpu->r[f.Rn] + f.disp;
+		break;
+
+	case LBL_ADDR___RNXDISP__:		/* @disp(Rn) */
+	case LBL_ADDR___RNXDISP_XINDEX_RX__:
+		if ((exc = fx_load(cpu, cpu->r[f.Rn] + f.disp, 4, &va, &tmp)))
+			return exc;
+		break;
+
+	case LBL_ADDR__PCXDISP_:		/* disp(PC) */
+	case LBL_ADDR__PCXDISPXINDEX_RX__:
+		va = npc + f.disp;
+		break;
+
+	case LBL_ADDR___PCXDISP__:		/* @disp(PC) */
+	case LBL_ADDR___PCXDISP_XINDEX_RX__:
+		if (ls && (f.Rx >= 0))
+			ls_diverges("indexed @disp(PC)");
+		if ((exc = fx_load(cpu, npc + f.disp, 4, &va, &tmp)))
+			return exc;
+		break;
+
+	default:
+		return LBL_EXC_RESERVED_ADDRESSING_MODE | U_EXC_MASK;
+	}
+
+	return fx_mem(cpu, acc, width, va + x, o);
+}
+
+
+/* a result for a w/m operand -- 0 or an exception */
+static int fx_write(struct cpu *cpu, const struct fx_opnd *o, int width, uint32_t lo, uint32_t hi)
+{
+	if (o->reg < 0)
+		return fx_store(cpu, o->va, width, lo, hi);
+
+	if (width == 8) {
+		cpu->r[o->reg]            = lo;
+		cpu->r[(o->reg + 1) & 15] = hi;
+	} else {
+		reg_write(cpu, o->reg, lo, uw(width));
+	}
+	return 0;
+}
+
+
+/* what op does with its operands -- 0, the µaddr of an exception (with
+   U_EXC_MASK set).  cpu->r[15] is the next instruction already.
+ */
+static int fx_execute(struct cpu *cpu, int op, struct fx_opnd o[])
+{
+	int		kind = fx_op[op];
+	int		n    = op_cnt[op];
+	int		exc;
+
+	/* the result goes to the last operand, the flags are for its width --
+	   quads are handled as longwords by the lazy flags
+	 */
+	int		 w    = n ? op_width[op][n-1] : 4;
+	int		 fw   = (w == 8) ? UW_32 : uw(w);
+	uint32_t	 mask = width_mask(fw);
+	uint32_t	 res  = 0, hi = 0;
+	bool		 wr   = true;		/* res/hi go to o[n-1] */
+	bool		 iov  = false;		/* integer overflow trap if PSL<IV> */
+	int		 cin, ws;
+
+	switch (kind) {
+	case FX_HALT:
+		cpu->stopped = 1;
+		return 0;
+
+	case FX_NOP:
+		return 0;
+
+	/* the operand that changes comes second: y + x, y - x, y / x */
+	case FX_ADD:
+	case FX_ADWC:
+		cin = (kind == FX_ADWC) ? C(flags_get(cpu, U_ARCH, NZVC(0,0,0,1))) : 0;
+		res = (o[1].lo & mask) + (o[0].lo & mask) + cin;
+		lf_record(cpu, U_ARCH, LF_ADD, fw, o[1].lo, o[0].lo, res, 0, 0, cin);
+		iov = true;
+		break;
+
+	case FX_SUB:
+	case FX_SBWC:
+		cin = (kind == FX_SBWC) ? C(flags_get(cpu, U_ARCH, NZVC(0,0,0,1))) : 0;
+		res = o[1].lo - ((o[0].lo & mask) + cin);
+		lf_record(cpu, U_ARCH, LF_SUB, fw, o[1].lo, o[0].lo, res, 0, 0, cin);
+		iov = true;
+		break;
+
+	case FX_INC:
+		res = (o[0].lo & mask) + 1;
+		lf_record(cpu, U_ARCH, LF_ADD, fw, o[0].lo, 1, res, 0, 0, 0);
+		iov = true;
+		break;
+
+	case FX_DEC:
+		res = o[0].lo - 1;
+		lf_record(cpu, U_ARCH, LF_SUB, fw, o[0].lo, 1, res, 0, 0, 0);
+		iov = true;
+		break;
+
+	case FX_MNEG:
+		res = 0 - (o[0].lo & mask);
+		lf_record(cpu, U_ARCH, LF_SUB, fw, 0, o[0].lo, res, 0, 0, 0);
+		iov = true;
+		break;
+
+	case FX_MUL:
+		{
+		int64_t	p = (int64_t) signext(o[0].lo, fw) * signext(o[1].lo, fw);
+
+		res = p;
+		lf_record(cpu, U_ARCH, LF_RES, fw, 0, 0, res, p != signext(res, fw), 0, 0);
+		iov = true;
+		}
+		break;
+
+	case FX_DIV:
+		{
+		int32_t	divr = signext(o[0].lo, fw);
+		int32_t	divd = signext(o[1].lo, fw);
+		int	v    = (divr == 0) || ((divr == -1) && ((o[1].lo & mask) == (mask >> 1) + 1));
+
+		/* the quotient is the dividend if it overflows */
+		res = v ? (uint32_t) divd : (uint32_t) (divd / divr);
+		lf_record(cpu, U_ARCH, LF_RES, fw, 0, 0, res, v, 0, 0);
+		if (divr == 0) {
+			if ((exc = fx_write(cpu, &o[n-1], w, res, 0)))
+				return exc;
+			return LBL_EXC_INT_DIV_BY_ZERO | U_EXC_MASK;
+		}
+		iov = true;
+		}
+		break;
+
+	case FX_BIC:	res = o[1].lo & ~o[0].lo;	goto logic;
+	case FX_BIS:	res = o[1].lo |  o[0].lo;	goto logic;
+	case FX_XOR:	res = o[1].lo ^  o[0].lo;	goto logic;
+	case FX_MCOM:	res = ~o[0].lo;			goto logic;
+	logic:
+		lf_record(cpu, U_ARCH, LF_RES, fw, 0, 0, res, 0, -1, 0);
+		break;
+
+	case FX_ROTL:
+		{
+		int	cnt = o[0].lo & 31;
+
+		res = (o[1].lo << cnt) | (o[1].lo >> ((32 - cnt) & 31));
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, res, 0, -1, 0);
+		}
+		break;
+
+	case FX_ASHL:
+		{
+		int	cnt = (int8_t) o[0].lo;
+		int	v   = 0;
+
+		if (cnt >= 32) {
+			res = 0;
+			v   = o[1].lo != 0;
+		} else if (cnt >= 0) {
+			res = o[1].lo << cnt;
+			v   = ((int32_t) res >> cnt) != (int32_t) o[1].lo;
+		} else if (cnt > -32) {
+			res = (int32_t) o[1].lo >> -cnt;
+		} else {
+			res = (int32_t) o[1].lo >> 31;
+		}
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, res, v, 0, 0);
+		iov = true;
+		}
+		break;
+
+	case FX_CLR:
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, 0, 0, -1, 0);
+		break;
+
+	case FX_CMP:
+		lf_record(cpu, U_ARCH, LF_CMP, fw, o[0].lo, o[1].lo, 0, 0, 0, 0);
+		wr = false;
+		break;
+
+	case FX_TST:
+		lf_record(cpu, U_ARCH, LF_CMP, fw, o[0].lo, 0, 0, 0, 0, 0);
+		wr = false;
+		break;
+
+	case FX_MOV:
+		res = o[0].lo;
+		hi  = o[0].hi;
+		if (w == 8) {
+			flags_sync(cpu, U_ARCH);
+			cpu->psl[U_ARCH] = NZVC(hi >> 31, (res | hi) == 0, 0, C(cpu->psl[U_ARCH]));
+		} else {
+			lf_record(cpu, U_ARCH, LF_RES, fw, 0, 0, res, 0, -1, 0);
+		}
+		break;
+
+	/* sign extend, or truncate */
+	case FX_CVT:
+		ws  = op_width[op][0];
+		res = signext(o[0].lo, uw(ws));
+		lf_record(cpu, U_ARCH, LF_RES, fw, 0, 0, res, signext(res, fw) != (int32_t) res, 0, 0);
+		iov = true;
+		break;
+
+	/* N = 0 */
+	case FX_MOVZ:
+		ws  = op_width[op][0];
+		res = o[0].lo & width_mask(uw(ws));
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, res, 0, -1, 0);
+		break;
+
+	case FX_MOVA:
+		res = o[0].lo;
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, res, 0, -1, 0);
+		break;
+
+	case FX_PUSHL:
+	case FX_PUSHA:
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, o[0].lo, 0, -1, 0);
+		return fx_push(cpu, o[0].lo);
+
+	/* cc is in the low 4 bits of the opcode */
+	case FX_BCC:
+		if (match_cc(flags_get(cpu, U_ARCH, cc_need[op & 0xF]), op & 0xF))
+			cpu->r[15] = o[0].lo;
+		return 0;
+
+	case FX_BR:
+	case FX_JMP:
+		cpu->r[15] = o[0].lo;
+		return 0;
+
+	case FX_BSB:
+	case FX_JSB:
+		if ((exc = fx_push(cpu, cpu->r[15])))
+			return exc;
+		cpu->r[15] = o[0].lo;
+		return 0;
+
+	case FX_RSB:
+		if ((exc = fx_load(cpu, cpu->r[14], 4, &res, &hi)))
+			return exc;
+		jnl_log(cpu, 14, 0);
+		cpu->r[14] += 4;
+		cpu->r[15]  = res;
+		return 0;
+
+	case FX_BLBS:
+	case FX_BLBC:
+		if ((o[0].lo & 1) == (kind == FX_BLBS))
+			cpu->r[15] = o[1].lo;
+		return 0;
+
+	/* limit, index, displ -- C is left alone */
+	case FX_AOBLSS:
+	case FX_AOBLEQ:
+		res = o[1].lo + 1;
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, res, res == 0x80000000, -1, 0);
+		if ((exc = fx_write(cpu, &o[1], 4, res, 0)))
+			return exc;
+		if (((int32_t) res < (int32_t) o[0].lo) ||
+		    ((kind == FX_AOBLEQ) && (res == o[0].lo)))
+			cpu->r[15] = o[2].lo;
+		wr  = false;
+		iov = true;
+		break;
+
+	/* index, displ -- C is left alone */
+	case FX_SOBGEQ:
+	case FX_SOBGTR:
+		res = o[0].lo - 1;
+		lf_record(cpu, U_ARCH, LF_RES, UW_32, 0, 0, res, res == 0x7FFFFFFF, -1, 0);
+		if ((exc = fx_write(cpu, &o[0], 4, res, 0)))
+			return exc;
+		if (((int32_t) res > 0) || ((kind == FX_SOBGEQ) && (res == 0)))
+			cpu->r[15] = o[1].lo;
+		wr  = false;
+		iov = true;
+		break;
+
+	default:
+		UNREACHABLE();
+	}
+
+	if (wr && (exc = fx_write(cpu, &o[n-1], w, res, hi)))
+		return exc;
+
+	/* a trap -- the result has been written */
+	if (iov && (cpu->r[R_PSL] & PSL_IV) && V(flags_get(cpu, U_ARCH, NZVC(0,0,1,0))))
+		return LBL_EXC_INTO | U_EXC_MASK;
+	return 0;
+}
+
+
+/* run the instruction at pc, avail bytes in b[] -- 0, the µaddr of an
+   exception (with U_EXC_MASK set), or FX_UCODE before it has touched
+   anything.  *len is the length of the instruction.
+ */
+static int fx_instruction(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail, int *len)
+{
+	if (!avail)
+		return fetch_fault(cpu);
+
+	int		op   = b[0];
+
+	if (fx_op[op] == FX_NONE)
+		return FX_UCODE;
+
+	struct fx_opnd	o[6] = {{0}};	/* gcc can't see op_cnt[] */
+	int		n   = op_cnt[op];
+	int		idx = 1;
+	int		exc;
+
+	for (int i=0; i < n; i++)
+		if ((exc = fx_operand(cpu, pc, b, avail, &idx, op, i, &o[i])))
+			return exc;
+	*len       = idx;
+	cpu->r[15] = pc + idx;
+	return fx_execute(cpu, op, o);
+}
+
+
+/* lockstep -- revax-sim --engine lockstep
+
+   Each instruction the direct interpreter knows runs twice from the same
+   state.  First fx_instruction(), whose memory writes are logged with what
+   they overwrote, so they can be undone along with its register and flag
+   changes.  Then the µcode engine, for real.  The outcomes are compared --
+   r0..r15, the PSL with the arch flags, the exception, HALT, and the bytes
+   written to memory -- and the first difference stops the simulator with a
+   report.  Up to there the run is the µcode engine's.
+
+   Some differences are known µcode bugs.  Those instructions are left to
+   the µcode engine without a comparison, and counted, so lockstep can check
+   everything else:
+
+     - ls_known[] by opcode
+     - indexed @(Rn)+ and @disp(PC) operands, flagged by fx_operand()
+     - integer overflow traps (PSL<IV>): the µcode loses the result
+
+   An entry goes when its flow is fixed.
+ */
+#define LS_MAXW		8		/* memory writes per instruction */
+#define LS_REGS		17		/* r0..r15, psl */
+
+static const char	*ls_known[256] = {
+	/* the operands go into the ALU the wrong way around: x - y, x / y,
+	   x & ~y, and ASHL/ROTL mix up the count and the value
+	 */
+	[0x82] = "SUB",		[0x83] = "SUB",		[0xA2] = "SUB",		[0xA3] = "SUB",
+	[0xC2] = "SUB",		[0xC3] = "SUB",		[0xD9] = "SBWC",
+	[0x86] = "DIV",		[0x87] = "DIV",		[0xA6] = "DIV",		[0xA7] = "DIV",
+	[0xC6] = "DIV",		[0xC7] = "DIV",
+	[0x8A] = "BIC",		[0x8B] = "BIC",		[0xAA] = "BIC",		[0xAB] = "BIC",
+	[0xCA] = "BIC",		[0xCB] = "BIC",
+	[0x78] = "ASHL",	[0x9C] = "ROTL",
+
+	/* MNEG computes src - 0 */
+	[0x8E] = "MNEG",	[0xAE] = "MNEG",	[0xCE] = "MNEG",
+
+	/* PUSHL/PUSHAx leave the flags alone, MOVZ clears C */
+	[0xDD] = "PUSHL",	[0x9F] = "PUSHAB",	[0x3F] = "PUSHAW",	[0xDF] = "PUSHAL",
+	[0x7F] = "PUSHAQ",
+	[0x9A] = "MOVZ",	[0x9B] = "MOVZ",	[0x3C] = "MOVZ",
+
+	/* the flows are empty */
+	[0xE8] = "BLBS",	[0xE9] = "BLBC",	[0xF2] = "AOBLSS",	[0xF3] = "AOBLEQ",
+	[0xF4] = "SOBGEQ",	[0xF5] = "SOBGTR",
+
+	/* quadword results, and CVTBW's operand types are wrong in the table */
+	[0x7C] = "CLRQ",	[0x7D] = "MOVQ",	[0x99] = "CVTBW",
+};
+
+struct ls_state {
+	uint32_t	r[LS_REGS];
+	int		exc;
+	int		stopped;
+	const char	*known;		/* an operand µcode gets wrong -- ls_diverges() */
+
+	int		wcnt;
+	struct {
+		uint32_t	 va;
+		int		 len;
+		uint32_t	 lo, hi;
+		uint32_t	 olo, ohi;	/* what was there before */
+	} w[LS_MAXW];
+};
+
+
+/* a write went through -- only the direct interpreter knows olo/ohi */
+static void ls_store(uint32_t va, int len, uint32_t lo, uint32_t hi, uint32_t olo, uint32_t ohi)
+{
+	if (ls->wcnt == LS_MAXW)
+		return;
+	ls->w[ls->wcnt].va  = va;
+	ls->w[ls->wcnt].len = len;
+	ls->w[ls->wcnt].lo  = lo;
+	ls->w[ls->wcnt].hi  = hi;
+	ls->w[ls->wcnt].olo = olo;
+	ls->w[ls->wcnt].ohi = ohi;
+	ls->wcnt++;
+}
+
+
+/* the instruction has an operand the µcode is known to get wrong */
+static void ls_diverges(const char *why)
+{
+	ls->known = why;
+}
+
+
+/* the architectural outcome of the instruction at pc */
+static void ls_result(struct cpu *cpu, struct ls_state *s, uint32_t pc, int exc)
+{
+	long	evals = cpu->lf_evals;	/* not a real evaluation */
+
+	memcpy(s->r, cpu->r, 16 * sizeof(uint32_t));
+	s->r[16]   = (cpu->r[R_PSL] & ~0xF) | flags_get(cpu, U_ARCH, NZVC(1,1,1,1));
+	s->exc     = exc;
+	s->stopped = cpu->stopped;
+	cpu->lf_evals = evals;
+
+	/* cpu_run() puts the PC back */
+	if (exc)
+		s->r[15] = pc;
+}
+
+
+/* the bytes s wrote, the last write to a byte wins -- how many */
+static int ls_bytes(const struct ls_state *s, uint32_t va[LS_MAXW*8], uint8_t val[LS_MAXW*8])
+{
+	int	n = 0;
+
+	for (int i=0; i < s->wcnt; i++)
+		for (int j=0; j < s->w[i].len; j++) {
+			int	k = 0;
+
+			while ((k < n) && (va[k] != s->w[i].va + j))
+				k++;
+			va[k]  = s->w[i].va + j;
+			val[k] = (j < 4) ? BYTE(s->w[i].lo, j) : BYTE(s->w[i].hi, (j - 4));
+			n      = (k == n) ? n + 1 : n;
+		}
+	return n;
+}
+
+
+/* do the engines disagree?  Print how. */
+static bool ls_diff(struct cpu *cpu, uint32_t pc, int op, const struct ls_state *f, const struct ls_state *u)
+{
+	static const char	*rname[LS_REGS] = {
+		"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11",
+		"r12/AP", "r13/FP", "r14/SP", "r15/PC", "PSL"};
+
+	uint32_t	fva[LS_MAXW*8], uva[LS_MAXW*8];
+	uint8_t		fval[LS_MAXW*8], uval[LS_MAXW*8];
+	int		fcnt = ls_bytes(f, fva, fval);
+	int		ucnt = ls_bytes(u, uva, uval);
+	bool		diff = false;
+
+#define DIFF()									\
+	do {									\
+		if (!diff)							\
+			printf("lockstep: the engines disagree on %s at PC %04X_%04X (instruction %llu)\n", \
+				mne[op], SPLIT(pc), (unsigned long long) cpu->clock); \
+		diff = true;							\
+	} while (0)
+
+	for (int i=0; i < LS_REGS; i++)
+		if (f->r[i] != u->r[i]) {
+			DIFF();
+			printf("  %-7s     fast %04X_%04X  µcode %04X_%04X\n",
+				rname[i], SPLIT(f->r[i]), SPLIT(u->r[i]));
+		}
+	if (f->exc != u->exc) {
+		DIFF();
+		printf("  exception   fast %s  µcode %s\n",
+			f->exc ? ulabel(f->exc & ~U_EXC_MASK) : "-",
+			u->exc ? ulabel(u->exc & ~U_EXC_MASK) : "-");
+	}
+	if (f->stopped != u->stopped) {
+		DIFF();
+		printf("  halted      fast %s  µcode %s\n", f->stopped ? "yes" : "no", u->stopped ? "yes" : "no");
+	}
+
+	/* memory -- the same bytes with the same values */
+	for (int i=0; i < fcnt; i++) {
+		int	k = 0;
+
+		while ((k < ucnt) && (uva[k] != fva[i]))
+			k++;
+		if ((k < ucnt) && (uval[k] == fval[i]))
+			continue;
+		DIFF();
+		if (k < ucnt)
+			printf("  [%04X_%04X] fast        %02X  µcode        %02X\n", SPLIT(fva[i]), fval[i], uval[k]);
+		else
+			printf("  [%04X_%04X] fast        %02X  µcode        --\n", SPLIT(fva[i]), fval[i]);
+	}
+	for (int i=0; i < ucnt; i++) {
+		int	k = 0;
+
+		while ((k < fcnt) && (fva[k] != uva[i]))
+			k++;
+		if (k == fcnt) {
+			DIFF();
+			printf("  [%04X_%04X] fast        --  µcode        %02X\n", SPLIT(uva[i]), uval[i]);
+		}
+	}
+#undef DIFF
+
+	return diff;
+}
+
+
+/* both engines on the instruction at pc -- 0 or the µaddr of the µcode
+   engine's exception
+ */
+static int lockstep(struct cpu *cpu, uint32_t pc, const uint8_t *b, int avail, int *len)
+{
+	static struct ls_state	fast, ucode;
+
+	uint32_t	r[R_CNT], psl[2];
+	struct lflags	lf[2];
+	long		lf_ops   = cpu->lf_ops;
+	long		lf_evals = cpu->lf_evals;
+	int		op       = avail ? b[0] : 0;	/* b[] may be overwritten */
+	int		exc;
+
+	/* nothing to compare on a fetch fault, b is NULL */
+	if (!avail) {
+		cpu->fx_ucode++;
+		return ucode_instruction(cpu, pc, b, avail, len);
+	}
+	if (ls_known[op]) {
+		cpu->fx_known++;
+		return ucode_instruction(cpu, pc, b, avail, len);
+	}
+
+	memcpy(r,   cpu->r,   sizeof(r));
+	memcpy(psl, cpu->psl, sizeof(psl));
+	memcpy(lf,  cpu->lf,  sizeof(lf));
+
+	fast.wcnt  = 0;
+	fast.known = NULL;
+	ls  = &fast;
+	exc = fx_instruction(cpu, pc, b, avail, len);
+	ls  = NULL;
+	if (exc == FX_UCODE) {
+		cpu->fx_ucode++;
+		return ucode_instruction(cpu, pc, b, avail, len);
+	}
+	if (exc)
+		exc_regs(cpu, exc);
+	ls_result(cpu, &fast, pc, exc);
+
+	/* take it all back, newest write first */
+	for (int i = fast.wcnt - 1; i >= 0; i--) {
+		int	err;
+
+		access(cpu, MODE_WRITE, fast.w[i].va, fast.w[i].len, &fast.w[i].olo, &fast.w[i].ohi, &err);
+	}
+	memcpy(cpu->r,   r,   sizeof(r));
+	memcpy(cpu->psl, psl, sizeof(psl));
+	memcpy(cpu->lf,  lf,  sizeof(lf));
+	cpu->lf_ops   = lf_ops;
+	cpu->lf_evals = lf_evals;
+	cpu->stopped  = 0;
+
+	ucode.wcnt = 0;
+	ls  = &ucode;
+	exc = ucode_instruction(cpu, pc, b, avail, len);
+	ls  = NULL;
+	if (exc)
+		exc_regs(cpu, exc);
+	ls_result(cpu, &ucode, pc, exc);
+
+	/* the µcode skips the result write before the trap, which the fast
+	   engine may have faulted on
+	 */
+	if (fast.known || (fast.exc == (LBL_EXC_INTO | U_EXC_MASK)) ||
+	    (ucode.exc == (LBL_EXC_INTO | U_EXC_MASK))) {
+		cpu->fx_known++;
+		return exc;
+	}
+	cpu->fx_checked++;
+	if (ls_diff(cpu, pc, op, &fast, &ucode))
+		cpu->stopped = 1;
+	return exc;
+}
+
+
+/* the KA655 ROM, translated ahead of time -- revax-sim --engine fast --rom <file>
+
+   src/vax-rom.h is made by revax-dis -c from vax-bin/ka655x.bin: a C
+   function for each run of the code the disassembler's flood fill can reach
+   (CASE tables included).  They work on struct cpu like the fast engine
+   does, with the operands taken apart at build time and fx_execute() doing
+   the work, so the µcode engine can take over between any two instructions.
+
+   A function returns when control leaves it, when something needs attention
+   (the same checks cpu_run() makes before each instruction), on an
+   exception, or with FX_UCODE at an instruction the fast engine doesn't do.
+   *pc is that instruction.
+
+   The guard: rx_init() checksums the ROM pages as they are mapped.  Code on
+   a page that isn't what the translation was made from, or that can be
+   written, is interpreted as usual.  So is everything with MAPEN on -- the
+   PC is a virtual address then.
+ */
+struct rx_func {
+	uint32_t	start, end;	/* [start, end) */
+	int		(*fn)(struct cpu *cpu, uint32_t *pc);
+};
+
+/* the instruction at addr, if the fast engine knows op */
+#define RX_INSTR(addr, op)						\
+	do {								\
+		*pc = (addr);						\
+		if (fx_op[op] == FX_NONE)				\
+			return FX_UCODE;				\
+	} while (0)
+
+/* the instruction at addr has an operand the fast engine wouldn't take */
+#define RX_UCODE(addr)							\
+	do {								\
+		*pc = (addr);						\
+		return FX_UCODE;					\
+	} while (0)
+
+/* the operands, see fx_operand() */
+#define RX_IMM(i, lo_, hi_)	(o[i].reg = -1, o[i].lo = (lo_), o[i].hi = (hi_))
+#define RX_TARGET(i, addr)	(o[i].reg = -1, o[i].lo = (addr), o[i].hi = 0)
+#define RX_REG(i, n, width)	(o[i].reg = (n), o[i].lo = cpu->r[n],		\
+				 o[i].hi  = ((width) == 8) ? cpu->r[(n) + 1] : 0)
+
+#define RX_LOAD(addr)							\
+	do {								\
+		if ((exc = fx_load(cpu, (addr), 4, &va, &tmp)))		\
+			return exc;					\
+	} while (0)
+
+#define RX_MEM(i, acc, width, addr)					\
+	do {								\
+		o[i].reg = -1;						\
+		o[i].hi  = 0;						\
+		if ((exc = fx_mem(cpu, (acc), (width), (addr), &o[i])))	\
+			return exc;					\
+	} while (0)
+
+#define RX_EXEC(op, next)						\
+	do {								\
+		cpu->r[15] = (next);					\
+		if ((exc = fx_execute(cpu, (op), o)))			\
+			return exc;					\
+	} while (0)
+
+/* retired -- stop if cpu_run() has something to do before the next one */
+#define RX_DONE()							\
+	do {								\
+		jnl_commit(cpu);					\
+		cpu->clock++;						\
+		cpu->fx_instrs++;					\
+		cpu->rx_instrs++;					\
+		if (cpu->stopped || (cpu->clock >= cpu->due) ||	\
+		    __atomic_load_n(&cpu->events, __ATOMIC_ACQUIRE))	\
+			return 0;					\
+	} while (0)
+
+/* a control transfer out of the run */
+#define RX_NEXT(next)							\
+	do {								\
+		if (cpu->r[15] != (next))				\
+			return 0;					\
+	} while (0)
+
+#include "vax-rom.h"
+
+static bool	rx_good[ARRAY_SIZE(rx_funcs)];	/* passed the guard */
+static bool	rx_on;				/* there is a ROM */
+static int	rx_changed;			/* pages that didn't pass */
+
+
+/* FNV-1a -- the same as revax-dis */
+static uint32_t rx_page_sum(const uint8_t *p, unsigned cnt)
+{
+	uint32_t	h = 2166136261u;
 
-		/* src, src', dst -- len flags */
-		case U_MOVX:
-			/* MOVQ is implemented as mov + mov-
+	for (unsigned i=0; i < cnt; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
 
-			   The trouble is that the Z flag has to be set based
-			   on *both* 32-bit values.
-			 */
-			break;
 
-		/* s1, dst -- len */
-		case U_LD:
-		case U_LDI:
-		case U_LDU:
-			{
-			uint32_t	tmp, tmphi;
-			int		err;
-
-			if (!access(cpu,
-				    MODE_READ +
-				    (MODE_LDI * (u.op == U_LDI)) +
-				    (MODE_LDU * (u.op == U_LDU)),
-				    u.s1, u.width, &tmp, &tmphi, &err)) {
-				/* exception */
-				return LBL_EXC_ACCESS | U_EXC_MASK;
-			}
+/* the guard, after the ROM has been mapped */
+static void rx_init(struct cpu *cpu)
+{
+	bool	ok[RX_PAGES];
 
-			switch (u.width) {
-			case UW_8:
-			case UW_16:
-			case UW_32:
-				cpu->r[u.dst] = signext(tmp, u.width);
-				break;
-			}
-			}
-			break;
+	rx_changed = 0;
+	for (int i=0; i < RX_PAGES; i++) {
+		uint32_t	 pfn  = (RX_BASE >> MEM_PAGE_BITS) + i;
+		uint8_t		*page = mem_page(cpu->mem, pfn);
+		unsigned	 cnt  = (RX_SIZE - i * MEM_PAGE_SZE < MEM_PAGE_SZE) ? RX_SIZE - i * MEM_PAGE_SZE : MEM_PAGE_SZE;
 
-		/* s1, s2 -- len */
-		case U_ST:
-		case U_STI:
-		case U_STU:
-			{
-			uint32_t	tmp, tmphi;
-			int		err;
-
-			switch (u.width) {
-			case UW_8:
-			case UW_16:
-			case UW_32:
-				tmp = cpu->r[u.dst];
-				break;
-			}
-			if (!access(cpu,
-				    MODE_WRITE +
-				    (MODE_LDI * (u.op == U_LDI)) +
-				    (MODE_LDU * (u.op == U_LDU)),
-				    u.s1, u.width, &tmp, &tmphi, &err)) {
-				/* exception */
-				return LBL_EXC_ACCESS | U_EXC_MASK;
-			}
-			}
-			break;
+		ok[i] = page && !(mem_flags(cpu->mem, pfn) & MF_WRITE) && (rx_page_sum(page, cnt) == rx_sum[i]);
+		rx_changed += !ok[i];
+	}
 
-		/* src, dst -- width */
-		case U_INC:
-			cpu->r[u.dst] += uop_width(u.width);
-			break;
-		case U_DEC:
-			cpu->r[u.dst] -= uop_width(u.width);
-			break;
-		case U_INDEX:
-			cpu->r[u.dst] = cpu->r[u.s1] * uop_width(u.width);
-			break;
+	for (unsigned i=0; i < ARRAY_SIZE(rx_funcs); i++) {
+		uint32_t	first = (rx_funcs[i].start - RX_BASE) >> MEM_PAGE_BITS;
+		uint32_t	last  = (rx_funcs[i].end - 1 - RX_BASE) >> MEM_PAGE_BITS;
 
-		/* The entire ALU group is handled outside this switch for
-		   both readability reasons and in order to be nice to the
-		   compiler.  Not all compilers tolerate big functions equally
-		   well.
-		 */
-		case U_CMP:
-		case U_ADD:
-		case U_SUB:
-		case U_MUL:
-		case U_DIV:
-		case U_AND:
-		case U_BIC:
-		case U_BIS:
-		case U_XOR:
-		case U_ASHL:
-		case U_ROTL:
-		case U_ADC:
-		case U_SBB:
-		case U_EMUL:
-		case U_EDIV:
-			{
-				uint32_t	exc_addr;
-				(void) exc_addr;
+		rx_good[i] = true;
+		for (uint32_t p = first; p <= last; p++)
+			rx_good[i] = rx_good[i] && ok[p];
+	}
+	rx_on = true;
+}
 
-				alu(cpu, u);
-			}
-			break;
 
+/* the translated code for pc -- NULL if there is none */
+static const struct rx_func *rx_lookup(struct cpu *cpu, uint32_t pc)
+{
+	if (!rx_on || (cpu->preg[PR_MAPEN] & 1) || (pc - RX_BASE >= RX_SIZE))
+		return NULL;
 
-		/* s1, dst    ; s1 is a GPR with the number of a preg */
-		case U_MFPR:
-			/* FIXME move outside this function. */
-			/* merge with U_MTPR? */
-			cpu->r[u.dst] = cpu->preg[u.s1];
-			break;
+	unsigned	lo = 0, hi = ARRAY_SIZE(rx_funcs);
 
-		/* s1, dst    ; dst is a GPR with the number of a preg */
-		case U_MTPR:
-			/* FIXME move outside this function. */
-			/* merge with U_MFPR? */
-			cpu->preg[u.dst] = cpu->r[u.s1];
-			break;
+	while (lo < hi) {
+		unsigned	mid = (lo + hi) / 2;
 
-		default:
-			printf("#%3d", u.op);
-		}
+		if (pc < rx_funcs[mid].start)
+			hi = mid;
+		else if (pc >= rx_funcs[mid].end)
+			lo = mid + 1;
+		else
+			return rx_good[mid] ? &rx_funcs[mid] : NULL;
 	}
-	return 0;
+	return NULL;
 }
 
 
-/* start at a µaddr, fetch a basic block, execute it, if there was a branch,
-   fetch a new basic block and repeat.
+/* run translated code from *pc -- 0, the µaddr of an exception (*pc is the
+   instruction that took it), or FX_UCODE if the instruction at *pc has to
+   be interpreted.  *b and *avail are fetched for it.
  */
-static void run_flow()
+static int rx_run(struct cpu *cpu, const struct rx_func *rx, uint32_t *pc, const uint8_t **b, int *avail)
 {
+	uint32_t	start = *pc;
+	int		exc;
+
+	cpu->rx_calls++;
+	exc = rx->fn(cpu, pc);
+	if ((exc == FX_UCODE) && (*pc != start))
+		*b = ifetch(cpu, *pc, avail);
+	return exc;
 }
 
 
-/* start by looking at interrupt rq and trace flag.
-
-   fetch instruction
-   decode-opcode, figure out stuff
-   decode-operand, fetch basic block, run it, fetch new basic block if branch/exception, ...
-   decode next operand until we are done (or we get an exception)
-   write result(s) (if we didn't get an exception)
-
-   did we request an exception?  I think this is for faults only -- INTO, DIV0
-
-   Do we do the stack stuff and jmp to the exception vector here or do we wait
-   until the next time we get called?
- */
-static void run_instruction()
+/* name of a µcode label, for messages */
+static const char *ulabel(int uaddr)
 {
+	for (unsigned i=0; i < ARRAY_SIZE(ulabels); i++)
+		if (ulabels[i].value == uaddr)
+			return ulabels[i].name;
+	return "?";
 }
 
 
@@ -610,10 +6119,159 @@ static void dump_regs(struct cpu *cpu, struct cpu *old_cpu)
 }
 
 
+/* run control -- revax-sim --skip <n> | --skip-to <pc>, --detail <m>, --period <p>
+
+   Fast-forward, then look closely.  The run starts fast: the --engine that
+   was asked for, with traces and the JIT, and without --trace, --stats or
+   --uop-profile.  After n instructions, or when the next instruction is at
+   pc, it switches to the detailed mode: the µcode engine with whatever of
+   those was asked for.  After m detailed instructions the simulator stops,
+   or with --period it goes back to fast-forwarding and starts the next m
+   instruction window p instructions after the start of the last one.
+
+   The switches are timers on the timer wheel, so the instruction counts are
+   exact (cpu_run() doesn't start a trace that would run past cpu->due).
+   --skip-to compares the PC before every instruction and doesn't start a
+   trace with pc in the middle.  The --trace file gets a new sync record at
+   the start of each window.
+ */
+static bool		 rc;		/* any of the options given */
+static uint64_t		 rc_skip, rc_detail, rc_period;
+static bool		 rc_topc;	/* --skip-to, until pc is reached */
+static uint32_t		 rc_pc;
+
+static bool		 rc_detailed;	/* in a window */
+static struct timer	 rc_timer;
+static int		 rc_engine;	/* --engine, for fast-forwarding */
+static bool		 rc_stats, rc_uprof;	/* what was asked for */
+
+static long		 rc_windows;
+static uint64_t		 rc_instrs, rc_start;	/* detailed instructions, window start */
+static long		 rc_hits, rc_misses;	/* decode cache, in windows */
+
+
+/* switch to the detailed mode, or out of it */
+static void rc_mode(struct cpu *cpu, bool detailed)
+{
+	if (detailed) {
+		rc_windows++;
+		rc_start   = cpu->clock;
+		rc_hits   -= cpu->dcache->hits;
+		rc_misses -= cpu->dcache->misses;
+	} else if (rc_detailed) {
+		rc_instrs += cpu->clock - rc_start;
+		rc_hits   += cpu->dcache->hits;
+		rc_misses += cpu->dcache->misses;
+	}
+
+	rc_detailed = detailed;
+	cpu->engine = detailed ? ENG_UCODE : rc_engine;
+	stats       = detailed && rc_stats;
+	uprof       = detailed && rc_uprof;
+	trc         = detailed ? trc_file : NULL;
+	if (trc)
+		trc->gap = true;
+}
+
+
+/* the end of a fast-forward or of a window */
+static void rc_fire(struct cpu *cpu, struct timer *t)
+{
+	if (!rc_detailed) {
+		rc_mode(cpu, true);
+		if (rc_detail)
+			timer_add(cpu, t, rc_detail);
+	} else if (rc_period) {
+		rc_mode(cpu, false);
+		timer_add(cpu, t, rc_period - rc_detail);
+	} else {
+		rc_mode(cpu, false);
+		printf("end of the detailed window at PC %04X_%04X\n", SPLIT(cpu->r[15]));
+		cpu->stopped = 1;
+	}
+}
+
+
+/* --skip-to: the next instruction is at rc_pc */
+static void rc_reached(struct cpu *cpu)
+{
+	rc_topc = false;
+	rc_fire(cpu, &rc_timer);
+}
+
+
+static void rc_init(struct cpu *cpu)
+{
+	rc_engine = cpu->engine;
+	rc_stats  = stats;
+	rc_uprof  = uprof;
+	rc_timer.fire = rc_fire;
+
+	if (rc_skip || rc_topc) {
+		rc_mode(cpu, false);
+		if (rc_skip)
+			timer_add(cpu, &rc_timer, rc_skip);
+	} else {
+		rc_mode(cpu, true);
+		if (rc_detail)
+			timer_add(cpu, &rc_timer, rc_detail);
+	}
+}
+
+
+/* the run is over -- the reports are for what was asked for */
+static void rc_stop(struct cpu *cpu)
+{
+	rc_mode(cpu, false);
+	stats = rc_stats;
+	uprof = rc_uprof;
+}
+
+
+/* something is pending -- deal with it before the next instruction */
+static void events_run(struct cpu *cpu, uint32_t ev)
+{
+	uint32_t	pc = cpu->r[15];
+
+	if (ev & EV_HALT) {
+		events_clear(cpu, EV_HALT);
+		printf("halt request at PC %04X_%04X\n", SPLIT(pc));
+		cpu->stopped = 1;
+		return;
+	}
+
+	if (ev & EV_TIMER) {
+		events_clear(cpu, EV_TIMER);
+		timers_run(cpu);
+	}
+
+	if (ev & EV_STATS) {
+		events_clear(cpu, EV_STATS);
+		stats_dump();
+	}
+
+	/* a device interrupt may have been posted below IPL */
+	if (ev & EV_IRQ) {
+		events_update(cpu);
+		ev = __atomic_load_n(&cpu->events, __ATOMIC_ACQUIRE);
+	}
+
+	/* FIXME interrupts and trace traps aren't handled by the µcode yet */
+	if (ev & EV_TP) {
+		printf("trace trap at PC %04X_%04X\n", SPLIT(pc));
+		cpu->stopped = 1;
+	} else if (ev & (EV_IRQ | EV_SIRQ)) {
+		uint32_t	req = __atomic_load_n(&cpu->irq, __ATOMIC_ACQUIRE) | cpu->preg[PR_SISR];
+
+		printf("interrupt at IPL %02X, PC %04X_%04X\n", 31 - __builtin_clz(req), SPLIT(pc));
+		cpu->stopped = 1;
+	}
+}
+
+
 static void cpu_run(struct cpu *cpu)
 {
 	struct cpu	old_cpu;
-	uint16_t	utarget;
 
 	dump_regs(cpu, cpu);
 	memcpy(&old_cpu, cpu, sizeof(struct cpu));
@@ -623,48 +6281,137 @@ static void cpu_run(struct cpu *cpu)
 	cpu->psl[0] = NZVC(1,0,1,1);
 
 	while (!cpu->stopped) {
-		struct uop	uops[MAXFLOWLEN];
-		int		uop_cnt;
+		uint32_t		pc = cpu->r[15];
+		const uint8_t		*b;
+		int			avail, exc, len = 0;
 
-		uint8_t		buf[12];
-		size_t		fetch_cnt;
+		/* interrupts, trace, halt request, timers */
+		if (cpu->clock >= cpu->due)
+			events_post(cpu, EV_TIMER);
 
-		mem_fetch(cpu, cpu->r[15], &buf, sizeof(buf),&fetch_cnt);
+		uint32_t		ev = __atomic_load_n(&cpu->events, __ATOMIC_ACQUIRE);
 
-		printf("PC: %04X_%04X  %02X %02X %02X %02X   %02X %02X %02X %02X   %02X %02X %02X %02X\n",
-			SPLIT(cpu->r[15]),
-			buf[ 0], buf[ 1], buf[ 2], buf[ 3],
-			buf[ 4], buf[ 5], buf[ 6], buf[ 7],
-			buf[ 8], buf[ 9], buf[10], buf[11]);
+		if (ev) {
+			events_run(cpu, ev);
+			if (cpu->stopped)
+				break;
+		}
 
-		decode(cpu, &uop_cnt, uops);
+		if (rc_topc && (pc == rc_pc))
+			rc_reached(cpu);
 
-		do {
-			dis_uinstr(0, uop_cnt, uops);
+		b = ifetch(cpu, pc, &avail);
+		if (ev & EV_PROF)
+			prof_sample(cpu, pc, b, avail);
+		if (trc)
+			trc_fetch(b, avail);
 
-			utarget = datapath(cpu, uop_cnt, uops);
-#if 0
-			if (utarget != -1)
-				fetch(utarget, &uop_cnt, uops);
-#endif
-		} while (utarget != 0xFFFF);
+		struct trace	*tr = (avail && !cpu->ra && !trc && !(ev & EV_TRACE) &&
+				       (cpu->engine == ENG_UCODE)) ? trace_get(cpu, pc) : NULL;
+
+		/* timers fire between the instructions of a trace too */
+		if (tr && (cpu->clock + tr->icnt > cpu->due))
+			tr = NULL;
+		for (int k=1; tr && rc_topc && (k < tr->icnt); k++)
+			if (tr->instr[k].pc == rc_pc)
+				tr = NULL;
+
+		/* translated ROM code -- not for --trace, trace traps or --skip-to,
+		   they look at each instruction
+		 */
+		const struct rx_func	*rx = (avail && !trc && !(ev & EV_TRACE) && !rc_topc &&
+					       (cpu->engine == ENG_FAST)) ? rx_lookup(cpu, pc) : NULL;
+
+		if (tr) {
+			exc = run_trace(cpu, tr, &pc);
+		} else if (rx && ((exc = rx_run(cpu, rx, &pc, &b, &avail)) != FX_UCODE)) {
+			/* stopped before *pc, or an exception there */
+		} else {
+			switch (cpu->engine) {
+			case ENG_FAST:
+				exc = fx_instruction(cpu, pc, b, avail, &len);
+				if (exc == FX_UCODE) {
+					cpu->fx_ucode++;
+					exc = ucode_instruction(cpu, pc, b, avail, &len);
+				}
+				break;
+			case ENG_LOCKSTEP:
+				exc = lockstep(cpu, pc, b, avail, &len);
+				break;
+			default:
+				exc = ucode_instruction(cpu, pc, b, avail, &len);
+			}
+			cpu->fx_instrs++;
+			if (!exc)
+				cpu->clock++;
+			if (!exc && (ev & EV_TRACE)) {
+				cpu->r[R_PSL] |= PSL_TP;
+				events_post(cpu, EV_TP);
+			}
+		}
+
+		if (exc) {
+			/* FIXME exceptions aren't handled by the µcode yet */
+			exc_regs(cpu, exc);
+			printf("exception %s at PC %04X_%04X\n", ulabel(exc & ~U_EXC_MASK), SPLIT(pc));
+			cpu->r[15]   = pc;
+			cpu->stopped = 1;
+		} else {
+			jnl_commit(cpu);
+		}
+		if (trc)
+			trc_instr(cpu, pc, len, exc);
 	}
 
+	if (rc)
+		rc_stop(cpu);
+	flags_sync(cpu, U_ARCH);
+	flags_sync(cpu, U_MICRO);
 	dump_regs(cpu, &old_cpu);
+	printf("decode cache: %ld hits, %ld misses\n", cpu->dcache->hits, cpu->dcache->misses);
+	printf("flow templates: %ld\n", tmpl_cnt);
+	printf("trace cache: %ld hits, %ld misses, %ld instructions\n",
+		cpu->tcache->hits, cpu->tcache->misses, cpu->tcache->instrs);
+	printf("flags: %ld flag-setting µops, %ld evaluations\n", cpu->lf_ops, cpu->lf_evals);
+	if (cpu->jit)
+		printf("jit: %ld traces compiled, %zu bytes of code, %ld flushes\n",
+			cpu->jit->blocks, cpu->jit->used, cpu->jit->flushes);
+	else
+		printf("jit: off\n");
+	if (cpu->ra)
+		printf("run-ahead: %ld from the ring, %ld decoded here, %ld redirects, %ld stale\n",
+			cpu->ra->hits, cpu->ra->owncnt, cpu->ra->redirects, cpu->ra->stale);
+	if (cpu->engine != ENG_UCODE)
+		printf("engine: %s, %ld instructions, %ld by the µcode engine, %ld checked in lockstep, %ld known to differ\n",
+			(cpu->engine == ENG_FAST) ? "fast" : "lockstep",
+			cpu->fx_instrs, cpu->fx_ucode, cpu->fx_checked, cpu->fx_known);
+	if (rx_on)
+		printf("rom: %ld instructions in translated code, %ld calls, %d of %d pages changed\n",
+			cpu->rx_instrs, cpu->rx_calls, rx_changed, RX_PAGES);
+	if (rc)
+		printf("run control: %ld windows, %llu detailed instructions, decode cache %ld hits, %ld misses in them\n",
+			rc_windows, (unsigned long long) rc_instrs, rc_hits, rc_misses);
 }
 
 
 static void cpu_init(struct cpu *cpu)
 {
 	memset(cpu, 0x0, sizeof (struct cpu));
-	cpu->mem = malloc(sizeof (struct mem_table));
-	memset(cpu->mem, 0x0, sizeof (struct mem_table));
+	cpu->mem = calloc(1, sizeof (struct mem_table));
+
+	tlb_flush(&cpu->itlb);
+	tlb_flush(&cpu->dtlb);
+	cpu->ib.tag = TLB_INVALID;
+	dcache_init(cpu);
+	tcache_init(cpu);
+	jit_init(cpu);
+	timers_init(cpu);
 }
 
 
 static void cpu_program(struct cpu *cpu)
 {
-	strcpy((char *) (cpu->mem->pages[0]),
+	strcpy((char *) mem_page(cpu->mem, 0),
 #if 0
 	"\xC1\x52\x53\x54"	/* ADDL3   r2, r3, r4	*/
 	"\xC3\x52\x53\x54"	/* SUBL3   r2, r3, r4	*/
@@ -687,17 +6434,284 @@ static void cpu_program(struct cpu *cpu)
 
 	"\xC1\x64\x52\x57"	/* ADDL3   r2, [r4], r7 */
 
-	"\xFF"			/* STOP			*/
+	"\x00"			/* HALT			*/
 	);
 }
 
 
+/***/
+
+/* "timing" -- cost of ld/st µops, with and without the access() fast path.
+
+   The same addresses are used for all runs so the D-TLB is warm after the
+   first one.  Most of the accesses are aligned, one is unaligned but stays
+   within its page.
+ */
+
+static double timediff(struct timespec from, struct timespec to)
+{
+	return (to.tv_sec - from.tv_sec) * 1000 * 1000.0  + (to.tv_nsec - from.tv_nsec) / 1000.0;
+}
+
+
+static const struct uop	ldst_flow[] = {
+	{.op=U_LD, .s1=1, .dst=7, .width=UW_32},
+	{.op=U_ST, .s1=7, .s2=2,  .width=UW_32},
+	{.op=U_LD, .s1=3, .dst=8, .width=UW_16},
+	{.op=U_ST, .s1=8, .s2=4,  .width=UW_8},
+	{.op=U_LD, .s1=4, .dst=9, .width=UW_8},
+	{.op=U_ST, .s1=9, .s2=5,  .width=UW_16},
+	{.op=U_LD, .s1=6, .dst=10,.width=UW_32},
+	{.op=U_ST, .s1=10,.s2=1,  .width=UW_32},
+};
+
+
+/* run the flow n times with access() or access_slow() */
+static void time_ldst_run(struct cpu *cpu, long n, int mode)
+{
+	struct uop	flow[ARRAY_SIZE(ldst_flow)];
+
+	memcpy(flow, ldst_flow, sizeof(flow));
+
+	while (n--) {
+		switch (mode) {
+		case 0:	/* datapath */
+			if (datapath(cpu, ARRAY_SIZE(flow), flow) != UADDR_DONE)
+				assert(0);
+			break;
+		case 1:	/* access() */
+		case 2:	/* access_slow() */
+			for (unsigned i=0; i < ARRAY_SIZE(flow); i++) {
+				struct uop	u = flow[i];
+				int		write = (u.op == U_ST);
+				uint32_t	va    = cpu->r[write ? u.s2 : u.s1];
+				uint32_t	data  = cpu->r[write ? u.s1 : u.dst], datahi;
+				int		err, ok;
+
+				if (mode == 1)
+					ok = access(cpu, write, va, uop_width(u.width), &data, &datahi, &err);
+				else
+					ok = access_slow(cpu, write, va, uop_width(u.width), &data, &datahi, &err);
+				if (!ok)
+					abort();	/* the pages are all there */
+				if (!write)
+					cpu->r[u.dst] = data;
+			}
+			break;
+		}
+	}
+}
+
+
+static void time_ldst()
+{
+	static struct cpu	cpu;
+	const char		*name[] = {"datapath() ld/st", "access()        ", "access_slow()   "};
+
+	cpu_init(&cpu);
+	mem_init(&cpu, 1024 * 1024);
+
+	cpu.r[1] = 0x1000;
+	cpu.r[2] = 0x2204;
+	cpu.r[3] = 0x3402;
+	cpu.r[4] = 0x4013;
+	cpu.r[5] = 0x5006;
+	cpu.r[6] = 0x6101;	/* unaligned, same page */
+
+	printf("Timing (%zu ld/st µops per flow)\n", ARRAY_SIZE(ldst_flow));
+	printf("------\n");
+
+	for (int mode=0; mode < 3; mode++) {
+		struct timespec	start, stop;
+		long		cnt = 0;
+
+		time_ldst_run(&cpu, 1000, mode);	/* warm up TLB + caches */
+
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		while (1) {
+			time_ldst_run(&cpu, 10000, mode);
+			cnt += 10000;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &stop);
+			if (timediff(start, stop) > 100000.0)
+				break;
+		}
+
+		printf("%s  %g ns/µop  (%g µs, %ld flows)\n",
+			name[mode],
+			timediff(start, stop) * 1000.0 / ARRAY_SIZE(ldst_flow) / cnt,
+			timediff(start, stop), cnt);
+	}
+	printf("\n");
+}
+
+
+/* "timing" -- µops/s through the datapath dispatch.
+
+   Which engine (threaded or switch) is decided at build time, so build both
+   and compare:
+
+     make sim && ./revax-sim --time-dispatch
+     make sim EXTCFLAGS=-DDATAPATH_SWITCH && ./revax-sim --time-dispatch
+
+   Each workload is run through datapath() (handlers resolved for every run,
+   like flows that aren't in a trace) and datapath_run() with the handlers
+   resolved once (like a trace).
+ */
+
+static const struct uop	alu_flow[] = {
+	{.op=U_IMM,   .imm=0x1234,       .dst=16},
+	{.op=U_IMM,   .imm=7,            .dst=17},
+	{.op=U_ADD,   .s1=16, .s2=17, .dst=18, .width=UW_32, .flags=1},
+	{.op=U_SUB,   .s1=18, .s2=17, .dst=19, .width=UW_32, .flags=1},
+	{.op=U_AND,   .s1=18, .s2=16, .dst=20, .width=UW_16, .flags=1},
+	{.op=U_XOR,   .s1=19, .s2=20, .dst=21, .width=UW_32, .flags=1},
+	{.op=U_BIS,   .s1=21, .s2=17, .dst=22, .width=UW_8,  .flags=1},
+	{.op=U_ASHL,  .s1=22, .s2=17, .dst=23, .width=UW_32, .flags=1},
+	{.op=U_MOV,   .s1=23,         .dst=24, .width=UW_32, .flags=1},
+	{.op=U_CMP,   .s1=18, .s2=19,          .width=UW_32, .flags=1},
+	{.op=U_BCC,   .cc=U_CC_VS, .utarget=0x10, .flags=1},
+	{.op=U_INC,   .s1=24,         .dst=24, .width=UW_32},
+	{.op=U_DEC,   .s1=24,         .dst=24, .width=UW_16},
+	{.op=U_ZEROBL,.s1=24,         .dst=25, .width=UW_32, .flags=1},
+	{.op=U_BIC,   .s1=25, .s2=16, .dst=25, .width=UW_32, .flags=1},
+	{.op=U_NOP},
+};
+
+
+/* mode 0: datapath(), 1: pre-resolved, 2: compiled */
+static void time_dispatch_run(struct cpu *cpu, long n, int cnt, const struct uop flow[cnt],
+                              const void *h[cnt+1], int (*jit)(struct cpu *cpu), int mode)
+{
+	while (n--) {
+		int	utarget;
+
+		switch (mode) {
+		case 0:	utarget = datapath(cpu, cnt, flow);		break;
+		case 1:	utarget = datapath_run(cpu, cnt, flow, h);	break;
+		default:utarget = jit(cpu);				break;
+		}
+		if (utarget != UADDR_DONE)
+			assert(0);
+	}
+}
+
+
+static void time_dispatch()
+{
+	static struct cpu	cpu;
+
+	struct {
+		const char		*name;
+		const struct uop	*flow;
+		int			 cnt;
+	} work[] = {
+		{"alu  ", alu_flow,  ARRAY_SIZE(alu_flow)},
+		{"ld/st", ldst_flow, ARRAY_SIZE(ldst_flow)},
+	};
+	const char	*mode_name[] = {"datapath()  ", "pre-resolved", "jit         "};
+
+	cpu_init(&cpu);
+	mem_init(&cpu, 1024 * 1024);
+
+#ifdef DATAPATH_SWITCH
+	printf("Timing (switch dispatch)\n");
+#else
+	printf("Timing (threaded dispatch)\n");
+#endif
+	printf("------\n");
+
+	for (unsigned w=0; w < ARRAY_SIZE(work); w++)
+		for (int mode=0; mode < 3; mode++) {
+			const void	*h[MAXFLOWLEN+1];
+			int		(*jit)(struct cpu *cpu);
+			struct timespec	 start, stop;
+			long		 cnt = 0;
+
+			jit = jit_compile(&cpu, work[w].cnt, work[w].flow);
+			if ((mode == 2) && !jit)
+				continue;
+
+			/* same registers as time_ldst() */
+			cpu.r[1] = 0x1000;
+			cpu.r[2] = 0x2204;
+			cpu.r[3] = 0x3402;
+			cpu.r[4] = 0x4013;
+			cpu.r[5] = 0x5006;
+			cpu.r[6] = 0x6101;
+
+			datapath_resolve(work[w].cnt, work[w].flow, h);
+			time_dispatch_run(&cpu, 1000, work[w].cnt, work[w].flow, h, jit, mode);
+
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+			while (1) {
+				time_dispatch_run(&cpu, 10000, work[w].cnt, work[w].flow, h, jit, mode);
+				cnt += 10000;
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &stop);
+				if (timediff(start, stop) > 100000.0)
+					break;
+			}
+
+			printf("%s  %s  %6.2f ns/µop  %7.1f Mµops/s\n",
+				work[w].name,
+				mode_name[mode],
+				timediff(start, stop) * 1000.0 / work[w].cnt / cnt,
+				(double) work[w].cnt * cnt / timediff(start, stop));
+		}
+	printf("\n");
+}
+
+
+/***/
+
 static void help()
 {
 		fprintf(stderr,
 "revax-sim <binary>\n"
+"revax-sim --time-ldst\n"
+"revax-sim --time-dispatch\n"
+"revax-sim --decode-trace <file>\n"
+"revax-sim [--engine ucode|fast|lockstep] [--rom <file>] [--skip <n> | --skip-to <pc>]\n"
+"          [--detail <m> [--period <p>]] [--run-ahead] [--stats <report>]\n"
+"          [--profile <stacks> [--symbols <file>]]\n"
+"          [--trace <file> | --trace-last <file>] [--uop-profile <profile>] <binary>\n"
 "\n"
-"  inputs a VAX binary (raw or a.out) and runs it.\n");
+"  inputs a VAX binary (raw or a.out) and runs it.\n"
+"\n"
+"  --time-ldst      time ld/st µops with and without the access() fast path.\n"
+"  --time-dispatch  µops/s through the datapath dispatch (threaded or switch,\n"
+"                   chosen at build time with -DDATAPATH_SWITCH) and through\n"
+"                   JIT compiled code (x86-64 only, off with -DNO_JIT).\n"
+"  --engine         ucode: templates, traces and JIT (the default).  fast:\n"
+"                   interpret the integer instructions directly, the rest\n"
+"                   goes to the µcode.  lockstep: run both on each of those\n"
+"                   and stop at the first difference.  Known µcode bugs\n"
+"                   (ls_known[] in sim.c) aren't compared, only counted.\n"
+"  --rom            map a KA655 ROM at %04X_%04X and start there.  The fast\n"
+"                   engine runs the translation of vax-bin/ka655x.bin made\n"
+"                   at build time (revax-dis -c) for the pages that match.\n"
+"  --skip           fast-forward n instructions first: no --trace, --stats or\n"
+"                   --uop-profile, traces and JIT on.\n"
+"  --skip-to        fast-forward until the PC (hex) is reached.\n"
+"  --detail         then run m instructions on the µcode engine with those,\n"
+"                   and stop.\n"
+"  --period         don't stop, start a new window every p instructions.\n"
+"  --uop-profile    also write the µop pairs and triples that ran to <profile>\n"
+"                   (for uasm.pl --fuse).\n"
+"  --run-ahead      decode in a second thread that runs ahead of the datapath,\n"
+"                   instructions are passed through a lock-free ring.  No\n"
+"                   traces or JIT in this mode.\n"
+"  --stats          count how often each opcode, operand class, and ucode[]\n"
+"                   entry ran, write them to <report> at the end and on\n"
+"                   SIGUSR1 (misc/ucode-heat.pl annotates ucode.vu with it).\n"
+"  --profile        sample the guest PC and the CALLx frame chain %d times a\n"
+"                   second, write them to <stacks> as folded stacks (for\n"
+"                   flamegraph.pl).\n"
+"  --symbols        name the frames from an a.out or a revax-dis .map file.\n"
+"  --trace          write a binary trace of every instruction to <file> (one\n"
+"                   at a time, no traces or JIT in this mode).\n"
+"  --trace-last     only the last %d KB of it, also written on a crash.\n"
+"  --decode-trace   print a trace as a listing: PC, bytes, µops, registers and\n"
+"                   memory written.\n", SPLIT(ROM_BASE), PROF_HZ, TRC_BLOCKS * TRC_BLOCK / 1024);
 }
 
 
@@ -708,10 +6722,140 @@ static void help_exit()
 }
 
 
+/* ^C is a halt request -- the registers etc. still get printed */
+static struct cpu	*sigint_cpu;
+
+static void sigint(int sig)
+{
+	(void) sig;
+	events_post(sigint_cpu, EV_HALT);
+}
+
+
+/* SIGUSR1 -- write the --stats report and keep going */
+static void sigusr1(int sig)
+{
+	(void) sig;
+	events_post(sigint_cpu, EV_STATS);
+}
+
+
+/* SIGPROF -- take a --profile sample */
+static void sigprof(int sig)
+{
+	(void) sig;
+	events_post(sigint_cpu, EV_PROF);
+}
+
+
 int main(int argc, char *argv[])
 {
 	/* parse command line */
 
+	const char	*uprof_file = NULL;
+	const char	*rom_file   = NULL;
+	const char	*trc_name   = NULL;
+	bool		 trc_stream = false;
+	bool		 runahead   = false;
+	int		 engine     = ENG_UCODE;
+
+	if ((argc >= 4) && (strcmp(argv[1], "--engine") == 0)) {
+		if (strcmp(argv[2], "ucode") == 0)
+			engine = ENG_UCODE;
+		else if (strcmp(argv[2], "fast") == 0)
+			engine = ENG_FAST;
+		else if (strcmp(argv[2], "lockstep") == 0)
+			engine = ENG_LOCKSTEP;
+		else
+			help_exit();
+		argv += 2;
+		argc -= 2;
+	}
+
+	if ((argc >= 4) && (strcmp(argv[1], "--rom") == 0)) {
+		rom_file = argv[2];
+		argv    += 2;
+		argc    -= 2;
+	}
+
+	if ((argc >= 4) && (strcmp(argv[1], "--skip") == 0)) {
+		rc      = true;
+		rc_skip = strtoull(argv[2], NULL, 0);
+		argv   += 2;
+		argc   -= 2;
+	} else if ((argc >= 4) && (strcmp(argv[1], "--skip-to") == 0)) {
+		rc      = true;
+		rc_topc = true;
+		rc_pc   = strtoul(argv[2], NULL, 16);
+		argv   += 2;
+		argc   -= 2;
+	}
+
+	if ((argc >= 4) && (strcmp(argv[1], "--detail") == 0)) {
+		rc        = true;
+		rc_detail = strtoull(argv[2], NULL, 0);
+		argv     += 2;
+		argc     -= 2;
+	}
+
+	if ((argc >= 4) && (strcmp(argv[1], "--period") == 0)) {
+		rc_period = strtoull(argv[2], NULL, 0);
+		argv     += 2;
+		argc     -= 2;
+
+		/* a window has to end before the next one starts */
+		if (!rc_detail || (rc_period <= rc_detail))
+			help_exit();
+	}
+
+	if ((argc >= 3) && (strcmp(argv[1], "--run-ahead") == 0)) {
+		/* the ring only feeds the µcode engine */
+		if (engine != ENG_UCODE)
+			help_exit();
+		runahead = true;
+		argv    += 1;
+		argc    -= 1;
+	}
+
+	if ((argc >= 4) && (strcmp(argv[1], "--stats") == 0)) {
+		stats      = true;
+		stats_file = argv[2];
+		argv      += 2;
+		argc      -= 2;
+	}
+
+	if ((argc >= 4) && (strcmp(argv[1], "--profile") == 0)) {
+		prof      = true;
+		prof_file = argv[2];
+		argv     += 2;
+		argc     -= 2;
+	}
+
+	if (prof && (argc >= 4) && (strcmp(argv[1], "--symbols") == 0)) {
+		prof_symbols(argv[2]);
+		argv     += 2;
+		argc     -= 2;
+	}
+
+	if ((argc >= 4) && ((strcmp(argv[1], "--trace") == 0) || (strcmp(argv[1], "--trace-last") == 0))) {
+		trc_stream = strcmp(argv[1], "--trace") == 0;
+		trc_name   = argv[2];
+		argv      += 2;
+		argc      -= 2;
+	}
+
+	if ((argc == 4) && (strcmp(argv[1], "--uop-profile") == 0)) {
+		uprof      = true;
+		uprof_file = argv[2];
+		argv      += 2;
+		argc      -= 2;
+	}
+
+	if ((argc == 3) && (strcmp(argv[1], "--decode-trace") == 0)) {
+		trc_decode(argv[2]);
+		exit(0);
+	}
+
 	if (argc != 2)
 		help_exit();
 
@@ -724,15 +6868,63 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
-	struct cpu	cpu;
+	if (strcmp(argv[1], "--time-ldst") == 0) {
+		time_ldst();
+		exit(0);
+	}
 
-	/* disable stdout buffering so we still get output in case of seg faults */
-	setbuf(stdout, NULL);
+	if (strcmp(argv[1], "--time-dispatch") == 0) {
+		time_dispatch();
+		exit(0);
+	}
+
+	struct cpu	cpu;
 
 	cpu_init(&cpu);
 	mem_init(&cpu, 512 * 1024 * 1024);
-	cpu_program(&cpu);
+	if (rom_file) {
+		/* power-up: kernel mode on the interrupt stack, IPL 1F */
+		rom_load(&cpu, ROM_BASE, rom_file);
+		rx_init(&cpu);
+		cpu.r[15]    = ROM_BASE;
+		cpu.r[R_PSL] = (1u << 26) | (0x1F << 16);
+	} else {
+		cpu_program(&cpu);
+	}
+	cpu.engine = engine;
+	if (trc_name)
+		trc_start(trc_name, trc_stream);
+	if (rc)
+		rc_init(&cpu);
+	sigint_cpu = &cpu;
+	signal(SIGINT, sigint);
+	if (stats)
+		signal(SIGUSR1, sigusr1);
+
+	struct itimerval	prof_it = {
+		.it_interval = {.tv_usec = 1000000 / PROF_HZ},
+		.it_value    = {.tv_usec = 1000000 / PROF_HZ},
+	};
+
+	if (prof) {
+		signal(SIGPROF, sigprof);
+		setitimer(ITIMER_PROF, &prof_it, NULL);
+	}
+	if (runahead)
+		ra_start(&cpu);
 	cpu_run(&cpu);
+	if (runahead)
+		ra_stop(&cpu);
+	if (uprof)
+		uprof_dump(uprof_file);
+	if (stats)
+		stats_dump();
+	if (prof) {
+		setitimer(ITIMER_PROF, &(struct itimerval) {}, NULL);
+		prof_dump();
+	}
+	if (trc_file)
+		trc_stop();
 
 	return EXIT_SUCCESS;
 }
@@ -10,6 +10,11 @@
 #
 #   misc/uasm-experiment.pl < src/ucode.vu > src/vax-ucodex.h
 #
+#   src/uasm.pl --fuse <profile> < src/ucode.vu > src/vax-ucode.h
+#
+# --fuse reads a µop profile from 'revax-sim --uop-profile' and turns the most
+# frequent µop pairs and triples into superinstructions, see write_fuse().
+#
 
 use strict;
 use warnings;
@@ -437,6 +442,11 @@ my $imm_placeholder = 0x1234;
 # bit flag set on utarget iff the bcc/exc is exc
 my $exc_flag = 0x8000;
 
+# µop profile for superinstructions (--fuse) + how many of each to make
+my $fuse_file;
+my $fuse_pairs   = 8;
+my $fuse_triples = 4;
+
 
 ###
 
@@ -667,6 +677,18 @@ sub clabel($) {
 }
 
 
+# C name of a µop
+sub cuop($) {
+	my ($mne) = @_;
+
+	my $name = uc $mne;
+	$name = 'INC'   if $name eq '++';
+	$name = 'DEC'   if $name eq '--';
+	$name = 'INDEX' if $name eq '[]';
+	return "U_$name";
+}
+
+
 sub write_tables() {
 	printf "/* Microcode-related tables -- autogenerated by 'uasm.pl < ucode.vu'\n";
 	printf "   (uasm.pl also reads uops.spec)\n";
@@ -682,11 +704,7 @@ sub write_tables() {
 	printf "enum uopcode {\n";
 	foreach my $v (sort {$a <=> $b} values %uop_no) {
 		my %rev_uop_no = reverse %uop_no;
-		my $name = uc $rev_uop_no{$v};
-		$name = 'INC'   if $name eq '++';
-		$name = 'DEC'   if $name eq '--';
-		$name = 'INDEX' if $name eq '[]';
-		printf "\t%-10s\t= %2d,\n", "U_$name", $v;
+		printf "\t%-10s\t= %2d,\n", cuop($rev_uop_no{$v}), $v;
 	}
 	printf "};\n";
 	printf "\n";
@@ -833,15 +851,25 @@ sub write_tables() {
 	printf "\n";
 	printf "#define MAXFLOWLEN	%d\n", $maxflowlen;
 	printf "\n";
+	printf "/* packed into 64 bits -- imm overlaps s1/s2/cc/utarget, only the imm µop\n";
+	printf "   uses it and it doesn't have any of those.\n";
+	printf " */\n";
 	printf "struct uop {\n";
-	printf "\tenum uopcode\top;\n";
-	printf "\tuint32_t\timm;\n";
-	printf "\tint\t\ts1, s2, dst;\n";
-	printf "\tuint16_t\tutarget;\n";
-	printf "\tint\t\tcc;\n";
-	printf "\tint\t\tflags;  /* 0=arch, 1=µ */\n";
-	printf "\tenum width\twidth;\n";
-	printf "\t_Bool\t\tlast;\n";
+	printf "\tunsigned\top:6;\t/* enum uopcode */\n";
+	printf "\tunsigned\tdst:6;\n";
+	printf "\tunsigned\twidth:3;\t/* enum width */\n";
+	printf "\tunsigned\tflags:1;\t/* 0=arch, 1=µ */\n";
+	printf "\tunsigned\tlast:1;\n";
+	printf "\tunsigned\t:0;\n";
+	printf "\n";
+	printf "\tunion {\n";
+	printf "\t\tuint32_t\timm;\n";
+	printf "\t\tstruct {\n";
+	printf "\t\t\tunsigned\ts1:6, s2:6;\n";
+	printf "\t\t\tunsigned\tcc:4;\n";
+	printf "\t\t\tunsigned\tutarget:16;\n";
+	printf "\t\t};\n";
+	printf "\t};\n";
 	printf "} ucode[%d] = {\n", scalar @ucode;
 	for (my $i=0; $i < scalar @ucode; $i++) {
 		if ($i % 10 == 0) {
@@ -974,6 +1002,16 @@ foreach my $k ('s1', 's2', 'dst', 'imm', 'cc', 'utarget') {
 	print "\n";
 	print "\n";
 
+	# ulineno[]
+	printf "/* ucode.vu line of each ucode[] entry (revax-sim --stats) */\n";
+	printf "const unsigned short ulineno[%d] = {", scalar @ucode;
+	for (my $i=0; $i < scalar @ucode; $i++) {
+		printf "%s%4d,", ($i % 10 == 0) ? "\n\t" : " ", $lineno[$i];
+	}
+	printf "\n};\n";
+	print "\n";
+	print "\n";
+
 	# µcode labels
 	printf "/* microcode labels -- exceptions (used by sim.c for some µops) */\n";
 	foreach my $s (sort keys(%lbls)) {
@@ -1048,11 +1086,68 @@ foreach my $k ('s1', 's2', 'dst', 'imm', 'cc', 'utarget') {
 
 	printf "\n\n";
 
+	write_fuse();
+
 	print "#endif /* VAX_UCODE__H */\n";
 	printf "\n\n";
 }
 
 
+# superinstructions
+#
+# The profile has one line per µop sequence:
+#
+#   pair    <count>  <µop> <µop>
+#   triple  <count>  <µop> <µop> <µop>
+#
+# The most frequent ones become X(n, U_xxx, U_yyy) entries in UFUSE_PAIRS and
+# UFUSE_TRIPLES, the simulator builds the handlers from those.  Without
+# --fuse, both lists are empty.
+sub write_fuse() {
+	my @pairs   = ();
+	my @triples = ();
+
+	if (defined $fuse_file) {
+		open(my $f, '<', $fuse_file) or die "can't open |$fuse_file|: $!\n";
+		while (my $line = <$f>) {
+			$line =~ s/#.*$//;
+			next if $line =~ /^\s*$/;
+
+			my ($kind, $cnt, @ops) = split ' ', $line;
+			die "|$line| is not a valid profile line, $fuse_file line $..\n"
+				unless ($kind eq 'pair'   and @ops == 2) or
+				       ($kind eq 'triple' and @ops == 3);
+			foreach my $op (@ops) {
+				die "|$op| is not a µop, $fuse_file line $..\n" unless exists $uop_no{$op};
+			}
+
+			push @pairs,   [$cnt, @ops] if $kind eq 'pair';
+			push @triples, [$cnt, @ops] if $kind eq 'triple';
+		}
+		close $f;
+
+		@pairs   = sort {$b->[0] <=> $a->[0]} @pairs;
+		@triples = sort {$b->[0] <=> $a->[0]} @triples;
+		splice(@pairs,   $fuse_pairs)   if @pairs   > $fuse_pairs;
+		splice(@triples, $fuse_triples) if @triples > $fuse_triples;
+	}
+
+	printf "/* µop superinstructions -- X(n, µop, µop[, µop]), see datapath_resolve() */\n";
+	foreach my $list (['UFUSE_PAIRS', \@pairs], ['UFUSE_TRIPLES', \@triples]) {
+		my ($name, $seqs) = @$list;
+		my @lines = ("#define $name(X)");
+
+		for (my $n = 0; $n < @$seqs; $n++) {
+			my ($cnt, @ops) = @{$seqs->[$n]};
+
+			push @lines, sprintf "\tX(%d, %s)\t/* %10d */", $n, join(', ', map {cuop($_)} @ops), $cnt;
+		}
+		printf "%s\n", join(" \\\n", @lines);
+	}
+	printf "\n\n";
+}
+
+
 sub write_stats() {
 	# summary of µcode stats
 	#
@@ -1162,6 +1257,12 @@ sub write_stats() {
 
 ###
 
+if (@ARGV and $ARGV[0] eq '--fuse') {
+	die "--fuse needs a profile.\n" unless @ARGV >= 2;
+	shift @ARGV;
+	$fuse_file = shift @ARGV;
+}
+
 read_spec();
 read_ucode();
 patch_jumps();